@@ -112,8 +112,18 @@ enum transaction_flags {
 	TF_ROOT_OBJECT	= 0x04,	/* contents are the component's root object */
 	TF_STATUS_CODE	= 0x08,	/* contents are a 32-bit status code */
 	TF_ACCEPT_FDS	= 0x10,	/* allow replies with file descriptors */
+	TF_ZERO_COPY	= 0x20,	/* share payload pages instead of copying */
 };
 
+/*
+ * With TF_ZERO_COPY, whole pages of a large payload that lies in a
+ * mapping of a sealed ashmem area are mapped into the target's buffer
+ * instead of copied; everything else is still copied.  Sealed means the
+ * area's prot mask no longer allows PROT_WRITE, none of its shared
+ * mappings can be written through and the payload's pages are pinned.
+ * The area cannot be purged until the target has freed the buffer.
+ */
+
 struct binder_transaction_data {
 	/* The first two are only used for bcTRANSACTION and brTRANSACTION,
 	 * identifying the target and contents of the transaction.
@@ -21,10 +21,13 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/miscdevice.h>
+#include <linux/mm.h>
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/time.h>
+#include <linux/vmalloc.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
@@ -33,30 +36,42 @@
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting. The offsets and the reader list are
+ * protected by the spinlock 'lock'; the contents of the buffer are not.
+ *
+ * Writers reserve space for an entry under 'lock', write its header, and then
+ * copy the payload with no lock held, so concurrent writers copy in parallel
+ * and readers are never blocked behind a writer that faults on its user
+ * buffer. Space between 'c_off' and 'w_off' belongs to writers that have not
+ * finished yet; 'c_off' catches up with 'w_off' whenever the last of them
+ * finishes, and readers never read past 'c_off'.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
 	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
+	spinlock_t		lock;	/* lock protecting the offsets */
 	size_t			w_off;	/* current write head offset */
+	size_t			c_off;	/* committed write head offset */
+	int			writers; /* writers still copying */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+	struct logger_mmap_header *hdr;	/* positions shared with mmap readers */
 };
 
 /*
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by log->lock.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
 	size_t			r_off;	/* current read head offset */
+	unsigned int		laps;	/* times pulled forward by a writer */
+	int			batch;	/* read as many entries as fit */
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
@@ -89,7 +104,7 @@ static inline struct logger_log *file_get_log(struct file *file)
  * get_entry_len - Grabs the length of the payload of the next entry starting
  * from 'off'.
  *
- * Caller needs to hold log->mutex.
+ * Caller needs to hold log->lock.
  */
 static __u32 get_entry_len(struct logger_log *log, size_t off)
 {
@@ -108,25 +123,47 @@ static __u32 get_entry_len(struct logger_log *log, size_t off)
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * get_batch_len - returns the length of the longest run of whole entries
+ * starting at 'off' that fits in 'count' bytes, or zero if the first one
+ * does not.
+ *
+ * Caller needs to hold log->lock.
+ */
+static size_t get_batch_len(struct logger_log *log, size_t off, size_t count)
+{
+	size_t len = 0;
+
+	while (off != log->c_off) {
+		size_t nr = get_entry_len(log, off);
+
+		if (len + nr > count)
+			break;
+		len += nr;
+		off = logger_offset(off + nr);
+	}
+
+	return len;
+}
+
+/*
+ * do_read_log_to_user - reads exactly 'count' bytes at offset 'off' from 'log'
+ * into the user-space buffer 'buf'. Returns 'count' on success.
  *
- * Caller must hold log->mutex.
+ * Called without log->lock, so a writer may overwrite the data while it is
+ * being copied; see reader_advance().
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static ssize_t do_read_log_to_user(struct logger_log *log, size_t off,
+				   char __user *buf, size_t count)
 {
 	size_t len;
 
 	/*
 	 * We read from the log in two disjoint operations. First, we read from
-	 * the current read head offset up to 'count' bytes or to the end of
-	 * the log, whichever comes first.
+	 * the given offset up to 'count' bytes or to the end of the log,
+	 * whichever comes first.
 	 */
-	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
+	len = min(count, log->size - off);
+	if (copy_to_user(buf, log->buffer + off, len))
 		return -EFAULT;
 
 	/*
@@ -137,11 +174,27 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 		if (copy_to_user(buf + len, log->buffer, count - len))
 			return -EFAULT;
 
-	reader->r_off = logger_offset(reader->r_off + count);
-
 	return count;
 }
 
+/*
+ * reader_advance - moves 'reader' past the 'count' bytes it copied starting at
+ * 'off' while it was pulled forward 'laps' times. Returns zero if a writer
+ * lapped the reader during the copy, in which case the copy may be torn and
+ * has to be redone from the reader's new offset.
+ *
+ * Caller must hold log->lock.
+ */
+static int reader_advance(struct logger_log *log, struct logger_reader *reader,
+			  size_t off, unsigned int laps, size_t count)
+{
+	if (reader->r_off != off || reader->laps != laps)
+		return 0;
+
+	reader->r_off = logger_offset(off + count);
+	return 1;
+}
+
 /*
  * logger_read - our log's read() method
  *
@@ -149,16 +202,19 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
  *
  * 	- O_NONBLOCK works
  * 	- If there are no log entries to read, blocks until log is written to
- * 	- Atomically reads exactly one log entry
+ * 	- Atomically reads exactly one log entry, or in batch mode as many
+ * 	  whole entries as fit in the buffer
  *
- * Optimal read size is LOGGER_ENTRY_MAX_LEN. Will set errno to EINVAL if read
- * buffer is insufficient to hold next entry.
+ * Optimal read size is LOGGER_ENTRY_MAX_LEN, or the log size in batch mode.
+ * Will set errno to EINVAL if read buffer is insufficient to hold next entry.
  */
 static ssize_t logger_read(struct file *file, char __user *buf,
 			   size_t count, loff_t *pos)
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	unsigned int laps;
+	size_t off;
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
@@ -166,9 +222,9 @@ start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		spin_lock(&log->lock);
+		ret = (log->c_off == reader->r_off);
+		spin_unlock(&log->lock);
 		if (!ret)
 			break;
 
@@ -189,26 +245,35 @@ start:
 	if (ret)
 		return ret;
 
-	mutex_lock(&log->mutex);
+	spin_lock(&log->lock);
 
 	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
+	if (unlikely(log->c_off == reader->r_off)) {
+		spin_unlock(&log->lock);
 		goto start;
 	}
 
-	/* get the size of the next entry */
+	/* get the size of the next entry, or of the entries that fit */
 	ret = get_entry_len(log, reader->r_off);
-	if (count < ret) {
-		ret = -EINVAL;
-		goto out;
-	}
-
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	if (reader->batch && count >= ret)
+		ret = get_batch_len(log, reader->r_off, count);
+	off = reader->r_off;
+	laps = reader->laps;
+	spin_unlock(&log->lock);
+	if (count < ret)
+		return -EINVAL;
+
+	/* get exactly one entry, or the whole batch, from the log */
+	ret = do_read_log_to_user(log, off, buf, ret);
+	if (ret < 0)
+		return ret;
 
-out:
-	mutex_unlock(&log->mutex);
+	spin_lock(&log->lock);
+	if (!reader_advance(log, reader, off, laps, ret)) {
+		spin_unlock(&log->lock);
+		goto start;
+	}
+	spin_unlock(&log->lock);
 
 	return ret;
 }
@@ -217,7 +282,7 @@ out:
  * get_next_entry - return the offset of the first valid entry at least 'len'
  * bytes after 'off'.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->lock.
  */
 static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
 {
@@ -255,7 +320,7 @@ static inline int clock_interval(size_t a, size_t b, size_t c)
  * We do this by "pulling forward" the readers and start head to the first
  * entry after the new write head.
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
 static void fix_up_readers(struct logger_log *log, size_t len)
 {
@@ -263,18 +328,52 @@ static void fix_up_readers(struct logger_log *log, size_t len)
 	size_t new = logger_offset(old + len);
 	struct logger_reader *reader;
 
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	if (clock_interval(old, new, log->head)) {
+		size_t head = get_next_entry(log, log->head, len);
+
+		log->hdr->head += logger_offset(head - log->head);
+		log->head = head;
+		/*
+		 * mmap readers must see the new head before the overwritten
+		 * entries; pairs with the smp_rmb() described at
+		 * struct logger_mmap_header.
+		 */
+		smp_wmb();
+	}
 
 	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
+		if (clock_interval(old, new, reader->r_off)) {
 			reader->r_off = get_next_entry(log, reader->r_off, len);
+			reader->laps++;
+		}
+}
+
+/*
+ * logger_pending - returns the number of bytes reserved by writers that have
+ * not finished copying yet.
+ *
+ * The caller needs to hold log->lock.
+ */
+static inline size_t logger_pending(struct logger_log *log)
+{
+	return logger_offset(log->w_off - log->c_off);
+}
+
+/*
+ * logger_can_reserve - can 'len' more bytes be reserved without the new entry,
+ * or the walk fix_up_readers() does past it, reaching data that writers are
+ * still copying? Only fails when the log is tiny compared to the number of
+ * concurrent writers.
+ */
+static inline int logger_can_reserve(struct logger_log *log, size_t len)
+{
+	return logger_pending(log) + len + LOGGER_ENTRY_MAX_LEN <= log->size;
 }
 
 /*
  * do_write_log - writes 'len' bytes from 'buf' to 'log'
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
 static void do_write_log(struct logger_log *log, const void *buf, size_t count)
 {
@@ -292,30 +391,43 @@ static void do_write_log(struct logger_log *log, const void *buf, size_t count)
 
 /*
  * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
+ * the log 'log' at offset 'off', which the caller reserved
  *
- * The caller needs to hold log->mutex.
+ * Called without log->lock.
  *
  * Returns 'count' on success, negative error code on failure.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
+static ssize_t do_write_log_from_user(struct logger_log *log, size_t off,
 				      const void __user *buf, size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
+	len = min(count, log->size - off);
+	if (len && copy_from_user(log->buffer + off, buf, len))
 		return -EFAULT;
 
 	if (count != len)
 		if (copy_from_user(log->buffer, buf + len, count - len))
 			return -EFAULT;
 
-	log->w_off = logger_offset(log->w_off + count);
-
 	return count;
 }
 
+/*
+ * clear_log - zeroes 'count' bytes of 'log' at offset 'off', which the caller
+ * reserved
+ */
+static void clear_log(struct logger_log *log, size_t off, size_t count)
+{
+	size_t len;
+
+	len = min(count, log->size - off);
+	memset(log->buffer + off, 0, len);
+
+	if (count != len)
+		memset(log->buffer, 0, count - len);
+}
+
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
@@ -325,7 +437,7 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
+	size_t orig, off, end, len;
 	struct logger_entry header;
 	struct timespec now;
 	ssize_t ret = 0;
@@ -342,7 +454,18 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
+	len = sizeof(struct logger_entry) + header.len;
+
+	spin_lock(&log->lock);
+
+	while (unlikely(!logger_can_reserve(log, len))) {
+		spin_unlock(&log->lock);
+		ret = wait_event_interruptible(log->wq,
+					       logger_can_reserve(log, len));
+		if (ret)
+			return ret;
+		spin_lock(&log->lock);
+	}
 
 	/*
 	 * Fix up any readers, pulling them forward to the first readable
@@ -350,30 +473,61 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	 * because if we partially fail, we can end up with clobbered log
 	 * entries that encroach on readable buffer.
 	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
+	fix_up_readers(log, len);
 
+	/* reserve the entry; the header goes in now so it can be walked */
+	orig = log->w_off;
 	do_write_log(log, &header, sizeof(struct logger_entry));
+	off = log->w_off;
+	end = logger_offset(off + header.len);
+	log->w_off = end;
+	log->writers++;
 
-	while (nr_segs-- > 0) {
-		size_t len;
+	spin_unlock(&log->lock);
+
+	while (nr_segs-- > 0 && ret < header.len) {
+		size_t seg;
 		ssize_t nr;
 
 		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
+		seg = min_t(size_t, iov->iov_len, header.len - ret);
 
 		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
+		nr = do_write_log_from_user(log, logger_offset(off + ret),
+					    iov->iov_base, seg);
 		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+			ret = nr;
+			break;
 		}
 
 		iov++;
 		ret += nr;
 	}
 
-	mutex_unlock(&log->mutex);
+	spin_lock(&log->lock);
+
+	if (unlikely(ret < 0)) {
+		/*
+		 * Drop the entry if nobody reserved space after it, otherwise
+		 * it has to stay so the entries after it can be found.
+		 */
+		if (log->w_off == end)
+			log->w_off = orig;
+		else
+			clear_log(log, off, header.len);
+	}
+
+	if (--log->writers == 0) {
+		/*
+		 * mmap readers read the entries lockless once tail covers
+		 * them; pairs with the smp_rmb() after a reader reads tail.
+		 */
+		smp_wmb();
+		log->hdr->tail += logger_pending(log);
+		log->c_off = log->w_off;
+	}
+
+	spin_unlock(&log->lock);
 
 	/* wake up any blocked readers */
 	wake_up_interruptible(&log->wq);
@@ -409,12 +563,14 @@ static int logger_open(struct inode *inode, struct file *file)
 			return -ENOMEM;
 
 		reader->log = log;
+		reader->laps = 0;
+		reader->batch = 0;
 		INIT_LIST_HEAD(&reader->list);
 
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		reader->r_off = log->head;
 		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 
 		file->private_data = reader;
 	} else
@@ -432,7 +588,11 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
+		struct logger_log *log = reader->log;
+
+		spin_lock(&log->lock);
 		list_del(&reader->list);
+		spin_unlock(&log->lock);
 		kfree(reader);
 	}
 
@@ -462,10 +622,10 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	spin_lock(&log->lock);
+	if (log->c_off != reader->r_off)
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
@@ -476,7 +636,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	struct logger_reader *reader;
 	long ret = -ENOTTY;
 
-	mutex_lock(&log->mutex);
+	spin_lock(&log->lock);
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -488,10 +648,10 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
+		if (log->c_off >= reader->r_off)
+			ret = log->c_off - reader->r_off;
 		else
-			ret = (log->size - reader->r_off) + log->w_off;
+			ret = (log->size - reader->r_off) + log->c_off;
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -499,7 +659,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off != reader->r_off)
+		if (log->c_off != reader->r_off)
 			ret = get_entry_len(log, reader->r_off);
 		else
 			ret = 0;
@@ -509,21 +669,58 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
+		/* entries still being written survive the flush */
 		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+			reader->r_off = log->c_off;
+		log->head = log->c_off;
+		log->hdr->head = log->hdr->tail;
+		ret = 0;
+		break;
+	case LOGGER_SET_READ_BATCH:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		reader->batch = !!arg;
 		ret = 0;
 		break;
 	}
 
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
 
+/*
+ * logger_mmap - the log's mmap file operation
+ *
+ * Maps the header page and, after it, the log itself read-only, so a reader
+ * can drain the log without a system call per batch; see
+ * struct logger_mmap_header. Only readers may map the log.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_log *log = file_get_log(file);
+	unsigned long size = vma->vm_end - vma->vm_start;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EBADF;
+	if (vma->vm_pgoff || size != PAGE_SIZE + log->size)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_DONTEXPAND;
+
+	return remap_vmalloc_range(vma, log->hdr, 0);
+}
+
 static const struct file_operations logger_fops = {
 	.owner = THIS_MODULE,
 	.read = logger_read,
+	.mmap = logger_mmap,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
 	.unlocked_ioctl = logger_ioctl,
@@ -534,13 +731,11 @@ static const struct file_operations logger_fops = {
 
 /*
  * Defines a log structure with name 'NAME' and a size of 'SIZE' bytes, which
- * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, and less than
- * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
+ * must be a power of two, at least PAGE_SIZE, greater than
+ * LOGGER_ENTRY_MAX_LEN, and less than LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
 static struct logger_log VAR = { \
-	.buffer = _buf_ ## VAR, \
 	.misc = { \
 		.minor = MISC_DYNAMIC_MINOR, \
 		.name = NAME, \
@@ -549,8 +744,10 @@ static struct logger_log VAR = { \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
 	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
 	.w_off = 0, \
+	.c_off = 0, \
+	.writers = 0, \
 	.head = 0, \
 	.size = SIZE, \
 };
@@ -577,10 +774,19 @@ static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	/* the header page and the log, in the order they are mapped */
+	log->hdr = vmalloc_user(PAGE_SIZE + log->size);
+	if (unlikely(!log->hdr))
+		return -ENOMEM;
+	log->buffer = (unsigned char *)log->hdr + PAGE_SIZE;
+	log->hdr->size = log->size;
+	log->hdr->data_offset = PAGE_SIZE;
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
 		       "device for log '%s'!\n", log->misc.name);
+		vfree(log->hdr);
 		return ret;
 	}
 
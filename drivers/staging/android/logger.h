@@ -30,6 +30,31 @@ struct logger_entry {
 	char		msg[0];	/* the entry's payload */
 };
 
+/*
+ * struct logger_mmap_header - the first page of a read-only mmap() of a log;
+ * the log itself follows at 'data_offset'.
+ *
+ * Positions count bytes ever written to the log and wrap at 2^32; the offset
+ * of position 'pos' in the log is 'pos & (size - 1)'. Entries between 'head'
+ * and 'tail' are complete. A reader copies entries out starting at its own
+ * position, then re-reads 'head': if it moved past the start of the copy, a
+ * writer lapped the reader and overwrote the data mid-copy, so it has to
+ * continue from 'head' instead. poll() does not know where such a reader is,
+ * so it has to pace itself.
+ *
+ * The kernel moves 'head' before it overwrites entries and moves 'tail' after
+ * it has written them, with a write barrier in each case. A reader therefore
+ * needs a read barrier (smp_rmb() or equivalent) between reading 'tail' and
+ * copying the entries, and another between copying them and re-reading
+ * 'head'.
+ */
+struct logger_mmap_header {
+	__u32		head;	/* position of the oldest entry */
+	__u32		tail;	/* position after the newest complete entry */
+	__u32		size;	/* size of the log, a power of two */
+	__u32		data_offset; /* offset of the log in the mapping */
+};
+
 #define LOGGER_LOG_RADIO	"log_radio"	/* radio-related messages */
 #define LOGGER_LOG_EVENTS	"log_events"	/* system/hardware events */
 #define LOGGER_LOG_SYSTEM	"log_system"	/* system/framework messages */
@@ -45,5 +70,6 @@ struct logger_entry {
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_SET_READ_BATCH		_IO(__LOGGERIO, 5) /* many entries/read */
 
 #endif /* _LINUX_LOGGER_H */
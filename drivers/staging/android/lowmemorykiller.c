@@ -16,6 +16,19 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Processes are kept on one list per oom_adj value, so picking a victim only
+ * looks at the processes in the highest populated bucket that may be killed,
+ * and a pass that found nothing to kill is not repeated until a process comes,
+ * goes or changes its oom_adj. The time spent selecting victims is shown in
+ * lowmemorykiller/select_cost in debugfs.
+ *
+ * Reading /dev/mempressure returns the current memory pressure level, and
+ * poll() on it signals when the level changes, so services can drop caches
+ * before anything gets killed. The level is the number of minfree thresholds
+ * that free memory is within pressure_margin percent of, plus one if reclaim
+ * recently freed fewer than pressure_efficiency percent of the pages it
+ * scanned.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -35,6 +48,15 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
+#include <linux/vmstat.h>
+#include <linux/workqueue.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -54,6 +76,54 @@ static int lowmem_minfree_size = 4;
 
 static struct task_struct *lowmem_deathpending;
 
+#define LOWMEM_BUCKETS		(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+#define lowmem_bucket(adj)	(&lowmem_procs[(adj) - OOM_DISABLE])
+
+/*
+ * Thread group leaders by signal->oom_adj. Like the process list itself
+ * the lists are protected by tasklist_lock. They are filled in by
+ * lowmem_init(); until then the hooks do nothing. lowmem_gen changes
+ * whenever the lists do.
+ */
+static struct list_head lowmem_procs[LOWMEM_BUCKETS];
+static int lowmem_ready;
+static unsigned int lowmem_gen;
+
+/*
+ * The last pass that found nothing to kill at lowmem_miss_adj; the same pass
+ * is not repeated for lowmem_miss_adj or higher until the lists change or a
+ * second has passed, because processes can grow in between. This, the
+ * cost histogram and the pressure state are protected by lowmem_lock, as
+ * shrinkers run concurrently.
+ */
+static DEFINE_SPINLOCK(lowmem_lock);
+static unsigned int lowmem_miss_gen;
+static int lowmem_miss_adj = OOM_ADJUST_MAX + 1;
+static unsigned long lowmem_miss_time;
+
+/* Histogram of victim selection times, bucket n counts < 2^(n + 9) ns */
+#define LOWMEM_COST_BUCKETS	16
+static unsigned long lowmem_select_cost[LOWMEM_COST_BUCKETS];
+
+/*
+ * The pressure level is re-evaluated at most every LOWMEM_PRESSURE_INTERVAL
+ * from the shrinker, and every LOWMEM_PRESSURE_RECHECK while it is raised so
+ * that readers hear about the pressure going away as well.
+ */
+#define LOWMEM_PRESSURE_INTERVAL	(HZ / 10)
+#define LOWMEM_PRESSURE_RECHECK		HZ
+static int lowmem_pressure_margin = 25;
+static int lowmem_pressure_efficiency = 25;
+static int lowmem_pressure_level;
+static unsigned int lowmem_pressure_seq;
+static unsigned long lowmem_pressure_time;
+static unsigned long lowmem_pressure_scanned;
+static unsigned long lowmem_pressure_stolen;
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_pressure_wait);
+
+static void lowmem_pressure_workfn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(lowmem_pressure_work, lowmem_pressure_workfn);
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
@@ -63,6 +133,58 @@ static struct task_struct *lowmem_deathpending;
 static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data);
 
+static int lowmem_oom_adj(struct task_struct *p)
+{
+	int oom_adj = p->signal->oom_adj;
+
+	return clamp(oom_adj, OOM_DISABLE, OOM_ADJUST_MAX);
+}
+
+/* The hooks below are called with tasklist_lock write-locked */
+void lowmem_add_process(struct task_struct *p)
+{
+	if (lowmem_ready) {
+		list_add_tail(&p->lowmem_node,
+			      lowmem_bucket(lowmem_oom_adj(p)));
+		lowmem_gen++;
+	}
+}
+
+void lowmem_del_process(struct task_struct *p)
+{
+	if (lowmem_ready) {
+		list_del(&p->lowmem_node);
+		lowmem_gen++;
+	}
+}
+
+void lowmem_replace_process(struct task_struct *old, struct task_struct *new)
+{
+	if (lowmem_ready) {
+		list_replace(&old->lowmem_node, &new->lowmem_node);
+		lowmem_gen++;
+	}
+}
+
+/*
+ * Called without locks after 'p's oom_adj was written. Reads oom_adj again
+ * under tasklist_lock so racing writers leave the process in the right
+ * bucket. oom_adj writes are rare enough for the write lock.
+ */
+void lowmem_adj_changed(struct task_struct *p)
+{
+	struct task_struct *leader;
+
+	write_lock_irq(&tasklist_lock);
+	leader = p->group_leader;
+	if (lowmem_ready && pid_alive(leader)) {
+		list_move_tail(&leader->lowmem_node,
+			       lowmem_bucket(lowmem_oom_adj(leader)));
+		lowmem_gen++;
+	}
+	write_unlock_irq(&tasklist_lock);
+}
+
 static struct notifier_block task_nb = {
 	.notifier_call	= task_notify_func,
 };
@@ -78,6 +200,95 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 	return NOTIFY_OK;
 }
 
+#ifdef CONFIG_VM_EVENT_COUNTERS
+/* Sums the per-zone reclaim counters without taking the hotplug lock */
+static void lowmem_reclaim_events(unsigned long *scanned, unsigned long *stolen)
+{
+	int cpu, zone;
+
+	*scanned = 0;
+	*stolen = 0;
+	for_each_possible_cpu(cpu) {
+		struct vm_event_state *this = &per_cpu(vm_event_states, cpu);
+
+		for (zone = 0; zone < MAX_NR_ZONES; zone++) {
+			*scanned += this->event[PGSCAN_KSWAPD_NORMAL -
+						ZONE_NORMAL + zone];
+			*scanned += this->event[PGSCAN_DIRECT_NORMAL -
+						ZONE_NORMAL + zone];
+			*stolen += this->event[PGSTEAL_NORMAL -
+					       ZONE_NORMAL + zone];
+		}
+	}
+}
+#else
+static void lowmem_reclaim_events(unsigned long *scanned, unsigned long *stolen)
+{
+	*scanned = 0;
+	*stolen = 0;
+}
+#endif
+
+static void lowmem_update_pressure(int other_free, int other_file)
+{
+	unsigned long scanned, stolen;
+	int level = 0;
+	int changed;
+	int i;
+
+	if (time_before(jiffies,
+			lowmem_pressure_time + LOWMEM_PRESSURE_INTERVAL))
+		return;
+
+	for (i = 0; i < lowmem_minfree_size; i++) {
+		size_t limit = lowmem_minfree[i] +
+			lowmem_minfree[i] * lowmem_pressure_margin / 100;
+
+		if (other_free < limit && other_file < limit)
+			level++;
+	}
+
+	lowmem_reclaim_events(&scanned, &stolen);
+
+	spin_lock(&lowmem_lock);
+	if (level && scanned != lowmem_pressure_scanned &&
+	    (stolen - lowmem_pressure_stolen) * 100 <
+	    (scanned - lowmem_pressure_scanned) * lowmem_pressure_efficiency)
+		level++;
+	lowmem_pressure_scanned = scanned;
+	lowmem_pressure_stolen = stolen;
+	lowmem_pressure_time = jiffies;
+	changed = level != lowmem_pressure_level;
+	if (changed) {
+		lowmem_pressure_level = level;
+		lowmem_pressure_seq++;
+	}
+	spin_unlock(&lowmem_lock);
+
+	if (changed) {
+		lowmem_print(3, "memory pressure level %d, ofree %d %d\n",
+			     level, other_free, other_file);
+		wake_up_interruptible(&lowmem_pressure_wait);
+	}
+	if (level)
+		schedule_delayed_work(&lowmem_pressure_work,
+				      LOWMEM_PRESSURE_RECHECK);
+}
+
+static void lowmem_pressure_workfn(struct work_struct *work)
+{
+	lowmem_update_pressure(global_page_state(NR_FREE_PAGES),
+			       global_page_state(NR_FILE_PAGES));
+}
+
+static void lowmem_account_cost(ktime_t start)
+{
+	s64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	int i = fls64(ns >> 9);
+
+	lowmem_select_cost[min(i, LOWMEM_COST_BUCKETS - 1)]++;
+}
+
 static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 {
 	struct task_struct *p;
@@ -85,12 +296,15 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	int rem = 0;
 	int tasksize;
 	int i;
+	int adj;
+	int unchanged;
 	int min_adj = OOM_ADJUST_MAX + 1;
 	int selected_tasksize = 0;
 	int selected_oom_adj;
 	int array_size = ARRAY_SIZE(lowmem_adj);
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES);
+	ktime_t start;
 
 	/*
 	 * If we already have a death outstanding, then
@@ -99,6 +313,8 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	 * this pass.
 	 *
 	 */
+	lowmem_update_pressure(other_free, other_file);
+
 	if (lowmem_deathpending)
 		return 0;
 
@@ -126,43 +342,57 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 			     nr_to_scan, gfp_mask, rem);
 		return rem;
 	}
+	min_adj = max(min_adj, OOM_DISABLE);
 	selected_oom_adj = min_adj;
 
 	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
+	spin_lock(&lowmem_lock);
+	unchanged = lowmem_miss_gen == lowmem_gen &&
+		    min_adj >= lowmem_miss_adj &&
+		    time_before(jiffies, lowmem_miss_time + HZ);
+	spin_unlock(&lowmem_lock);
+	if (!lowmem_ready || unchanged) {
+		read_unlock(&tasklist_lock);
+		lowmem_print(5, "lowmem_shrink %d, %x, nothing new, return %d\n",
+			     nr_to_scan, gfp_mask, rem);
+		return rem;
+	}
+
+	/*
+	 * The highest bucket holding a process with memory has the victim:
+	 * its largest process.
+	 */
+	start = ktime_get();
+	for (adj = OOM_ADJUST_MAX; adj >= min_adj && !selected; adj--) {
+		list_for_each_entry(p, lowmem_bucket(adj), lowmem_node) {
+			struct mm_struct *mm;
+
+			task_lock(p);
+			mm = p->mm;
+			if (!mm) {
+				task_unlock(p);
 				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
+			}
+			tasksize = get_mm_rss(mm);
+			task_unlock(p);
+			if (tasksize <= selected_tasksize)
 				continue;
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_adj = adj;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+				     p->pid, p->comm, adj, tasksize);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
 	}
+	spin_lock(&lowmem_lock);
+	lowmem_account_cost(start);
+	if (!selected) {
+		lowmem_miss_gen = lowmem_gen;
+		lowmem_miss_adj = min_adj;
+		lowmem_miss_time = jiffies;
+	}
+	spin_unlock(&lowmem_lock);
+
 	if (selected) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
@@ -183,8 +413,134 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+static int lowmem_select_cost_show(struct seq_file *m, void *unused)
+{
+	unsigned long cost[LOWMEM_COST_BUCKETS];
+	int i;
+
+	spin_lock(&lowmem_lock);
+	memcpy(cost, lowmem_select_cost, sizeof(cost));
+	spin_unlock(&lowmem_lock);
+
+	for (i = 0; i < LOWMEM_COST_BUCKETS - 1; i++)
+		seq_printf(m, "< %8llu ns: %lu\n", 1ULL << (i + 9), cost[i]);
+	seq_printf(m, ">= %7llu ns: %lu\n", 1ULL << (i + 8), cost[i]);
+	return 0;
+}
+
+static int lowmem_select_cost_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lowmem_select_cost_show, inode->i_private);
+}
+
+static const struct file_operations lowmem_select_cost_fops = {
+	.owner = THIS_MODULE,
+	.open = lowmem_select_cost_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static struct dentry *lowmem_debugfs_dir;
+
+static int mempressure_open(struct inode *inode, struct file *file)
+{
+	int ret;
+
+	ret = nonseekable_open(inode, file);
+	if (ret)
+		return ret;
+
+	/* the first read returns the current level right away */
+	spin_lock(&lowmem_lock);
+	file->private_data = (void *)(unsigned long)(lowmem_pressure_seq - 1);
+	spin_unlock(&lowmem_lock);
+	return 0;
+}
+
+static int mempressure_changed(struct file *file)
+{
+	return (unsigned int)(unsigned long)file->private_data !=
+		ACCESS_ONCE(lowmem_pressure_seq);
+}
+
+/*
+ * mempressure_read - returns the pressure level as a decimal number followed
+ * by a newline. Blocks, unless O_NONBLOCK is set, until the level changed
+ * since the last read on this file.
+ */
+static ssize_t mempressure_read(struct file *file, char __user *buf,
+				size_t count, loff_t *pos)
+{
+	char level[16];
+	unsigned int seq;
+	int len;
+	int ret;
+
+	if (!mempressure_changed(file)) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(lowmem_pressure_wait,
+					       mempressure_changed(file));
+		if (ret)
+			return ret;
+	}
+
+	spin_lock(&lowmem_lock);
+	len = snprintf(level, sizeof(level), "%d\n", lowmem_pressure_level);
+	seq = lowmem_pressure_seq;
+	spin_unlock(&lowmem_lock);
+
+	if (count < len)
+		return -EINVAL;
+	if (copy_to_user(buf, level, len))
+		return -EFAULT;
+	file->private_data = (void *)(unsigned long)seq;
+	return len;
+}
+
+static unsigned int mempressure_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &lowmem_pressure_wait, wait);
+	return mempressure_changed(file) ? POLLIN | POLLRDNORM : 0;
+}
+
+static const struct file_operations mempressure_fops = {
+	.owner = THIS_MODULE,
+	.open = mempressure_open,
+	.read = mempressure_read,
+	.poll = mempressure_poll,
+};
+
+static struct miscdevice mempressure_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "mempressure",
+	.fops = &mempressure_fops,
+};
+
 static int __init lowmem_init(void)
 {
+	struct task_struct *p;
+	int i;
+
+	write_lock_irq(&tasklist_lock);
+	for (i = 0; i < LOWMEM_BUCKETS; i++)
+		INIT_LIST_HEAD(&lowmem_procs[i]);
+	for_each_process(p)
+		list_add_tail(&p->lowmem_node,
+			      lowmem_bucket(lowmem_oom_adj(p)));
+	lowmem_ready = 1;
+	write_unlock_irq(&tasklist_lock);
+
+	lowmem_debugfs_dir = debugfs_create_dir("lowmemorykiller", NULL);
+	if (lowmem_debugfs_dir)
+		debugfs_create_file("select_cost", S_IRUGO, lowmem_debugfs_dir,
+				    NULL, &lowmem_select_cost_fops);
+
+	if (misc_register(&mempressure_misc))
+		printk(KERN_ERR "lowmemorykiller: failed to register "
+		       "mempressure device\n");
+
 	register_shrinker(&lowmem_shrinker);
 	return 0;
 }
@@ -192,6 +548,9 @@ static int __init lowmem_init(void)
 static void __exit lowmem_exit(void)
 {
 	unregister_shrinker(&lowmem_shrinker);
+	cancel_delayed_work_sync(&lowmem_pressure_work);
+	misc_deregister(&mempressure_misc);
+	debugfs_remove_recursive(lowmem_debugfs_dir);
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -200,6 +559,10 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(pressure_margin, lowmem_pressure_margin, int,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_efficiency, lowmem_pressure_efficiency, int,
+		   S_IRUGO | S_IWUSR);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
@@ -0,0 +1,395 @@
+/*
+ * Allocator benchmark for ramzswap
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Replays the same randomized alloc/free trace against xvmalloc and
+ * zsalloc and reports the time per operation and the memory each pool
+ * needs for the objects that are live. Object sizes follow what LZO
+ * makes of typical anonymous pages. The trace has three phases:
+ *
+ *  fill:   allocate nr_objs objects
+ *  churn:  nr_ops times free a random object and allocate another one
+ *  shrink: free random objects until a quarter of them are left
+ *
+ * The shrink phase is where the allocators differ: xvmalloc keeps the
+ * pages that are left partly used, while zsalloc compaction, driven the
+ * way ramzswap drives it, moves objects together and gives pages back.
+ * Both are reported after every phase. The module does its work in its
+ * init function and never stays loaded:
+ *	modprobe ramzswap_bench nr_objs=65536 nr_ops=1000000
+ */
+
+#define KMSG_COMPONENT "ramzswap_bench"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/highmem.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+#include "xvmalloc.h"
+#include "zsalloc.h"
+
+static unsigned int nr_objs = 16384;
+module_param(nr_objs, uint, 0);
+MODULE_PARM_DESC(nr_objs, "Objects allocated in the fill phase");
+
+static unsigned int nr_ops = 262144;
+module_param(nr_ops, uint, 0);
+MODULE_PARM_DESC(nr_ops, "Free/alloc pairs in the churn phase");
+
+static unsigned int seed = 1;
+module_param(seed, uint, 0);
+MODULE_PARM_DESC(seed, "Seed of the random trace");
+
+struct bench_obj {
+	struct page *page;
+	u32 offset;
+	u32 size;
+};
+
+struct bench {
+	const struct bench_ops *ops;
+	void *pool;
+	struct bench_obj *objs;
+	u32 *live;		/* live object indices, then free ones */
+	u32 nr_live;
+	u64 live_bytes;
+	u32 rnd;
+	struct mutex lock;	/* objs, against zsalloc compaction */
+};
+
+struct bench_ops {
+	const char *name;
+	void *(*create)(struct bench *b);
+	void (*destroy)(void *pool);
+	int (*alloc)(void *pool, u32 size, struct page **page, u32 *offset);
+	void (*free)(void *pool, struct page *page, u32 offset);
+	void *(*map)(void *pool, struct page *page, u32 offset);
+	void (*unmap)(void *pool, struct page *page, u32 offset, void *obj);
+	u64 (*total_size)(void *pool);
+};
+
+static void *bench_xv_create(struct bench *b)
+{
+	return xv_create_pool();
+}
+
+static void bench_xv_destroy(void *pool)
+{
+	xv_destroy_pool(pool);
+}
+
+static int bench_xv_alloc(void *pool, u32 size, struct page **page,
+			u32 *offset)
+{
+	return xv_malloc(pool, size, page, offset, GFP_NOIO | __GFP_HIGHMEM);
+}
+
+static void bench_xv_free(void *pool, struct page *page, u32 offset)
+{
+	xv_free(pool, page, offset);
+}
+
+static void *bench_xv_map(void *pool, struct page *page, u32 offset)
+{
+	return kmap_atomic(page, KM_USER0) + offset;
+}
+
+static void bench_xv_unmap(void *pool, struct page *page, u32 offset,
+			void *obj)
+{
+	kunmap_atomic(obj - offset, KM_USER0);
+}
+
+static u64 bench_xv_total_size(void *pool)
+{
+	return xv_get_total_size_bytes(pool);
+}
+
+static const struct bench_ops bench_xv_ops = {
+	.name		= "xvmalloc",
+	.create		= bench_xv_create,
+	.destroy	= bench_xv_destroy,
+	.alloc		= bench_xv_alloc,
+	.free		= bench_xv_free,
+	.map		= bench_xv_map,
+	.unmap		= bench_xv_unmap,
+	.total_size	= bench_xv_total_size,
+};
+
+/* Same checks as ramzswap_migrate(), objects start with their index */
+static int bench_zs_migrate(struct zs_pool *pool, void *private,
+			struct page *page, u32 offset)
+{
+	struct bench *b = private;
+	u32 *obj, index;
+	int ret = -EBUSY;
+
+	obj = zs_map_object(pool, page, offset, ZS_MM_RO);
+	index = *obj;
+	zs_unmap_object(pool, page, offset);
+
+	if (index >= nr_objs)
+		return -EINVAL;
+
+	mutex_lock(&b->lock);
+	if (b->objs[index].page == page && b->objs[index].offset == offset) {
+		ret = zs_move(pool, &page, &offset);
+		if (!ret) {
+			b->objs[index].page = page;
+			b->objs[index].offset = offset;
+		}
+	}
+	mutex_unlock(&b->lock);
+
+	return ret;
+}
+
+static void *bench_zs_create(struct bench *b)
+{
+	return zs_create_pool(bench_zs_migrate, b);
+}
+
+static void bench_zs_destroy(void *pool)
+{
+	zs_destroy_pool(pool);
+}
+
+static int bench_zs_alloc(void *pool, u32 size, struct page **page,
+			u32 *offset)
+{
+	return zs_malloc(pool, size, page, offset, GFP_NOIO | __GFP_HIGHMEM);
+}
+
+static void bench_zs_free(void *pool, struct page *page, u32 offset)
+{
+	zs_free(pool, page, offset);
+}
+
+static void *bench_zs_map(void *pool, struct page *page, u32 offset)
+{
+	return zs_map_object(pool, page, offset, ZS_MM_RW);
+}
+
+static void bench_zs_unmap(void *pool, struct page *page, u32 offset,
+			void *obj)
+{
+	zs_unmap_object(pool, page, offset);
+}
+
+static u64 bench_zs_total_size(void *pool)
+{
+	return zs_get_total_size_bytes(pool);
+}
+
+static const struct bench_ops bench_zs_ops = {
+	.name		= "zsalloc",
+	.create		= bench_zs_create,
+	.destroy	= bench_zs_destroy,
+	.alloc		= bench_zs_alloc,
+	.free		= bench_zs_free,
+	.map		= bench_zs_map,
+	.unmap		= bench_zs_unmap,
+	.total_size	= bench_zs_total_size,
+};
+
+static u32 bench_rand(struct bench *b)
+{
+	b->rnd = b->rnd * 1103515245 + 12345;
+	return b->rnd >> 8;
+}
+
+/*
+ * Roughly what LZO makes of anonymous pages: a fifth compress very
+ * well, most to between a quarter and a half of a page, the rest
+ * hardly (ramzswap stores pages above 3/4 of PAGE_SIZE uncompressed).
+ */
+static u32 bench_size(struct bench *b)
+{
+	u32 r = bench_rand(b) % 100;
+
+	if (r < 20)
+		return 32 + bench_rand(b) % (PAGE_SIZE / 4 - 32);
+	if (r < 80)
+		return PAGE_SIZE / 4 + bench_rand(b) % (PAGE_SIZE / 4);
+	return PAGE_SIZE / 2 + bench_rand(b) % (PAGE_SIZE / 4 + 1);
+}
+
+static int bench_alloc(struct bench *b)
+{
+	u32 index = b->live[b->nr_live];
+	struct bench_obj *o = &b->objs[index];
+	u32 *obj;
+	int ret;
+
+	o->size = bench_size(b);
+
+	mutex_lock(&b->lock);
+	ret = b->ops->alloc(b->pool, o->size, &o->page, &o->offset);
+	if (!ret) {
+		obj = b->ops->map(b->pool, o->page, o->offset);
+		*obj = index;
+		b->ops->unmap(b->pool, o->page, o->offset, obj);
+	}
+	mutex_unlock(&b->lock);
+	if (ret)
+		return ret;
+
+	b->nr_live++;
+	b->live_bytes += o->size;
+	return 0;
+}
+
+static int bench_free(struct bench *b)
+{
+	u32 pos = bench_rand(b) % b->nr_live;
+	u32 index = b->live[pos];
+	struct bench_obj *o = &b->objs[index];
+	u32 *obj, found;
+
+	mutex_lock(&b->lock);
+	obj = b->ops->map(b->pool, o->page, o->offset);
+	found = *obj;
+	b->ops->unmap(b->pool, o->page, o->offset, obj);
+	b->ops->free(b->pool, o->page, o->offset);
+	mutex_unlock(&b->lock);
+
+	b->nr_live--;
+	b->live[pos] = b->live[b->nr_live];
+	b->live[b->nr_live] = index;
+	b->live_bytes -= o->size;
+
+	if (unlikely(found != index)) {
+		pr_err("%s: object %u holds %u\n", b->ops->name, index, found);
+		return -EIO;
+	}
+	return 0;
+}
+
+static void bench_report(struct bench *b, const char *phase, u64 ns,
+			u32 ops)
+{
+	u64 total = b->ops->total_size(b->pool);
+
+	pr_info("%-8s %-6s: %5llu ns/op, %6llu pages for %6u objects "
+		"(%llu KB), %3llu%% efficient\n", b->ops->name, phase,
+		ops ? div64_u64(ns, ops) : 0, total >> PAGE_SHIFT,
+		b->nr_live, b->live_bytes >> 10,
+		total ? div64_u64(b->live_bytes * 100, total) : 0);
+}
+
+static int bench_run(struct bench *b, const struct bench_ops *ops)
+{
+	ktime_t start;
+	u32 i, ops_done;
+	int ret = 0;
+
+	b->ops = ops;
+	b->rnd = seed;
+	b->nr_live = 0;
+	b->live_bytes = 0;
+	for (i = 0; i < nr_objs; i++)
+		b->live[i] = i;
+
+	b->pool = ops->create(b);
+	if (!b->pool)
+		return -ENOMEM;
+
+	start = ktime_get();
+	for (i = 0; i < nr_objs && !ret; i++)
+		ret = bench_alloc(b);
+	if (ret)
+		goto out;
+	bench_report(b, "fill", ktime_to_ns(ktime_sub(ktime_get(), start)),
+			nr_objs);
+
+	start = ktime_get();
+	for (i = 0; i < nr_ops && !ret; i++) {
+		ret = bench_free(b);
+		if (!ret)
+			ret = bench_alloc(b);
+		if (!(i & 1023))
+			cond_resched();
+	}
+	if (ret)
+		goto out;
+	bench_report(b, "churn", ktime_to_ns(ktime_sub(ktime_get(), start)),
+			2 * nr_ops);
+
+	start = ktime_get();
+	for (ops_done = 0; b->nr_live > nr_objs / 4 && !ret; ops_done++)
+		ret = bench_free(b);
+	if (ret)
+		goto out;
+	/* let zsalloc finish the compaction it scheduled */
+	flush_scheduled_work();
+	bench_report(b, "shrink", ktime_to_ns(ktime_sub(ktime_get(), start)),
+			ops_done);
+
+	if (ops == &bench_zs_ops) {
+		struct zs_pool_stats stats;
+
+		zs_get_stats(b->pool, &stats);
+		pr_info("%-8s compactions: %llu, objects migrated: %llu, "
+			"pages compacted: %llu\n", ops->name,
+			stats.compactions, stats.objs_migrated,
+			stats.pages_compacted);
+	}
+
+out:
+	if (ret == -ENOMEM)
+		pr_err("%s: out of memory\n", ops->name);
+	while (b->nr_live)
+		bench_free(b);
+	ops->destroy(b->pool);
+	return ret;
+}
+
+static int __init ramzswap_bench_init(void)
+{
+	struct bench *b;
+	int ret = -ENOMEM;
+
+	if (!nr_objs)
+		return -EINVAL;
+
+	b = kzalloc(sizeof(*b), GFP_KERNEL);
+	if (!b)
+		return -ENOMEM;
+	mutex_init(&b->lock);
+	b->objs = vmalloc(nr_objs * sizeof(*b->objs));
+	b->live = vmalloc(nr_objs * sizeof(*b->live));
+	if (!b->objs || !b->live)
+		goto out;
+
+	pr_info("%u objects, %u churn ops, seed %u\n", nr_objs, nr_ops, seed);
+	ret = bench_run(b, &bench_xv_ops);
+	if (!ret)
+		ret = bench_run(b, &bench_zs_ops);
+	if (!ret)
+		ret = -EAGAIN;
+
+out:
+	vfree(b->live);
+	vfree(b->objs);
+	kfree(b);
+	return ret;
+}
+
+module_init(ramzswap_bench_init);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Benchmark of the ramzswap memory allocators");
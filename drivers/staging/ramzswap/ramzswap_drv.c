@@ -23,8 +23,10 @@
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
+#include <linux/math64.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
+#include <linux/sched.h>
 #include <linux/string.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
@@ -57,18 +59,242 @@ static void rzs_clear_flag(struct ramzswap *rzs, u32 index,
 	rzs->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+static rwlock_t *rzs_table_lock(struct ramzswap *rzs, u32 index)
+{
+	return &rzs->table_lock[index & (RZS_TABLE_LOCKS - 1)];
+}
+
+/*
+ * Get an idle compression stream, waiting for one if all of
+ * them are in use.
+ */
+static struct rzs_stream *rzs_strm_get(struct ramzswap *rzs)
+{
+	struct rzs_stream *strm;
+
+	for (;;) {
+		spin_lock(&rzs->strm_lock);
+		if (!list_empty(&rzs->idle_strm)) {
+			strm = list_first_entry(&rzs->idle_strm,
+					struct rzs_stream, list);
+			list_del(&strm->list);
+			spin_unlock(&rzs->strm_lock);
+			return strm;
+		}
+		spin_unlock(&rzs->strm_lock);
+
+		wait_event(rzs->strm_wait, !list_empty(&rzs->idle_strm));
+	}
+}
+
+static void rzs_strm_put(struct ramzswap *rzs, struct rzs_stream *strm)
+{
+	spin_lock(&rzs->strm_lock);
+	list_add(&strm->list, &rzs->idle_strm);
+	spin_unlock(&rzs->strm_lock);
+
+	wake_up(&rzs->strm_wait);
+}
+
+static void rzs_strm_free(struct rzs_stream *strm)
+{
+	if (strm->tfm)
+		crypto_free_comp(strm->tfm);
+	free_pages((unsigned long)strm->buffer, 1);
+	kfree(strm);
+}
+
+static struct rzs_stream *rzs_strm_alloc(const char *compressor)
+{
+	struct rzs_stream *strm;
+
+	strm = kzalloc(sizeof(*strm), GFP_KERNEL);
+	if (!strm)
+		return NULL;
+
+	strm->tfm = crypto_alloc_comp(compressor, 0, 0);
+	if (IS_ERR(strm->tfm))
+		strm->tfm = NULL;
+	/* Compressed output can be larger than the page */
+	strm->buffer = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+	if (!strm->tfm || !strm->buffer) {
+		rzs_strm_free(strm);
+		return NULL;
+	}
+
+	return strm;
+}
+
+/*
+ * Look for an object with the same compressed data. On a hit, the
+ * object gets a reference for the caller.
+ */
+static struct rzs_dedup *rzs_dedup_find(struct ramzswap *rzs,
+			const void *data, u32 clen, u32 checksum)
+{
+	struct rb_node *node;
+	struct rzs_dedup *dedup;
+	struct zobj_header *zheader;
+	int match;
+
+	spin_lock(&rzs->dedup_lock);
+	node = rzs->dedup_tree.rb_node;
+	while (node) {
+		dedup = rb_entry(node, struct rzs_dedup, node);
+		if (checksum < dedup->checksum)
+			node = node->rb_left;
+		else if (checksum > dedup->checksum)
+			node = node->rb_right;
+		else
+			break;
+	}
+	if (!node) {
+		spin_unlock(&rzs->dedup_lock);
+		return NULL;
+	}
+
+	zheader = zs_map_object(rzs->mem_pool, dedup->page, dedup->offset,
+				ZS_MM_RO);
+	match = zheader->size == clen && !memcmp(zheader + 1, data, clen);
+	zs_unmap_object(rzs->mem_pool, dedup->page, dedup->offset);
+
+	if (match)
+		dedup->refcount++;
+	spin_unlock(&rzs->dedup_lock);
+
+	return match ? dedup : NULL;
+}
+
+/*
+ * Make a newly stored object findable by rzs_dedup_find(). Returns
+ * NULL if it cannot be tracked, the object is then kept unshared.
+ */
+static struct rzs_dedup *rzs_dedup_add(struct ramzswap *rzs, u32 checksum,
+			struct page *page, u32 offset)
+{
+	struct rb_node **link, *parent = NULL;
+	struct rzs_dedup *dedup, *tmp;
+
+	dedup = kmalloc(sizeof(*dedup), GFP_NOIO);
+	if (!dedup)
+		return NULL;
+
+	dedup->checksum = checksum;
+	dedup->refcount = 1;
+	dedup->page = page;
+	dedup->offset = offset;
+
+	spin_lock(&rzs->dedup_lock);
+	link = &rzs->dedup_tree.rb_node;
+	while (*link) {
+		parent = *link;
+		tmp = rb_entry(parent, struct rzs_dedup, node);
+		if (checksum < tmp->checksum) {
+			link = &parent->rb_left;
+		} else if (checksum > tmp->checksum) {
+			link = &parent->rb_right;
+		} else {
+			/* Checksum collision, or a racing identical write */
+			spin_unlock(&rzs->dedup_lock);
+			kfree(dedup);
+			return NULL;
+		}
+	}
+	rb_link_node(&dedup->node, parent, link);
+	rb_insert_color(&dedup->node, &rzs->dedup_tree);
+	spin_unlock(&rzs->dedup_lock);
+
+	return dedup;
+}
+
+/*
+ * Allocate a block on the backing device. Returns rzs->bd_nr_pages
+ * if the device is full.
+ */
+static unsigned long rzs_bd_alloc(struct ramzswap *rzs)
+{
+	unsigned long blk;
+
+	spin_lock(&rzs->bd_lock);
+	blk = find_next_zero_bit(rzs->bd_bitmap, rzs->bd_nr_pages,
+				rzs->bd_hint);
+	if (blk >= rzs->bd_nr_pages)
+		blk = find_first_zero_bit(rzs->bd_bitmap, rzs->bd_nr_pages);
+	if (blk < rzs->bd_nr_pages) {
+		__set_bit(blk, rzs->bd_bitmap);
+		/* Keep a batch contiguous so its writes get merged */
+		rzs->bd_hint = blk + 1;
+	}
+	spin_unlock(&rzs->bd_lock);
+
+	return blk;
+}
+
+static void rzs_bd_free(struct ramzswap *rzs, unsigned long blk)
+{
+	spin_lock(&rzs->bd_lock);
+	__clear_bit(blk, rzs->bd_bitmap);
+	spin_unlock(&rzs->bd_lock);
+}
+
+static void rzs_bd_end_read(struct bio *bd_bio, int err)
+{
+	struct bio *bio = bd_bio->bi_private;
+
+	bio_put(bd_bio);
+
+	if (!err) {
+		flush_dcache_page(bio->bi_io_vec[0].bv_page);
+		set_bit(BIO_UPTODATE, &bio->bi_flags);
+	}
+	bio_endio(bio, err);
+}
+
+/*
+ * Read a written back page straight into the request's page. The
+ * slot cannot be freed meanwhile: swap keeps the page locked until
+ * the read completes.
+ */
+static int ramzswap_bd_read(struct ramzswap *rzs, struct bio *bio,
+			unsigned long blk)
+{
+	struct bio *bd_bio;
+
+	bd_bio = bio_alloc(GFP_NOIO, 1);
+	bd_bio->bi_bdev = rzs->backing;
+	bd_bio->bi_sector = (sector_t)blk << SECTORS_PER_PAGE_SHIFT;
+	bd_bio->bi_private = bio;
+	bd_bio->bi_end_io = rzs_bd_end_read;
+
+	if (!bio_add_page(bd_bio, bio->bi_io_vec[0].bv_page, PAGE_SIZE, 0)) {
+		bio_put(bd_bio);
+		rzs_stat64_inc(rzs, &rzs->stats.failed_reads);
+		bio_io_error(bio);
+		return 0;
+	}
+
+	rzs_stat64_inc(rzs, &rzs->stats.bd_reads);
+	submit_bio(READ, bd_bio);
+	return 0;
+}
+
+/*
+ * Returns 1 if the page is a single word repeated, which is then
+ * stored in *element. Zero filled pages are the common case.
+ */
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 1; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos] != page[0])
 			return 0;
 	}
 
+	*element = page[0];
 	return 1;
 }
 
@@ -116,26 +342,30 @@ static void setup_swap_header(struct ramzswap *rzs, union swap_header *s)
 }
 
 static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
-			struct ramzswap_ioctl_stats *s)
+			struct ramzswap_ioctl_stats2 *s)
 {
 	s->disksize = rzs->disksize;
+	strlcpy(s->compressor, rzs->compressor, sizeof(s->compressor));
 
 #if defined(CONFIG_RAMZSWAP_STATS)
 	{
 	struct ramzswap_stats *rs = &rzs->stats;
+	struct zs_pool_stats ps;
 	size_t succ_writes, mem_used;
 	unsigned int good_compress_perc = 0, no_compress_perc = 0;
+	u32 pages_stored = atomic_read(&rs->pages_stored);
+	u32 pages_expand = atomic_read(&rs->pages_expand);
+	u64 pool_bytes;
 
-	mem_used = xv_get_total_size_bytes(rzs->mem_pool)
-			+ (rs->pages_expand << PAGE_SHIFT);
+	mem_used = zs_get_total_size_bytes(rzs->mem_pool)
+			+ ((size_t)pages_expand << PAGE_SHIFT);
 	succ_writes = rzs_stat64_read(rzs, &rs->num_writes) -
 			rzs_stat64_read(rzs, &rs->failed_writes);
 
-	if (succ_writes && rs->pages_stored) {
-		good_compress_perc = rs->good_compress * 100
-					/ rs->pages_stored;
-		no_compress_perc = rs->pages_expand * 100
-					/ rs->pages_stored;
+	if (succ_writes && pages_stored) {
+		good_compress_perc = atomic_read(&rs->good_compress) * 100
+					/ pages_stored;
+		no_compress_perc = pages_expand * 100 / pages_stored;
 	}
 
 	s->num_reads = rzs_stat64_read(rzs, &rs->num_reads);
@@ -144,28 +374,63 @@ static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 	s->failed_writes = rzs_stat64_read(rzs, &rs->failed_writes);
 	s->invalid_io = rzs_stat64_read(rzs, &rs->invalid_io);
 	s->notify_free = rzs_stat64_read(rzs, &rs->notify_free);
-	s->pages_zero = rs->pages_zero;
+	s->pages_zero = atomic_read(&rs->pages_zero);
+	s->pages_same = atomic_read(&rs->pages_same);
+	s->pages_dup = atomic_read(&rs->pages_dup);
 
 	s->good_compress_pct = good_compress_perc;
 	s->pages_expand_pct = no_compress_perc;
 
-	s->pages_stored = rs->pages_stored;
+	s->pages_stored = pages_stored;
 	s->pages_used = mem_used >> PAGE_SHIFT;
-	s->orig_data_size = rs->pages_stored << PAGE_SHIFT;
-	s->compr_data_size = rs->compr_size;
+	s->orig_data_size = (u64)pages_stored << PAGE_SHIFT;
+	s->compr_data_size = atomic_long_read(&rs->compr_size);
 	s->mem_used_total = mem_used;
+
+	zs_get_stats(rzs->mem_pool, &ps);
+	pool_bytes = ps.total_pages << PAGE_SHIFT;
+	if (pool_bytes)
+		s->frag_pct = div64_u64((pool_bytes - ps.obj_bytes) * 100,
+					pool_bytes);
+	if (mem_used)
+		s->pool_efficiency_pct = div64_u64(s->compr_data_size * 100,
+					mem_used);
+	s->compactions = ps.compactions;
+	s->objs_migrated = ps.objs_migrated;
+	s->pages_compacted = ps.pages_compacted;
+
+	s->pages_wb = atomic_read(&rs->pages_wb);
+	s->bd_reads = rzs_stat64_read(rzs, &rs->bd_reads);
+	s->bd_writes = rzs_stat64_read(rzs, &rs->bd_writes);
+	s->failed_wb = rzs_stat64_read(rzs, &rs->failed_wb);
 	}
 #endif /* CONFIG_RAMZSWAP_STATS */
 }
 
+/*
+ * Free whatever is stored in the given slot. Called with the
+ * slot's table lock write-held.
+ */
 static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
 {
 	u32 clen;
-	void *obj;
+	struct zobj_header *zheader;
 
 	struct page *page = rzs->table[index].page;
 	u32 offset = rzs->table[index].offset;
 
+	/* A writeback in progress is abandoned */
+	rzs_clear_flag(rzs, index, RZS_UNDER_WB);
+
+	if (rzs_test_flag(rzs, index, RZS_WB)) {
+		rzs_bd_free(rzs, rzs->table[index].element);
+		rzs_clear_flag(rzs, index, RZS_WB);
+		rzs->table[index].element = 0;
+		rzs_stat_dec(&rzs->stats.pages_wb);
+		rzs_stat_dec(&rzs->stats.pages_stored);
+		return;
+	}
+
 	if (unlikely(!page)) {
 		/*
 		 * No memory is allocated for zero filled pages.
@@ -178,6 +443,38 @@ static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
 		return;
 	}
 
+	/* Neither for pages filled with some other word */
+	if (rzs_test_flag(rzs, index, RZS_SAME)) {
+		rzs_clear_flag(rzs, index, RZS_SAME);
+		rzs_stat_dec(&rzs->stats.pages_same);
+		rzs->table[index].element = 0;
+		return;
+	}
+
+	if (rzs_test_flag(rzs, index, RZS_DEDUP)) {
+		struct rzs_dedup *dedup = rzs->table[index].dedup;
+		int last;
+
+		rzs_clear_flag(rzs, index, RZS_DEDUP);
+		rzs->table[index].dedup = NULL;
+
+		spin_lock(&rzs->dedup_lock);
+		last = !--dedup->refcount;
+		if (last)
+			rb_erase(&dedup->node, &rzs->dedup_tree);
+		spin_unlock(&rzs->dedup_lock);
+
+		if (!last) {
+			rzs_stat_dec(&rzs->stats.pages_dup);
+			rzs_stat_dec(&rzs->stats.pages_stored);
+			return;
+		}
+
+		page = dedup->page;
+		offset = dedup->offset;
+		kfree(dedup);
+	}
+
 	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED))) {
 		clen = PAGE_SIZE;
 		__free_page(page);
@@ -186,29 +483,34 @@ static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
+	zheader = zs_map_object(rzs->mem_pool, page, offset, ZS_MM_RO);
+	clen = zheader->size;
+	zs_unmap_object(rzs->mem_pool, page, offset);
 
-	xv_free(rzs->mem_pool, page, offset);
+	zs_free(rzs->mem_pool, page, offset);
 	if (clen <= PAGE_SIZE / 2)
 		rzs_stat_dec(&rzs->stats.good_compress);
 
 out:
-	rzs->stats.compr_size -= clen;
+	atomic_long_sub(clen, &rzs->stats.compr_size);
 	rzs_stat_dec(&rzs->stats.pages_stored);
 
 	rzs->table[index].page = NULL;
 	rzs->table[index].offset = 0;
 }
 
-static int handle_zero_page(struct bio *bio)
+static int handle_same_page(struct bio *bio, unsigned long element)
 {
-	void *user_mem;
+	unsigned int pos;
+	unsigned long *user_mem;
 	struct page *page = bio->bi_io_vec[0].bv_page;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	memset(user_mem, 0, PAGE_SIZE);
+	if (!element)
+		memset(user_mem, 0, PAGE_SIZE);
+	else
+		for (pos = 0; pos != PAGE_SIZE / sizeof(*user_mem); pos++)
+			user_mem[pos] = element;
 	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
@@ -218,15 +520,12 @@ static int handle_zero_page(struct bio *bio)
 	return 0;
 }
 
-static int handle_uncompressed_page(struct ramzswap *rzs, struct bio *bio)
+/* Called with the slot's table lock held */
+static void handle_uncompressed_page(struct ramzswap *rzs, struct page *page,
+				u32 index)
 {
-	u32 index;
-	struct page *page;
 	unsigned char *user_mem, *cmem;
 
-	page = bio->bi_io_vec[0].bv_page;
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
-
 	user_mem = kmap_atomic(page, KM_USER0);
 	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
 			rzs->table[index].offset;
@@ -234,12 +533,6 @@ static int handle_uncompressed_page(struct ramzswap *rzs, struct bio *bio)
 	memcpy(user_mem, cmem, PAGE_SIZE);
 	kunmap_atomic(user_mem, KM_USER0);
 	kunmap_atomic(cmem, KM_USER1);
-
-	flush_dcache_page(page);
-
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
-	return 0;
 }
 
 /*
@@ -264,50 +557,88 @@ static int handle_ramzswap_fault(struct ramzswap *rzs, struct bio *bio)
 static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
 {
 	int ret;
-	u32 index;
-	size_t clen;
-	struct page *page;
+	u32 index, offset;
+	unsigned int clen;
+	rwlock_t *lock;
+	struct page *page, *obj_page;
 	struct zobj_header *zheader;
-	unsigned char *user_mem, *cmem;
+	struct rzs_stream *strm;
+	unsigned char *user_mem;
 
 	rzs_stat64_inc(rzs, &rzs->stats.num_reads);
 
 	page = bio->bi_io_vec[0].bv_page;
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
-	if (rzs_test_flag(rzs, index, RZS_ZERO))
-		return handle_zero_page(bio);
+	/* Decompressors may keep state, so reads need a stream too */
+	strm = rzs_strm_get(rzs);
+
+	lock = rzs_table_lock(rzs, index);
+	read_lock(lock);
+
+	if (rzs_test_flag(rzs, index, RZS_ZERO) ||
+			rzs_test_flag(rzs, index, RZS_SAME)) {
+		unsigned long element = rzs->table[index].element;
+
+		read_unlock(lock);
+		rzs_strm_put(rzs, strm);
+		return handle_same_page(bio, element);
+	}
+
+	if (rzs_test_flag(rzs, index, RZS_WB)) {
+		unsigned long blk = rzs->table[index].element;
+
+		read_unlock(lock);
+		rzs_strm_put(rzs, strm);
+		return ramzswap_bd_read(rzs, bio, blk);
+	}
 
 	/* Requested page is not present in compressed area */
-	if (!rzs->table[index].page)
+	if (!rzs->table[index].page) {
+		read_unlock(lock);
+		rzs_strm_put(rzs, strm);
 		return handle_ramzswap_fault(rzs, bio);
+	}
 
 	/* Page is stored uncompressed since it's incompressible */
-	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-		return handle_uncompressed_page(rzs, bio);
+	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED))) {
+		handle_uncompressed_page(rzs, page, index);
+		read_unlock(lock);
+		rzs_strm_put(rzs, strm);
+		goto done;
+	}
+
+	if (rzs_test_flag(rzs, index, RZS_DEDUP)) {
+		obj_page = rzs->table[index].dedup->page;
+		offset = rzs->table[index].dedup->offset;
+	} else {
+		obj_page = rzs->table[index].page;
+		offset = rzs->table[index].offset;
+	}
 
 	user_mem = kmap_atomic(page, KM_USER0);
 	clen = PAGE_SIZE;
 
-	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
-			rzs->table[index].offset;
+	zheader = zs_map_object(rzs->mem_pool, obj_page, offset, ZS_MM_RO);
 
-	ret = lzo1x_decompress_safe(
-		cmem + sizeof(*zheader),
-		xv_get_object_size(cmem) - sizeof(*zheader),
+	ret = crypto_comp_decompress(strm->tfm,
+		(u8 *)(zheader + 1), zheader->size,
 		user_mem, &clen);
 
+	zs_unmap_object(rzs->mem_pool, obj_page, offset);
 	kunmap_atomic(user_mem, KM_USER0);
-	kunmap_atomic(cmem, KM_USER1);
+	read_unlock(lock);
+	rzs_strm_put(rzs, strm);
 
 	/* should NEVER happen */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret || clen != PAGE_SIZE)) {
 		pr_err("Decompression failed! err=%d, page=%u\n",
 			ret, index);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_reads);
 		goto out;
 	}
 
+done:
 	flush_dcache_page(page);
 
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
@@ -319,43 +650,65 @@ out:
 	return 0;
 }
 
+/*
+ * Compression and allocation of the new object happen without any
+ * table lock held, using one of the per-device compression streams,
+ * so writers to different slots run in parallel. The table lock is
+ * only taken to install the object in its slot.
+ */
 static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 {
-	int ret;
-	u32 offset, index;
-	size_t clen;
+	int ret, uncompressed = 0;
+	u32 offset, index, checksum = 0;
+	unsigned int clen;
+	unsigned long element;
+	rwlock_t *lock;
 	struct zobj_header *zheader;
-	struct page *page, *page_store;
+	struct rzs_stream *strm;
+	struct rzs_dedup *dedup = NULL;
+	struct page *page, *page_store = NULL;
 	unsigned char *user_mem, *cmem, *src;
 
 	rzs_stat64_inc(rzs, &rzs->stats.num_writes);
 
 	page = bio->bi_io_vec[0].bv_page;
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	lock = rzs_table_lock(rzs, index);
 
-	src = rzs->compress_buffer;
-
-	mutex_lock(&rzs->lock);
+	strm = rzs_strm_get(rzs);
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	if (page_zero_filled(user_mem)) {
+	if (page_same_filled(user_mem, &element)) {
 		kunmap_atomic(user_mem, KM_USER0);
-		mutex_unlock(&rzs->lock);
-		rzs_stat_inc(&rzs->stats.pages_zero);
-		rzs_set_flag(rzs, index, RZS_ZERO);
+		rzs_strm_put(rzs, strm);
+
+		write_lock(lock);
+		ramzswap_free_page(rzs, index);
+		if (!element) {
+			rzs_set_flag(rzs, index, RZS_ZERO);
+		} else {
+			rzs->table[index].element = element;
+			rzs_set_flag(rzs, index, RZS_SAME);
+		}
+		write_unlock(lock);
+		if (!element)
+			rzs_stat_inc(&rzs->stats.pages_zero);
+		else
+			rzs_stat_inc(&rzs->stats.pages_same);
 
 		set_bit(BIO_UPTODATE, &bio->bi_flags);
 		bio_endio(bio, 0);
 		return 0;
 	}
 
-	ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-				rzs->compress_workmem);
+	clen = 2 * PAGE_SIZE;
+	ret = crypto_comp_compress(strm->tfm, user_mem, PAGE_SIZE,
+				strm->buffer, &clen);
 
 	kunmap_atomic(user_mem, KM_USER0);
 
-	if (unlikely(ret != LZO_E_OK)) {
-		mutex_unlock(&rzs->lock);
+	if (unlikely(ret)) {
+		rzs_strm_put(rzs, strm);
 		pr_err("Compression failed! err=%d\n", ret);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 		goto out;
@@ -367,62 +720,91 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 	 * errors which has side effect of hanging the system.
 	 */
 	if (unlikely(clen > max_zpage_size)) {
+		/* The compressed data is not needed, let others go */
+		rzs_strm_put(rzs, strm);
+
+		uncompressed = 1;
 		clen = PAGE_SIZE;
 		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 		if (unlikely(!page_store)) {
-			mutex_unlock(&rzs->lock);
 			pr_info("Error allocating memory for incompressible "
 				"page: %u\n", index);
 			rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 			goto out;
 		}
-
 		offset = 0;
-		rzs_set_flag(rzs, index, RZS_UNCOMPRESSED);
-		rzs_stat_inc(&rzs->stats.pages_expand);
-		rzs->table[index].page = page_store;
+
 		src = kmap_atomic(page, KM_USER0);
-		goto memstore;
+		cmem = kmap_atomic(page_store, KM_USER1);
+		memcpy(cmem, src, PAGE_SIZE);
+		kunmap_atomic(cmem, KM_USER1);
+		kunmap_atomic(src, KM_USER0);
+		goto stored;
+	}
+
+	if (rzs->dedup) {
+		checksum = jhash(strm->buffer, clen, 0);
+		dedup = rzs_dedup_find(rzs, strm->buffer, clen, checksum);
+		if (dedup) {
+			rzs_strm_put(rzs, strm);
+			goto install;
+		}
 	}
 
-	if (xv_malloc(rzs->mem_pool, clen + sizeof(*zheader),
-			&rzs->table[index].page, &offset,
+	if (zs_malloc(rzs->mem_pool, clen + sizeof(*zheader),
+			&page_store, &offset,
 			GFP_NOIO | __GFP_HIGHMEM)) {
-		mutex_unlock(&rzs->lock);
+		rzs_strm_put(rzs, strm);
 		pr_info("Error allocating memory for compressed "
-			"page: %u, size=%zu\n", index, clen);
+			"page: %u, size=%u\n", index, clen);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 		goto out;
 	}
 
-memstore:
-	rzs->table[index].offset = offset;
-
-	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
-			rzs->table[index].offset;
-
-#if 0
+	zheader = zs_map_object(rzs->mem_pool, page_store, offset, ZS_MM_WO);
 	/* Back-reference needed for memory defragmentation */
-	if (!rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)) {
-		zheader = (struct zobj_header *)cmem;
-		zheader->table_idx = index;
-		cmem += sizeof(*zheader);
-	}
-#endif
+	zheader->table_idx = index;
+	zheader->size = clen;
+	memcpy(zheader + 1, strm->buffer, clen);
+	zs_unmap_object(rzs->mem_pool, page_store, offset);
 
-	memcpy(cmem, src, clen);
+	rzs_strm_put(rzs, strm);
 
-	kunmap_atomic(cmem, KM_USER1);
-	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-		kunmap_atomic(src, KM_USER0);
+	if (rzs->dedup)
+		dedup = rzs_dedup_add(rzs, checksum, page_store, offset);
 
-	/* Update stats */
-	rzs->stats.compr_size += clen;
-	rzs_stat_inc(&rzs->stats.pages_stored);
+stored:
+	/* Update stats for the new object */
+	if (uncompressed)
+		rzs_stat_inc(&rzs->stats.pages_expand);
+	atomic_long_add(clen, &rzs->stats.compr_size);
 	if (clen <= PAGE_SIZE / 2)
 		rzs_stat_inc(&rzs->stats.good_compress);
 
-	mutex_unlock(&rzs->lock);
+install:
+	write_lock(lock);
+	/* Normally empty: swap frees a slot before reusing it */
+	ramzswap_free_page(rzs, index);
+	if (dedup) {
+		rzs->table[index].dedup = dedup;
+		rzs_set_flag(rzs, index, RZS_DEDUP);
+	} else {
+		rzs->table[index].page = page_store;
+		rzs->table[index].offset = offset;
+		if (uncompressed)
+			rzs_set_flag(rzs, index, RZS_UNCOMPRESSED);
+	}
+	rzs->table[index].ac_time = jiffies;
+	write_unlock(lock);
+
+	/* Move it out of memory along with others that follow */
+	if (uncompressed && rzs->backing)
+		queue_delayed_work(rzs->wb_wq, &rzs->wb_work,
+				msecs_to_jiffies(wb_delay_ms));
+
+	if (!page_store)
+		rzs_stat_inc(&rzs->stats.pages_dup);
+	rzs_stat_inc(&rzs->stats.pages_stored);
 
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
@@ -484,6 +866,317 @@ static int ramzswap_make_request(struct request_queue *queue, struct bio *bio)
 	return ret;
 }
 
+/*
+ * Should the slot be written back? Incompressible pages always are,
+ * others once they have been idle for wb_age seconds. Called with
+ * the slot's table lock held, or without to skip slots quickly.
+ */
+static int rzs_wb_candidate(struct ramzswap *rzs, u32 index)
+{
+	struct table *t = &rzs->table[index];
+
+	if (!t->page || t->flags & (BIT(RZS_ZERO) | BIT(RZS_SAME) |
+			BIT(RZS_DEDUP) | BIT(RZS_WB) | BIT(RZS_UNDER_WB)))
+		return 0;
+
+	if (t->flags & BIT(RZS_UNCOMPRESSED))
+		return 1;
+
+	return rzs->wb_age &&
+		time_after_eq(jiffies, t->ac_time + rzs->wb_age * HZ);
+}
+
+/* Copy the slot's data to page. Called with the slot's table lock held */
+static int rzs_wb_copy(struct ramzswap *rzs, u32 index, struct page *page,
+			struct rzs_stream *strm)
+{
+	struct page *obj_page = rzs->table[index].page;
+	u32 offset = rzs->table[index].offset;
+	struct zobj_header *zheader;
+	unsigned char *user_mem;
+	unsigned int clen;
+	int ret;
+
+	if (rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)) {
+		handle_uncompressed_page(rzs, page, index);
+		return 0;
+	}
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	clen = PAGE_SIZE;
+	zheader = zs_map_object(rzs->mem_pool, obj_page, offset, ZS_MM_RO);
+	ret = crypto_comp_decompress(strm->tfm, (u8 *)(zheader + 1),
+				zheader->size, user_mem, &clen);
+	zs_unmap_object(rzs->mem_pool, obj_page, offset);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	return ret || clen != PAGE_SIZE ? -EIO : 0;
+}
+
+/*
+ * Pick up to RZS_WB_BATCH slots from *pos on, give each a block and
+ * copy its data to the batch. Returns the number of slots picked.
+ */
+static int rzs_wb_collect(struct ramzswap *rzs, struct rzs_wb_batch *batch,
+			u32 *pos)
+{
+	u32 num_pages = rzs->disksize >> PAGE_SHIFT;
+	struct rzs_stream *strm;
+	int nr = 0;
+
+	strm = rzs_strm_get(rzs);
+
+	for (; *pos < num_pages && nr < RZS_WB_BATCH; (*pos)++) {
+		struct rzs_wb_entry *e = &batch->entry[nr];
+		u32 index = *pos;
+		rwlock_t *lock;
+
+		if (!rzs_wb_candidate(rzs, index))
+			continue;
+
+		lock = rzs_table_lock(rzs, index);
+		write_lock(lock);
+		if (!rzs_wb_candidate(rzs, index)) {
+			write_unlock(lock);
+			continue;
+		}
+
+		e->blk = rzs_bd_alloc(rzs);
+		if (e->blk >= rzs->bd_nr_pages) {
+			/* Backing device is full */
+			write_unlock(lock);
+			*pos = num_pages;
+			break;
+		}
+
+		if (rzs_wb_copy(rzs, index, e->page, strm)) {
+			write_unlock(lock);
+			rzs_bd_free(rzs, e->blk);
+			continue;
+		}
+		rzs_set_flag(rzs, index, RZS_UNDER_WB);
+		write_unlock(lock);
+
+		e->index = index;
+		e->err = 0;
+		nr++;
+	}
+
+	rzs_strm_put(rzs, strm);
+	return nr;
+}
+
+static void rzs_wb_end_io(struct bio *bio, int err)
+{
+	struct rzs_wb_entry *e = bio->bi_private;
+	struct rzs_wb_batch *batch = e->batch;
+
+	e->err = err;
+	bio_put(bio);
+
+	if (atomic_dec_and_test(&batch->pending))
+		complete(&batch->done);
+}
+
+/* Write the batch out and wait for it */
+static void rzs_wb_submit(struct ramzswap *rzs, struct rzs_wb_batch *batch,
+			int nr)
+{
+	int i;
+
+	atomic_set(&batch->pending, nr);
+	init_completion(&batch->done);
+
+	for (i = 0; i < nr; i++) {
+		struct rzs_wb_entry *e = &batch->entry[i];
+		struct bio *bio;
+
+		bio = bio_alloc(GFP_NOIO, 1);
+		bio->bi_bdev = rzs->backing;
+		bio->bi_sector = (sector_t)e->blk << SECTORS_PER_PAGE_SHIFT;
+		bio->bi_private = e;
+		bio->bi_end_io = rzs_wb_end_io;
+
+		if (!bio_add_page(bio, e->page, PAGE_SIZE, 0)) {
+			rzs_wb_end_io(bio, -EIO);
+			continue;
+		}
+		submit_bio(WRITE, bio);
+	}
+
+	blk_unplug(bdev_get_queue(rzs->backing));
+	wait_for_completion(&batch->done);
+}
+
+/*
+ * Free the in-memory copy of each slot written. Slots that were
+ * rewritten or freed meanwhile lost RZS_UNDER_WB, their block is
+ * given up instead.
+ */
+static void rzs_wb_commit(struct ramzswap *rzs, struct rzs_wb_batch *batch,
+			int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct rzs_wb_entry *e = &batch->entry[i];
+		rwlock_t *lock = rzs_table_lock(rzs, e->index);
+
+		write_lock(lock);
+		if (!e->err && rzs_test_flag(rzs, e->index, RZS_UNDER_WB)) {
+			ramzswap_free_page(rzs, e->index);
+			rzs->table[e->index].element = e->blk;
+			rzs_set_flag(rzs, e->index, RZS_WB);
+			rzs_stat_inc(&rzs->stats.pages_wb);
+			rzs_stat_inc(&rzs->stats.pages_stored);
+		} else {
+			rzs_clear_flag(rzs, e->index, RZS_UNDER_WB);
+			rzs_bd_free(rzs, e->blk);
+		}
+		write_unlock(lock);
+
+		if (e->err) {
+			pr_err("Write to backing device failed! err=%d, "
+				"page=%u\n", e->err, e->index);
+			rzs_stat64_inc(rzs, &rzs->stats.failed_wb);
+		} else {
+			rzs_stat64_inc(rzs, &rzs->stats.bd_writes);
+		}
+	}
+}
+
+/*
+ * Write all slots that should be on the backing device to it,
+ * RZS_WB_BATCH pages at a time. Runs from rzs->wb_wq only.
+ */
+static void ramzswap_writeback(struct ramzswap *rzs)
+{
+	struct rzs_wb_batch *batch;
+	u32 pos = 1;	/* leave the swap header alone */
+	int i, nr;
+
+	batch = kzalloc(sizeof(*batch), GFP_NOIO);
+	if (!batch)
+		return;
+
+	for (i = 0; i < RZS_WB_BATCH; i++) {
+		batch->entry[i].batch = batch;
+		batch->entry[i].page = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
+		if (!batch->entry[i].page)
+			goto out;
+	}
+
+	while ((nr = rzs_wb_collect(rzs, batch, &pos))) {
+		rzs_wb_submit(rzs, batch, nr);
+		rzs_wb_commit(rzs, batch, nr);
+		cond_resched();
+	}
+
+out:
+	for (i = 0; i < RZS_WB_BATCH && batch->entry[i].page; i++)
+		__free_page(batch->entry[i].page);
+	kfree(batch);
+}
+
+static void ramzswap_wb_work(struct work_struct *work)
+{
+	struct ramzswap *rzs = container_of(to_delayed_work(work),
+				struct ramzswap, wb_work);
+
+	ramzswap_writeback(rzs);
+}
+
+static void ramzswap_wb_age_work(struct work_struct *work)
+{
+	struct ramzswap *rzs = container_of(to_delayed_work(work),
+				struct ramzswap, wb_age_work);
+
+	ramzswap_writeback(rzs);
+
+	/* Pages age by up to half of wb_age before being noticed */
+	if (rzs->init_done && rzs->wb_age)
+		queue_delayed_work(rzs->wb_wq, &rzs->wb_age_work,
+				max_t(unsigned long, rzs->wb_age * HZ / 2, HZ));
+}
+
+static int ramzswap_bd_open(struct ramzswap *rzs)
+{
+	struct block_device *bdev;
+	size_t bitmap_size;
+
+	bdev = open_bdev_exclusive(rzs->backing_name,
+				FMODE_READ | FMODE_WRITE, rzs);
+	if (IS_ERR(bdev)) {
+		pr_err("Error opening backing device %s\n",
+			rzs->backing_name);
+		return PTR_ERR(bdev);
+	}
+	rzs->backing = bdev;
+
+	rzs->bd_nr_pages = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (!rzs->bd_nr_pages) {
+		pr_err("Backing device %s is empty\n", rzs->backing_name);
+		return -EINVAL;
+	}
+
+	bitmap_size = BITS_TO_LONGS(rzs->bd_nr_pages) * sizeof(long);
+	rzs->bd_bitmap = vmalloc(bitmap_size);
+	if (!rzs->bd_bitmap) {
+		pr_err("Error allocating backing device bitmap\n");
+		return -ENOMEM;
+	}
+	memset(rzs->bd_bitmap, 0, bitmap_size);
+	rzs->bd_hint = 0;
+
+	rzs->wb_wq = create_singlethread_workqueue("ramzswap_wb");
+	if (!rzs->wb_wq)
+		return -ENOMEM;
+
+	pr_info("Using backing device %s (%lu kB)\n", rzs->backing_name,
+		rzs->bd_nr_pages << (PAGE_SHIFT - 10));
+	return 0;
+}
+
+/*
+ * Called by compaction of the pool. The object header tells which
+ * slot owns the object, unless the object was freed meanwhile, so
+ * the slot is checked under its lock before the object is moved.
+ * Shared objects are left alone: all slots sharing one would have
+ * to be locked to move it.
+ */
+static int ramzswap_migrate(struct zs_pool *pool, void *private,
+			struct page *page, u32 offset)
+{
+	struct ramzswap *rzs = private;
+	struct zobj_header *zheader;
+	rwlock_t *lock;
+	u32 index;
+	int ret = -EBUSY;
+
+	zheader = zs_map_object(pool, page, offset, ZS_MM_RO);
+	index = zheader->table_idx;
+	zs_unmap_object(pool, page, offset);
+
+	if (index >= rzs->disksize >> PAGE_SHIFT)
+		return -EINVAL;
+
+	lock = rzs_table_lock(rzs, index);
+	write_lock(lock);
+	if (rzs->table[index].page == page &&
+			rzs->table[index].offset == offset &&
+			!(rzs->table[index].flags & (BIT(RZS_UNCOMPRESSED) |
+			BIT(RZS_SAME) | BIT(RZS_DEDUP) | BIT(RZS_WB)))) {
+		ret = zs_move(pool, &page, &offset);
+		if (!ret) {
+			rzs->table[index].page = page;
+			rzs->table[index].offset = offset;
+		}
+	}
+	write_unlock(lock);
+
+	return ret;
+}
+
 static void reset_device(struct ramzswap *rzs)
 {
 	size_t index;
@@ -491,35 +1184,50 @@ static void reset_device(struct ramzswap *rzs)
 	/* Do not accept any new I/O request */
 	rzs->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(rzs->compress_workmem);
-	free_pages((unsigned long)rzs->compress_buffer, 1);
-
-	rzs->compress_workmem = NULL;
-	rzs->compress_buffer = NULL;
+	/* Writeback uses the streams and the table */
+	if (rzs->wb_wq) {
+		cancel_delayed_work_sync(&rzs->wb_age_work);
+		cancel_delayed_work_sync(&rzs->wb_work);
+		destroy_workqueue(rzs->wb_wq);
+		rzs->wb_wq = NULL;
+	}
 
-	/* Free all pages that are still in this ramzswap device */
-	for (index = 0; index < rzs->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
+	/* Free the compression streams */
+	while (!list_empty(&rzs->idle_strm)) {
+		struct rzs_stream *strm;
 
-		page = rzs->table[index].page;
-		offset = rzs->table[index].offset;
+		strm = list_first_entry(&rzs->idle_strm,
+				struct rzs_stream, list);
+		list_del(&strm->list);
+		rzs_strm_free(strm);
+	}
 
-		if (!page)
-			continue;
+	/*
+	 * Free all pages that are still in this ramzswap device.
+	 * Compaction may still be moving objects, so lock.
+	 */
+	for (index = 0; rzs->table &&
+			index < rzs->disksize >> PAGE_SHIFT; index++) {
+		rwlock_t *lock = rzs_table_lock(rzs, index);
 
-		if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(rzs->mem_pool, page, offset);
+		write_lock(lock);
+		ramzswap_free_page(rzs, index);
+		write_unlock(lock);
 	}
 
+	/* Waits for compaction, which looks at the table */
+	if (rzs->mem_pool)
+		zs_destroy_pool(rzs->mem_pool);
+	rzs->mem_pool = NULL;
+
 	vfree(rzs->table);
 	rzs->table = NULL;
 
-	xv_destroy_pool(rzs->mem_pool);
-	rzs->mem_pool = NULL;
+	vfree(rzs->bd_bitmap);
+	rzs->bd_bitmap = NULL;
+	if (rzs->backing)
+		close_bdev_exclusive(rzs->backing, FMODE_READ | FMODE_WRITE);
+	rzs->backing = NULL;
 
 	/* Reset stats */
 	memset(&rzs->stats, 0, sizeof(rzs->stats));
@@ -529,7 +1237,7 @@ static void reset_device(struct ramzswap *rzs)
 
 static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 {
-	int ret;
+	int ret, i;
 	size_t num_pages;
 	struct page *page;
 	union swap_header *swap_header;
@@ -541,18 +1249,15 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 
 	ramzswap_set_disksize(rzs, totalram_pages << PAGE_SHIFT);
 
-	rzs->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!rzs->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
+	for (i = 0; i < num_online_cpus(); i++) {
+		struct rzs_stream *strm = rzs_strm_alloc(rzs->compressor);
 
-	rzs->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!rzs->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
-		goto fail;
+		if (!strm) {
+			pr_err("Error allocating compression stream %d\n", i);
+			ret = -ENOMEM;
+			goto fail;
+		}
+		list_add(&strm->list, &rzs->idle_strm);
 	}
 
 	num_pages = rzs->disksize >> PAGE_SHIFT;
@@ -584,16 +1289,27 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 	/* ramzswap devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, rzs->disk->queue);
 
-	rzs->mem_pool = xv_create_pool();
+	rzs->mem_pool = zs_create_pool(ramzswap_migrate, rzs);
 	if (!rzs->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
 		goto fail;
 	}
 
+	if (rzs->backing_name[0]) {
+		ret = ramzswap_bd_open(rzs);
+		if (ret)
+			goto fail;
+	}
+
 	rzs->init_done = 1;
 
-	pr_debug("Initialization done!\n");
+	if (rzs->backing && rzs->wb_age)
+		queue_delayed_work(rzs->wb_wq, &rzs->wb_age_work,
+				rzs->wb_age * HZ);
+
+	pr_debug("Initialization done, compressor %s%s\n",
+		rzs->compressor, rzs->dedup ? ", dedup" : "");
 	return 0;
 
 fail:
@@ -634,9 +1350,90 @@ static int ramzswap_ioctl(struct block_device *bdev, fmode_t mode,
 		pr_info("Disk size set to %zu kB\n", disksize_kb);
 		break;
 
+	case RZSIO_SET_COMPRESSOR:
+	{
+		char name[RZS_MAX_COMP_NAME];
+
+		if (rzs->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (copy_from_user(name, (void *)arg, sizeof(name))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		name[sizeof(name) - 1] = '\0';
+		if (!crypto_has_comp(name, 0, 0)) {
+			pr_info("Compressor %s not available\n", name);
+			ret = -EINVAL;
+			goto out;
+		}
+		strlcpy(rzs->compressor, name, sizeof(rzs->compressor));
+		pr_info("Compressor set to %s\n", name);
+		break;
+	}
+	case RZSIO_SET_DEDUP:
+		if (rzs->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (get_user(rzs->dedup, (int __user *)arg)) {
+			ret = -EFAULT;
+			goto out;
+		}
+		break;
+
+	case RZSIO_SET_BACKING_DEV:
+	{
+		char name[RZS_MAX_BACKING_NAME];
+
+		if (rzs->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (copy_from_user(name, (void *)arg, sizeof(name))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		name[sizeof(name) - 1] = '\0';
+		strlcpy(rzs->backing_name, name, sizeof(rzs->backing_name));
+		pr_info("Backing device set to %s\n", name);
+		break;
+	}
+	case RZSIO_SET_WB_AGE:
+	{
+		u32 age;
+
+		if (get_user(age, (u32 __user *)arg)) {
+			ret = -EFAULT;
+			goto out;
+		}
+		if (age > max_wb_age) {
+			ret = -EINVAL;
+			goto out;
+		}
+		rzs->wb_age = age;
+		/*
+		 * May be changed on a running device; the pending scan may
+		 * be up to half the old age away, so run it now instead.
+		 */
+		if (rzs->init_done && rzs->backing && age) {
+			cancel_delayed_work(&rzs->wb_age_work);
+			queue_delayed_work(rzs->wb_wq, &rzs->wb_age_work, 0);
+		}
+		break;
+	}
 	case RZSIO_GET_STATS:
+	case RZSIO_GET_STATS2:
 	{
-		struct ramzswap_ioctl_stats *stats;
+		struct ramzswap_ioctl_stats2 *stats;
+		size_t size = sizeof(*stats);
+
+		/* the old structure is the start of the new one */
+		BUILD_BUG_ON(offsetof(struct ramzswap_ioctl_stats2, pages_same)
+			     != sizeof(struct ramzswap_ioctl_stats));
+		if (cmd == RZSIO_GET_STATS)
+			size = sizeof(struct ramzswap_ioctl_stats);
 		if (!rzs->init_done) {
 			ret = -ENOTTY;
 			goto out;
@@ -647,7 +1444,7 @@ static int ramzswap_ioctl(struct block_device *bdev, fmode_t mode,
 			goto out;
 		}
 		ramzswap_ioctl_get_stats(rzs, stats);
-		if (copy_to_user((void *)arg, stats, sizeof(*stats))) {
+		if (copy_to_user((void *)arg, stats, size)) {
 			kfree(stats);
 			ret = -EFAULT;
 			goto out;
@@ -685,9 +1482,15 @@ out:
 void ramzswap_slot_free_notify(struct block_device *bdev, unsigned long index)
 {
 	struct ramzswap *rzs;
+	rwlock_t *lock;
 
 	rzs = bdev->bd_disk->private_data;
+	lock = rzs_table_lock(rzs, index);
+
+	/* Called with swap_lock held, so only spin here */
+	write_lock(lock);
 	ramzswap_free_page(rzs, index);
+	write_unlock(lock);
 	rzs_stat64_inc(rzs, &rzs->stats.notify_free);
 
 	return;
@@ -701,9 +1504,19 @@ static struct block_device_operations ramzswap_devops = {
 
 static int create_device(struct ramzswap *rzs, int device_id)
 {
-	int ret = 0;
-
-	mutex_init(&rzs->lock);
+	int ret = 0, i;
+
+	for (i = 0; i < RZS_TABLE_LOCKS; i++)
+		rwlock_init(&rzs->table_lock[i]);
+	INIT_LIST_HEAD(&rzs->idle_strm);
+	spin_lock_init(&rzs->strm_lock);
+	init_waitqueue_head(&rzs->strm_wait);
+	strlcpy(rzs->compressor, default_compressor, sizeof(rzs->compressor));
+	rzs->dedup_tree = RB_ROOT;
+	spin_lock_init(&rzs->dedup_lock);
+	spin_lock_init(&rzs->bd_lock);
+	INIT_DELAYED_WORK(&rzs->wb_work, ramzswap_wb_work);
+	INIT_DELAYED_WORK(&rzs->wb_age_work, ramzswap_wb_age_work);
 	spin_lock_init(&rzs->stat64_lock);
 
 	rzs->queue = blk_alloc_queue(GFP_KERNEL);
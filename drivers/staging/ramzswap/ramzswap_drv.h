@@ -15,11 +15,16 @@
 #ifndef _RAMZSWAP_DRV_H_
 #define _RAMZSWAP_DRV_H_
 
+#include <linux/completion.h>
+#include <linux/crypto.h>
+#include <linux/list.h>
+#include <linux/rbtree.h>
 #include <linux/spinlock.h>
-#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
 #include "ramzswap_ioctl.h"
-#include "xvmalloc.h"
+#include "zsalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -32,11 +37,11 @@ static const unsigned max_num_devices = 32;
  *
  * It stores back-reference to table entry which points to this
  * object. This is required to support memory defragmentation.
+ * The allocator rounds sizes up, so the exact size is kept too.
  */
 struct zobj_header {
-#if 0
 	u32 table_idx;
-#endif
+	u16 size;
 };
 
 /*-- Configurable parameters */
@@ -44,6 +49,9 @@ struct zobj_header {
 /* Default ramzswap disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
+/* Default compressor (any crypto API compression algorithm works) */
+static const char default_compressor[] = "lzo";
+
 /*
  * Pages that compress to size greater than this are stored
  * uncompressed in memory.
@@ -52,12 +60,30 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
+ * otherwise, zs_malloc() would always return failure.
+ */
+
+/*
+ * With a backing device, incompressible pages are collected for
+ * this long before a batch of them is written out.
  */
+static const unsigned wb_delay_ms = 100;
+
+/* Longest idle time after which pages can be written back (secs) */
+static const unsigned max_wb_age = 7 * 24 * 3600;
 
 /*-- End of configurable params */
 
+/* Pages written to the backing device per batch */
+#define RZS_WB_BATCH		32
+
+/*
+ * Number of locks the table is striped over. Slot i is protected
+ * by table_lock[i % RZS_TABLE_LOCKS]. Must be power of two.
+ */
+#define RZS_TABLE_LOCKS		64
+
 #define SECTOR_SHIFT		9
 #define SECTOR_SIZE		(1 << SECTOR_SHIFT)
 #define SECTORS_PER_PAGE_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
@@ -71,26 +97,82 @@ enum rzs_pageflags {
 	/* Page consists entirely of zeros */
 	RZS_ZERO,
 
+	/* Page is one word repeated, kept in table[page_no].element */
+	RZS_SAME,
+
+	/* Object is shared, table[page_no].dedup points to it */
+	RZS_DEDUP,
+
+	/* Page is on the backing device, at block table[page_no].element */
+	RZS_WB,
+
+	/* Page is being written to the backing device */
+	RZS_UNDER_WB,
+
 	__NR_RZS_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
 /*
- * Allocated for each swap slot, indexed by page no.
- * These table entries must fit exactly in a page.
+ * Allocated for each swap slot, indexed by page no. This is 12 bytes
+ * per slot on 32-bit, for the whole disksize, so keep it small.
  */
 struct table {
-	struct page *page;
+	union {
+		struct page *page;
+		struct rzs_dedup *dedup;	/* RZS_DEDUP */
+		unsigned long element;		/* RZS_SAME, RZS_WB */
+	};
 	u16 offset;
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
+	unsigned long ac_time;	/* jiffies when the page was stored */
 } __attribute__((aligned(4)));
 
+/*
+ * Compressed object shared by all slots holding identical data.
+ * Indexed by the checksum of the compressed data in rzs->dedup_tree.
+ */
+struct rzs_dedup {
+	struct rb_node node;
+	u32 checksum;
+	u32 refcount;		/* protected by rzs->dedup_lock */
+	struct page *page;
+	u16 offset;
+};
+
+/*
+ * Compression workspace: a compressor instance and an output buffer
+ * big enough for the worst case expansion of one page.
+ */
+struct rzs_stream {
+	struct list_head list;
+	struct crypto_comp *tfm;
+	void *buffer;
+};
+
+/*
+ * One batch of pages being written to the backing device. Each page
+ * holds a copy of a slot's data, the slot keeps its own copy until
+ * the write has completed.
+ */
+struct rzs_wb_batch {
+	atomic_t pending;		/* bios not completed yet */
+	struct completion done;
+	struct rzs_wb_entry {
+		struct rzs_wb_batch *batch;
+		struct page *page;
+		unsigned long blk;	/* block on the backing device */
+		u32 index;
+		int err;
+	} entry[RZS_WB_BATCH];
+};
+
 struct ramzswap_stats {
 	/* basic stats */
-	size_t compr_size;	/* compressed size of pages stored -
-				 * needed to enforce memlimit */
+	atomic_long_t compr_size;	/* compressed size of pages stored -
+					 * needed to enforce memlimit */
 	/* more stats */
 #if defined(CONFIG_RAMZSWAP_STATS)
 	u64 num_reads;		/* failed + successful */
@@ -99,27 +181,63 @@ struct ramzswap_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-swap I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
-	u32 pages_stored;	/* no. of pages currently stored */
-	u32 good_compress;	/* % of pages with compression ratio<=50% */
-	u32 pages_expand;	/* % of incompressible pages */
+	atomic_t pages_zero;	/* no. of zero filled pages */
+	atomic_t pages_same;	/* no. of other single-word filled pages */
+	atomic_t pages_dup;	/* no. of pages sharing another's object */
+	atomic_t pages_stored;	/* no. of pages currently stored */
+	atomic_t good_compress;	/* % of pages with compression ratio<=50% */
+	atomic_t pages_expand;	/* % of incompressible pages */
+	atomic_t pages_wb;	/* no. of pages on the backing device */
+	u64 bd_reads;		/* reads from the backing device */
+	u64 bd_writes;		/* pages written to the backing device */
+	u64 failed_wb;		/* failed writes to the backing device */
 #endif
 };
 
 struct ramzswap {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
 	struct table *table;
+	rwlock_t table_lock[RZS_TABLE_LOCKS];
+
+	/*
+	 * One compression stream per online CPU at init time. Readers
+	 * and writers take an idle one and sleep on strm_wait when all
+	 * are busy.
+	 */
+	struct list_head idle_strm;
+	spinlock_t strm_lock;
+	wait_queue_head_t strm_wait;
+	char compressor[RZS_MAX_COMP_NAME];
+
+	/* Objects shared between slots, if dedup is enabled */
+	int dedup;
+	struct rb_root dedup_tree;
+	spinlock_t dedup_lock;
+
+	/*
+	 * Optional backing device. Incompressible pages, and pages
+	 * idle for wb_age seconds if that is set, are written to it in
+	 * batches from wb_wq and read back from it directly. Its space
+	 * is handed out page by page from bd_bitmap.
+	 */
+	char backing_name[RZS_MAX_BACKING_NAME];
+	struct block_device *backing;
+	unsigned long *bd_bitmap;
+	unsigned long bd_nr_pages;
+	unsigned long bd_hint;	/* where to look for free blocks */
+	spinlock_t bd_lock;	/* protects bd_bitmap, bd_hint */
+	u32 wb_age;
+	struct workqueue_struct *wb_wq;
+	struct delayed_work wb_work;	/* incompressible pages */
+	struct delayed_work wb_age_work;	/* idle pages, periodic */
+
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
 	/*
 	 * This is limit on amount of *uncompressed* worth of data
-	 * we can hold. When backing swap device is provided, it is
-	 * set equal to device size.
+	 * we can hold. A backing device may be smaller or larger.
 	 */
 	size_t disksize;	/* bytes */
 
@@ -130,14 +248,14 @@ struct ramzswap {
 
 /* Debugging and Stats */
 #if defined(CONFIG_RAMZSWAP_STATS)
-static void rzs_stat_inc(u32 *v)
+static void rzs_stat_inc(atomic_t *v)
 {
-	*v = *v + 1;
+	atomic_inc(v);
 }
 
-static void rzs_stat_dec(u32 *v)
+static void rzs_stat_dec(atomic_t *v)
 {
-	*v = *v - 1;
+	atomic_dec(v);
 }
 
 static void rzs_stat64_inc(struct ramzswap *rzs, u64 *v)
@@ -15,6 +15,9 @@
 #ifndef _RAMZSWAP_IOCTL_H_
 #define _RAMZSWAP_IOCTL_H_
 
+#define RZS_MAX_COMP_NAME	16
+#define RZS_MAX_BACKING_NAME	128
+
 struct ramzswap_ioctl_stats {
 	u64 disksize;		/* user specified or equal to backing swap
 				 * size (if present) */
@@ -34,9 +37,49 @@ struct ramzswap_ioctl_stats {
 	u64 mem_used_total;
 } __attribute__ ((packed, aligned(4)));
 
+/*
+ * Returned by RZSIO_GET_STATS2.  Starts out with the fields of struct
+ * ramzswap_ioctl_stats, which RZSIO_GET_STATS keeps returning for the
+ * tools built against it.
+ */
+struct ramzswap_ioctl_stats2 {
+	u64 disksize;
+	u64 num_reads;
+	u64 num_writes;
+	u64 failed_reads;
+	u64 failed_writes;
+	u64 invalid_io;
+	u64 notify_free;
+	u32 pages_zero;
+	u32 good_compress_pct;
+	u32 pages_expand_pct;
+	u32 pages_stored;
+	u32 pages_used;
+	u64 orig_data_size;
+	u64 compr_data_size;
+	u64 mem_used_total;
+	u32 pages_same;		/* no. of pages filled with a repeated word */
+	u32 pages_dup;		/* no. of pages deduplicated */
+	char compressor[RZS_MAX_COMP_NAME];
+	u32 frag_pct;		/* unused space in pool pages */
+	u32 pool_efficiency_pct; /* compressed data size / memory used */
+	u64 compactions;	/* pool compaction passes */
+	u64 objs_migrated;	/* objects moved by compaction */
+	u64 pages_compacted;	/* pages freed by compaction */
+	u32 pages_wb;		/* no. of pages on the backing device */
+	u64 bd_reads;		/* reads from the backing device */
+	u64 bd_writes;		/* pages written to the backing device */
+	u64 failed_wb;		/* failed writes to the backing device */
+} __attribute__ ((packed, aligned(4)));
+
 #define RZSIO_SET_DISKSIZE_KB	_IOW('z', 0, size_t)
 #define RZSIO_GET_STATS		_IOR('z', 1, struct ramzswap_ioctl_stats)
 #define RZSIO_INIT		_IO('z', 2)
 #define RZSIO_RESET		_IO('z', 3)
+#define RZSIO_SET_COMPRESSOR	_IOW('z', 4, char[RZS_MAX_COMP_NAME])
+#define RZSIO_SET_DEDUP		_IOW('z', 5, int)
+#define RZSIO_SET_BACKING_DEV	_IOW('z', 6, char[RZS_MAX_BACKING_NAME])
+#define RZSIO_SET_WB_AGE	_IOW('z', 7, u32)
+#define RZSIO_GET_STATS2	_IOR('z', 8, struct ramzswap_ioctl_stats2)
 
 #endif
@@ -0,0 +1,660 @@
+/*
+ * zsalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Objects are grouped in size classes. Each class carves equally
+ * sized objects out of zspages, small groups of pages, so an object
+ * can be moved to any free slot of its class. When a class gets too
+ * many free slots, compaction moves the objects of its emptiest
+ * zspages into the others and frees the emptied pages; the owner of
+ * the objects is asked to do each move, see zs_migrate_fn.
+ */
+
+#include <linux/bitops.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/workqueue.h>
+
+#include "zsalloc.h"
+#include "zsalloc_int.h"
+
+static struct zspage *page_zspage(struct page *page)
+{
+	return (struct zspage *)page_private(page);
+}
+
+/* Offset of <page, offset> from the start of its zspage */
+static unsigned long obj_linear(struct page *page, u32 offset)
+{
+	return (page->index << PAGE_SHIFT) + offset;
+}
+
+static void obj_location(struct size_class *class, struct zspage *zspage,
+			u32 idx, struct page **page, u32 *offset)
+{
+	unsigned long off = (unsigned long)idx * class->size;
+
+	*page = zspage->pages[off >> PAGE_SHIFT];
+	*offset = off & ~PAGE_MASK;
+}
+
+/*
+ * Get index of the smallest class whose objects are at least
+ * the given size.
+ */
+static u32 get_class_index(u32 size)
+{
+	if (unlikely(size < ZS_MIN_ALLOC_SIZE))
+		size = ZS_MIN_ALLOC_SIZE;
+	return DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE, ZS_SIZE_CLASS_DELTA);
+}
+
+/*
+ * Number of pages per zspage that leaves the least space unused
+ * at its end for objects of the given size.
+ */
+static int get_pages_per_zspage(u32 size)
+{
+	int i, best = 1, max_usedpc = 0;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		u32 zspage_size = i * PAGE_SIZE;
+		u32 waste = zspage_size % size;
+		int usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+			struct zspage *zspage)
+{
+	if (zspage->inuse == class->objs_per_zspage)
+		return ZS_FULL;
+	if (zspage->inuse * 4 >= class->objs_per_zspage * 3)
+		return ZS_ALMOST_FULL;
+	return ZS_ALMOST_EMPTY;
+}
+
+/* Move the zspage to the list matching its use. Class lock held. */
+static void fix_fullness_group(struct size_class *class,
+			struct zspage *zspage)
+{
+	enum fullness_group fg;
+
+	if (zspage->isolated)
+		return;
+
+	fg = get_fullness_group(class, zspage);
+	if (fg == zspage->fullness)
+		return;
+
+	list_move(&zspage->list, &class->fullness_list[fg]);
+	zspage->fullness = fg;
+}
+
+/*
+ * Returns a zspage of the class with a free slot, preferring the
+ * fuller ones so that the emptier ones get a chance to drain.
+ */
+static struct zspage *find_zspage(struct size_class *class)
+{
+	struct list_head *head;
+
+	head = &class->fullness_list[ZS_ALMOST_FULL];
+	if (list_empty(head))
+		head = &class->fullness_list[ZS_ALMOST_EMPTY];
+	if (list_empty(head))
+		return NULL;
+
+	return list_first_entry(head, struct zspage, list);
+}
+
+/*
+ * Too many free slots in the class? The free slots have to amount
+ * to a few zspages or compaction could not free anything.
+ */
+static int class_fragmented(struct size_class *class)
+{
+	unsigned long capacity = class->zspages * class->objs_per_zspage;
+	unsigned long free = capacity - class->objs_used;
+
+	return free >= ZS_COMPACT_MIN_ZSPAGES * class->objs_per_zspage &&
+		free * 100 > capacity * ZS_COMPACT_FRAG_PERC;
+}
+
+static struct zspage *alloc_zspage(struct size_class *class, gfp_t flags)
+{
+	int i;
+	struct zspage *zspage;
+
+	zspage = kzalloc(sizeof(*zspage), flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		struct page *page = alloc_page(flags);
+
+		if (unlikely(!page))
+			goto fail;
+		set_page_private(page, (unsigned long)zspage);
+		page->index = i;
+		zspage->pages[i] = page;
+	}
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class = class;
+	zspage->fullness = ZS_ALMOST_EMPTY;
+
+	return zspage;
+
+fail:
+	while (i--) {
+		set_page_private(zspage->pages[i], 0);
+		__free_page(zspage->pages[i]);
+	}
+	kfree(zspage);
+	return NULL;
+}
+
+static void free_zspage(struct zs_pool *pool, struct zspage *zspage)
+{
+	int i, nr_pages = zspage->class->pages_per_zspage;
+
+	for (i = 0; i < nr_pages; i++) {
+		set_page_private(zspage->pages[i], 0);
+		__free_page(zspage->pages[i]);
+	}
+	kfree(zspage);
+
+	atomic_long_sub(nr_pages, &pool->total_pages);
+}
+
+/* Take a free slot of the zspage. Class lock held. */
+static void obj_alloc(struct size_class *class, struct zspage *zspage,
+			struct page **page, u32 *offset)
+{
+	u32 idx;
+
+	idx = find_first_zero_bit(zspage->used, class->objs_per_zspage);
+	__set_bit(idx, zspage->used);
+	zspage->inuse++;
+	class->objs_used++;
+
+	fix_fullness_group(class, zspage);
+	obj_location(class, zspage, idx, page, offset);
+}
+
+/*
+ * Release a slot. Returns 1 if the zspage is now empty and was taken
+ * off the class, so that the caller frees it after dropping the lock.
+ * Class lock held.
+ */
+static int obj_free(struct size_class *class, struct zspage *zspage,
+			struct page *page, u32 offset)
+{
+	u32 idx = obj_linear(page, offset) / class->size;
+
+	/* Catch double free bugs */
+	BUG_ON(!test_bit(idx, zspage->used));
+
+	__clear_bit(idx, zspage->used);
+	zspage->inuse--;
+	class->objs_used--;
+	/* It may have been the object that kept the zspage in place */
+	zspage->unmovable = 0;
+
+	/* An isolated zspage is freed by compaction */
+	if (!zspage->inuse && !zspage->isolated) {
+		list_del(&zspage->list);
+		class->zspages--;
+		return 1;
+	}
+
+	fix_fullness_group(class, zspage);
+	return 0;
+}
+
+/*
+ * Copy len bytes between buf and the zspage, starting at the given
+ * offset from the zspage start, one page at a time.
+ */
+static void zspage_copy(struct zspage *zspage, unsigned long off,
+			char *buf, u32 len, int to_zspage)
+{
+	while (len) {
+		u32 pgoff = off & ~PAGE_MASK;
+		u32 n = min_t(u32, len, PAGE_SIZE - pgoff);
+		char *vaddr;
+
+		vaddr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT], KM_USER1);
+		if (to_zspage)
+			memcpy(vaddr + pgoff, buf, n);
+		else
+			memcpy(buf, vaddr + pgoff, n);
+		kunmap_atomic(vaddr, KM_USER1);
+
+		buf += n;
+		off += n;
+		len -= n;
+	}
+}
+
+/* Copy one object of the class to another slot, page by page */
+static void obj_copy(struct size_class *class, struct zspage *dst,
+			unsigned long doff, struct zspage *src,
+			unsigned long soff)
+{
+	u32 len = class->size;
+
+	while (len) {
+		u32 n = min_t(u32, len, PAGE_SIZE - (soff & ~PAGE_MASK));
+		char *s, *d;
+
+		n = min_t(u32, n, PAGE_SIZE - (doff & ~PAGE_MASK));
+
+		s = kmap_atomic(src->pages[soff >> PAGE_SHIFT], KM_USER0);
+		d = kmap_atomic(dst->pages[doff >> PAGE_SHIFT], KM_USER1);
+		memcpy(d + (doff & ~PAGE_MASK), s + (soff & ~PAGE_MASK), n);
+		kunmap_atomic(d, KM_USER1);
+		kunmap_atomic(s, KM_USER0);
+
+		soff += n;
+		doff += n;
+		len -= n;
+	}
+}
+
+static void zs_compact_work(struct work_struct *work)
+{
+	zs_compact(container_of(work, struct zs_pool, compact_work));
+}
+
+/**
+ * zs_create_pool - create a memory pool
+ * @migrate: called by compaction to move an object, may be NULL
+ * @private: passed to @migrate
+ *
+ * Without @migrate, objects are never moved and the pool is
+ * not compacted.
+ */
+struct zs_pool *zs_create_pool(zs_migrate_fn migrate, void *private)
+{
+	int i, cpu;
+	u32 ovhd_size;
+	struct zs_pool *pool;
+
+	ovhd_size = roundup(sizeof(*pool), PAGE_SIZE);
+	pool = kzalloc(ovhd_size, GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_NR_CLASSES; i++) {
+		struct size_class *class = &pool->classes[i];
+		int fg;
+
+		spin_lock_init(&class->lock);
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage * PAGE_SIZE
+						/ class->size;
+		for (fg = 0; fg < __NR_FULLNESS_GROUPS; fg++)
+			INIT_LIST_HEAD(&class->fullness_list[fg]);
+	}
+
+	pool->migrate = migrate;
+	pool->private = private;
+	INIT_WORK(&pool->compact_work, zs_compact_work);
+
+	pool->map_area = alloc_percpu(struct zs_map_area);
+	if (!pool->map_area)
+		goto fail;
+	for_each_possible_cpu(cpu) {
+		struct zs_map_area *area = per_cpu_ptr(pool->map_area, cpu);
+
+		area->buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->buf)
+			goto fail;
+	}
+
+	return pool;
+
+fail:
+	zs_destroy_pool(pool);
+	return NULL;
+}
+
+/*
+ * All objects must have been freed.
+ */
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int cpu;
+
+	cancel_work_sync(&pool->compact_work);
+
+	if (pool->map_area) {
+		for_each_possible_cpu(cpu)
+			kfree(per_cpu_ptr(pool->map_area, cpu)->buf);
+		free_percpu(pool->map_area);
+	}
+	kfree(pool);
+}
+
+/**
+ * zs_malloc - Allocate object of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of object to allocate
+ * @page: page that holds the start of the object
+ * @offset: location of object within page
+ *
+ * On success, <page, offset> identifies the object allocated
+ * and 0 is returned. On failure, <page, offset> is set to
+ * 0 and -ENOMEM is returned.
+ *
+ * The object may continue in another page, so it must be
+ * accessed through zs_map_object().
+ */
+int zs_malloc(struct zs_pool *pool, u32 size, struct page **page,
+		u32 *offset, gfp_t flags)
+{
+	struct size_class *class;
+	struct zspage *zspage;
+
+	*page = NULL;
+	*offset = 0;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return -ENOMEM;
+
+	class = &pool->classes[get_class_index(size)];
+
+	spin_lock(&class->lock);
+	zspage = find_zspage(class);
+
+	if (!zspage) {
+		struct zspage *new;
+
+		spin_unlock(&class->lock);
+		new = alloc_zspage(class, flags);
+		if (unlikely(!new))
+			return -ENOMEM;
+		atomic_long_add(class->pages_per_zspage, &pool->total_pages);
+
+		spin_lock(&class->lock);
+		list_add(&new->list, &class->fullness_list[ZS_ALMOST_EMPTY]);
+		class->zspages++;
+		zspage = find_zspage(class);
+	}
+
+	obj_alloc(class, zspage, page, offset);
+	spin_unlock(&class->lock);
+
+	return 0;
+}
+
+/*
+ * Free object identified with <page, offset>
+ */
+void zs_free(struct zs_pool *pool, struct page *page, u32 offset)
+{
+	struct zspage *zspage = page_zspage(page);
+	struct size_class *class = zspage->class;
+	int empty, compact;
+
+	spin_lock(&class->lock);
+	empty = obj_free(class, zspage, page, offset);
+	/* Only a sparsely used zspage gives compaction something to move */
+	compact = pool->migrate && !empty && !zspage->isolated &&
+		zspage->fullness == ZS_ALMOST_EMPTY && class_fragmented(class);
+	spin_unlock(&class->lock);
+
+	if (empty)
+		free_zspage(pool, zspage);
+
+	/* We may be in atomic context, compact from a worker */
+	if (compact)
+		schedule_work(&pool->compact_work);
+}
+
+/**
+ * zs_map_object - get a pointer to an object
+ * @pool: pool the object belongs to
+ * @page: page that holds the start of the object
+ * @offset: location of object within page
+ * @mm: how the object will be accessed
+ *
+ * An object that crosses a page boundary is copied to a per-cpu
+ * buffer (unless @mm is ZS_MM_WO), and copied back on unmap unless
+ * @mm is ZS_MM_RO. Preemption is disabled until zs_unmap_object();
+ * only one object can be mapped at a time. KM_USER1 is used.
+ */
+void *zs_map_object(struct zs_pool *pool, struct page *page, u32 offset,
+			enum zs_mapmode mm)
+{
+	struct zspage *zspage = page_zspage(page);
+	struct size_class *class = zspage->class;
+	struct zs_map_area *area;
+
+	area = per_cpu_ptr(pool->map_area, get_cpu());
+	area->mm = mm;
+
+	if (offset + class->size <= PAGE_SIZE) {
+		area->vaddr = kmap_atomic(page, KM_USER1);
+		return area->vaddr + offset;
+	}
+
+	area->vaddr = NULL;
+	if (mm != ZS_MM_WO)
+		zspage_copy(zspage, obj_linear(page, offset), area->buf,
+				class->size, 0);
+	return area->buf;
+}
+
+void zs_unmap_object(struct zs_pool *pool, struct page *page, u32 offset)
+{
+	struct zspage *zspage = page_zspage(page);
+	struct size_class *class = zspage->class;
+	struct zs_map_area *area;
+
+	area = per_cpu_ptr(pool->map_area, smp_processor_id());
+
+	if (area->vaddr)
+		kunmap_atomic(area->vaddr, KM_USER1);
+	else if (area->mm != ZS_MM_RO)
+		zspage_copy(zspage, obj_linear(page, offset), area->buf,
+				class->size, 1);
+
+	put_cpu();
+}
+
+/**
+ * zs_move - move an object to another slot of its class
+ * @pool: pool the object belongs to
+ * @page: page that holds the start of the object, updated
+ * @offset: location of object within page, updated
+ *
+ * Only uses free slots of existing zspages. The caller must keep
+ * everybody else from accessing the object. Returns -ENOMEM when
+ * the class has no free slot outside of the object's zspage.
+ */
+int zs_move(struct zs_pool *pool, struct page **page, u32 *offset)
+{
+	struct zspage *src = page_zspage(*page), *dst;
+	struct size_class *class = src->class;
+	struct page *new_page;
+	u32 new_offset;
+	int empty;
+
+	spin_lock(&class->lock);
+	dst = find_zspage(class);
+	if (!dst || dst == src) {
+		spin_unlock(&class->lock);
+		return -ENOMEM;
+	}
+
+	obj_alloc(class, dst, &new_page, &new_offset);
+	obj_copy(class, dst, obj_linear(new_page, new_offset),
+			src, obj_linear(*page, *offset));
+	empty = obj_free(class, src, *page, *offset);
+	spin_unlock(&class->lock);
+
+	if (empty)
+		free_zspage(pool, src);
+
+	atomic_long_inc(&pool->objs_migrated);
+
+	*page = new_page;
+	*offset = new_offset;
+	return 0;
+}
+
+/*
+ * Returns the zspage with the fewest objects, if the other zspages
+ * of the class have room for all of them. Zspages none of whose
+ * objects could be moved last time are skipped until one of their
+ * objects is freed. Class lock held.
+ */
+static struct zspage *find_source_zspage(struct size_class *class)
+{
+	struct zspage *zspage, *best = NULL;
+	unsigned long free;
+
+	list_for_each_entry(zspage, &class->fullness_list[ZS_ALMOST_EMPTY],
+				list) {
+		if (zspage->unmovable)
+			continue;
+		if (!best || zspage->inuse < best->inuse)
+			best = zspage;
+	}
+	if (!best)
+		return NULL;
+
+	free = class->zspages * class->objs_per_zspage - class->objs_used;
+	if (free - (class->objs_per_zspage - best->inuse) < best->inuse)
+		return NULL;
+
+	return best;
+}
+
+/* Empty zspages of the class until it is no longer fragmented */
+static void compact_class(struct zs_pool *pool, struct size_class *class)
+{
+	unsigned long used[BITS_TO_LONGS(ZS_MAX_OBJS_PER_ZSPAGE)];
+	struct zspage *src;
+	struct page *page;
+	u32 idx, offset;
+	u16 inuse;
+	int empty, stuck;
+
+	for (;;) {
+		spin_lock(&class->lock);
+		src = class_fragmented(class) ? find_source_zspage(class)
+						: NULL;
+		if (!src) {
+			spin_unlock(&class->lock);
+			return;
+		}
+		/* Keep new objects out of it */
+		list_del_init(&src->list);
+		src->isolated = 1;
+		inuse = src->inuse;
+		memcpy(used, src->used, sizeof(used));
+		spin_unlock(&class->lock);
+
+		for_each_set_bit(idx, used, class->objs_per_zspage) {
+			obj_location(class, src, idx, &page, &offset);
+			pool->migrate(pool, pool->private, page, offset);
+		}
+
+		spin_lock(&class->lock);
+		src->isolated = 0;
+		empty = !src->inuse;
+		/* e.g. all its objects are shared by dedup */
+		stuck = src->inuse == inuse;
+		if (empty) {
+			class->zspages--;
+		} else {
+			src->unmovable = stuck;
+			src->fullness = get_fullness_group(class, src);
+			list_add(&src->list, &class->fullness_list[src->fullness]);
+		}
+		spin_unlock(&class->lock);
+
+		/*
+		 * Some objects could not be moved, try again later. If none
+		 * could, the zspage is skipped and others may do better.
+		 */
+		if (!empty) {
+			if (stuck)
+				continue;
+			return;
+		}
+
+		free_zspage(pool, src);
+		atomic_long_add(class->pages_per_zspage, &pool->pages_compacted);
+	}
+}
+
+/**
+ * zs_compact - move objects out of sparsely used zspages
+ * @pool: pool to compact
+ *
+ * Compacts every size class that has too many free slots. Called
+ * from a worker when zs_free() finds a class fragmented. Must be
+ * called from process context, with no locks of the owner held.
+ */
+void zs_compact(struct zs_pool *pool)
+{
+	int i;
+
+	if (!pool->migrate)
+		return;
+
+	atomic_long_inc(&pool->compactions);
+	for (i = 0; i < ZS_NR_CLASSES; i++)
+		compact_class(pool, &pool->classes[i]);
+}
+
+/*
+ * Returns total memory used by allocator (userdata + metadata)
+ */
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->total_pages) << PAGE_SHIFT;
+}
+
+void zs_get_stats(struct zs_pool *pool, struct zs_pool_stats *stats)
+{
+	int i;
+
+	stats->total_pages = atomic_long_read(&pool->total_pages);
+	stats->obj_bytes = 0;
+	for (i = 0; i < ZS_NR_CLASSES; i++) {
+		struct size_class *class = &pool->classes[i];
+
+		spin_lock(&class->lock);
+		stats->obj_bytes += (u64)class->objs_used * class->size;
+		spin_unlock(&class->lock);
+	}
+	stats->compactions = atomic_long_read(&pool->compactions);
+	stats->objs_migrated = atomic_long_read(&pool->objs_migrated);
+	stats->pages_compacted = atomic_long_read(&pool->pages_compacted);
+}
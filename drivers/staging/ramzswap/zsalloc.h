@@ -0,0 +1,59 @@
+/*
+ * zsalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_ALLOC_H_
+#define _ZS_ALLOC_H_
+
+#include <linux/types.h>
+
+struct page;
+struct zs_pool;
+
+/*
+ * Called by compaction for each object it wants to move. The owner
+ * must check that <page, offset> still is one of its objects, move
+ * it with zs_move() and update its reference to it, all while its
+ * users are kept away. Returns 0 if the object was moved.
+ */
+typedef int (*zs_migrate_fn)(struct zs_pool *pool, void *private,
+			struct page *page, u32 offset);
+
+enum zs_mapmode {
+	ZS_MM_RO,	/* read only */
+	ZS_MM_WO,	/* write only, old contents are not read */
+	ZS_MM_RW,
+};
+
+struct zs_pool_stats {
+	u64 total_pages;	/* pages used by the pool */
+	u64 obj_bytes;		/* bytes in allocated objects */
+	u64 compactions;	/* compaction passes */
+	u64 objs_migrated;	/* objects moved by compaction */
+	u64 pages_compacted;	/* pages freed by compaction */
+};
+
+struct zs_pool *zs_create_pool(zs_migrate_fn migrate, void *private);
+void zs_destroy_pool(struct zs_pool *pool);
+
+int zs_malloc(struct zs_pool *pool, u32 size, struct page **page,
+			u32 *offset, gfp_t flags);
+void zs_free(struct zs_pool *pool, struct page *page, u32 offset);
+
+void *zs_map_object(struct zs_pool *pool, struct page *page, u32 offset,
+			enum zs_mapmode mm);
+void zs_unmap_object(struct zs_pool *pool, struct page *page, u32 offset);
+
+int zs_move(struct zs_pool *pool, struct page **page, u32 *offset);
+void zs_compact(struct zs_pool *pool);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool);
+void zs_get_stats(struct zs_pool *pool, struct zs_pool_stats *stats);
+
+#endif
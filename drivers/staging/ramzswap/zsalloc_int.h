@@ -0,0 +1,102 @@
+/*
+ * zsalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_ALLOC_INT_H_
+#define _ZS_ALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+/* User configurable params */
+
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/* Size classes are ZS_SIZE_CLASS_DELTA bytes apart */
+#define ZS_SIZE_CLASS_DELTA	32
+#define ZS_NR_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) \
+					/ ZS_SIZE_CLASS_DELTA + 1)
+
+/*
+ * A zspage is 1 to ZS_MAX_PAGES_PER_ZSPAGE pages, as many as waste
+ * the least space for the class. Objects may cross page boundaries.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+#define ZS_MAX_OBJS_PER_ZSPAGE	(ZS_MAX_PAGES_PER_ZSPAGE * PAGE_SIZE \
+					/ ZS_MIN_ALLOC_SIZE)
+
+/*
+ * A class is compacted when more than ZS_COMPACT_FRAG_PERC percent
+ * of its object slots are free, and the free slots add up to at
+ * least ZS_COMPACT_MIN_ZSPAGES zspages.
+ */
+#define ZS_COMPACT_FRAG_PERC	25
+#define ZS_COMPACT_MIN_ZSPAGES	2
+
+/* End of user params */
+
+enum fullness_group {
+	ZS_ALMOST_FULL,		/* at least 3/4 of the objects in use */
+	ZS_ALMOST_EMPTY,
+	ZS_FULL,
+	__NR_FULLNESS_GROUPS,
+};
+
+struct size_class;
+
+struct zspage {
+	struct list_head list;		/* in class->fullness_list */
+	struct size_class *class;
+	u16 inuse;
+	u8 fullness;
+	u8 isolated;			/* being compacted */
+	u8 unmovable;			/* compaction could move nothing */
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	unsigned long used[BITS_TO_LONGS(ZS_MAX_OBJS_PER_ZSPAGE)];
+};
+
+struct size_class {
+	spinlock_t lock;
+	u32 size;
+	u16 pages_per_zspage;
+	u16 objs_per_zspage;
+	struct list_head fullness_list[__NR_FULLNESS_GROUPS];
+
+	/* stats */
+	unsigned long zspages;
+	unsigned long objs_used;
+};
+
+/* Bounce buffer for objects that cross a page boundary */
+struct zs_map_area {
+	char *buf;
+	void *vaddr;		/* mapped page if the buffer is not used */
+	enum zs_mapmode mm;
+};
+
+struct zs_pool {
+	struct size_class classes[ZS_NR_CLASSES];
+	struct zs_map_area *map_area;	/* per-cpu */
+
+	zs_migrate_fn migrate;
+	void *private;
+	struct work_struct compact_work;
+
+	/* stats */
+	atomic_long_t total_pages;
+	atomic_long_t compactions;
+	atomic_long_t objs_migrated;
+	atomic_long_t pages_compacted;
+};
+
+#endif
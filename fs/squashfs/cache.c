@@ -57,6 +57,7 @@
 #include "squashfs_fs_sb.h"
 #include "squashfs_fs_i.h"
 #include "squashfs.h"
+#include "page_actor.h"
 
 /*
  * Look-up block in cache, and increment usage count.  If not in cache, read
@@ -67,6 +68,7 @@ struct squashfs_cache_entry *squashfs_cache_get(struct super_block *sb,
 {
 	int i, n;
 	struct squashfs_cache_entry *entry;
+	struct squashfs_page_actor actor;
 
 	spin_lock(&cache->lock);
 
@@ -116,9 +118,11 @@ struct squashfs_cache_entry *squashfs_cache_get(struct super_block *sb,
 			entry->error = 0;
 			spin_unlock(&cache->lock);
 
-			entry->length = squashfs_read_data(sb, entry->data,
+			squashfs_buffer_actor_init(&actor, entry->data,
+				cache->pages);
+			entry->length = squashfs_read_data(sb, &actor,
 				block, length, &entry->next_index,
-				cache->block_size, cache->pages);
+				cache->block_size);
 
 			spin_lock(&cache->lock);
 
@@ -377,20 +381,6 @@ struct squashfs_cache_entry *squashfs_get_fragment(struct super_block *sb,
 }
 
 
-/*
- * Read and decompress the datablock located at <start_block> in the
- * filesystem.  The cache is used here to avoid duplicating locking and
- * read/decompress code.
- */
-struct squashfs_cache_entry *squashfs_get_datablock(struct super_block *sb,
-				u64 start_block, int length)
-{
-	struct squashfs_sb_info *msblk = sb->s_fs_info;
-
-	return squashfs_cache_get(sb, msblk->read_page, start_block, length);
-}
-
-
 /*
  * Read a filesystem table (uncompressed sequence of bytes) from disk
  */
@@ -399,14 +389,16 @@ int squashfs_read_table(struct super_block *sb, void *buffer, u64 block,
 {
 	int pages = (length + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
 	int i, res;
+	struct squashfs_page_actor actor;
 	void **data = kcalloc(pages, sizeof(void *), GFP_KERNEL);
 	if (data == NULL)
 		return -ENOMEM;
 
 	for (i = 0; i < pages; i++, buffer += PAGE_CACHE_SIZE)
 		data[i] = buffer;
-	res = squashfs_read_data(sb, data, block, length |
-		SQUASHFS_COMPRESSED_BIT_BLOCK, NULL, length, pages);
+	squashfs_buffer_actor_init(&actor, data, pages);
+	res = squashfs_read_data(sb, &actor, block, length |
+		SQUASHFS_COMPRESSED_BIT_BLOCK, NULL, length);
 	kfree(data);
 	return res;
 }
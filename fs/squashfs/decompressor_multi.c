@@ -0,0 +1,184 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * decompressor_multi.c
+ */
+
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/cpumask.h>
+#include <linux/slab.h>
+#include <linux/buffer_head.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "squashfs_fs_i.h"
+#include "decompressor.h"
+#include "squashfs.h"
+#include "page_actor.h"
+
+/*
+ * This file implements multi-threaded decompression: a pool of decompressor
+ * streams per mounted filesystem.  The pool starts with one stream and
+ * grows when a reader finds all streams busy, up to two streams per online
+ * cpu.  Once it is at its limit readers wait for a stream to come back.
+ * Streams are only freed at umount.
+ */
+
+struct squashfs_stream_pool {
+	spinlock_t		lock;
+	struct list_head	idle;
+	int			streams;	/* allocated, idle or busy */
+	wait_queue_head_t	wait;
+};
+
+struct decomp_stream {
+	void			*stream;
+	void			*scratch;	/* output for pages not in the cache */
+	struct list_head	list;
+};
+
+int squashfs_max_decompressors(void)
+{
+	return num_online_cpus() * 2;
+}
+
+static struct decomp_stream *alloc_stream(struct squashfs_sb_info *msblk)
+{
+	struct decomp_stream *decomp;
+
+	decomp = kmalloc(sizeof(*decomp), GFP_KERNEL);
+	if (decomp == NULL)
+		return NULL;
+
+	decomp->scratch = kmalloc(PAGE_CACHE_SIZE, GFP_KERNEL);
+	if (decomp->scratch == NULL) {
+		kfree(decomp);
+		return NULL;
+	}
+
+	decomp->stream = msblk->decompressor->init(msblk);
+	if (decomp->stream == NULL) {
+		kfree(decomp->scratch);
+		kfree(decomp);
+		return NULL;
+	}
+	return decomp;
+}
+
+void *squashfs_decompressor_create(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream_pool *pool;
+	struct decomp_stream *decomp;
+
+	pool = kmalloc(sizeof(*pool), GFP_KERNEL);
+	if (pool == NULL)
+		return NULL;
+
+	/* The first stream is allocated now, so a reader can always wait */
+	decomp = alloc_stream(msblk);
+	if (decomp == NULL) {
+		kfree(pool);
+		return NULL;
+	}
+
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->idle);
+	list_add(&decomp->list, &pool->idle);
+	pool->streams = 1;
+	init_waitqueue_head(&pool->wait);
+	return pool;
+}
+
+void squashfs_decompressor_destroy(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream_pool *pool = msblk->stream;
+	struct decomp_stream *decomp, *next;
+
+	if (pool == NULL)
+		return;
+
+	list_for_each_entry_safe(decomp, next, &pool->idle, list) {
+		msblk->decompressor->free(decomp->stream);
+		kfree(decomp->scratch);
+		kfree(decomp);
+		pool->streams--;
+	}
+	WARN_ON(pool->streams);
+	kfree(pool);
+}
+
+static struct decomp_stream *get_stream(struct squashfs_sb_info *msblk,
+	struct squashfs_stream_pool *pool)
+{
+	struct decomp_stream *decomp;
+
+	while (1) {
+		spin_lock(&pool->lock);
+		if (!list_empty(&pool->idle)) {
+			decomp = list_entry(pool->idle.next,
+				struct decomp_stream, list);
+			list_del(&decomp->list);
+			spin_unlock(&pool->lock);
+			return decomp;
+		}
+
+		if (pool->streams < squashfs_max_decompressors()) {
+			pool->streams++;
+			spin_unlock(&pool->lock);
+
+			decomp = alloc_stream(msblk);
+			if (decomp)
+				return decomp;
+
+			/* Out of memory, make do with the streams we have */
+			spin_lock(&pool->lock);
+			pool->streams--;
+		}
+		spin_unlock(&pool->lock);
+
+		wait_event(pool->wait, !list_empty(&pool->idle));
+	}
+}
+
+static void put_stream(struct squashfs_stream_pool *pool,
+	struct decomp_stream *decomp)
+{
+	spin_lock(&pool->lock);
+	list_add(&decomp->list, &pool->idle);
+	spin_unlock(&pool->lock);
+	wake_up(&pool->wait);
+}
+
+int squashfs_decompress(struct squashfs_sb_info *msblk,
+	struct squashfs_page_actor *output, struct buffer_head **bh, int b,
+	int offset, int length, int srclength)
+{
+	struct squashfs_stream_pool *pool = msblk->stream;
+	struct decomp_stream *decomp = get_stream(msblk, pool);
+	int res;
+
+	output->scratch = decomp->scratch;
+	res = msblk->decompressor->decompress(msblk, decomp->stream, output,
+		bh, b, offset, length, srclength);
+	put_stream(pool, decomp);
+
+	return res;
+}
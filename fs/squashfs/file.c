@@ -52,6 +52,7 @@
 #include "squashfs_fs_sb.h"
 #include "squashfs_fs_i.h"
 #include "squashfs.h"
+#include "page_actor.h"
 
 /*
  * Locate cache slot in range [offset, index] for specified inode.  If
@@ -371,26 +372,115 @@ static int read_blocklist(struct inode *inode, int index, u64 *block)
 }
 
 
-static int squashfs_readpage(struct file *file, struct page *page)
+/*
+ * Decompress datablock <block> straight into the page cache pages of the
+ * block.  Slots of <page> without a page (not grabbed, already uptodate or
+ * beyond the end of the file) are decompressed into the decompressor
+ * stream's scratch page and thrown away.  Nothing is allocated here, so
+ * running short of memory cannot fail the read.
+ */
+static int squashfs_readpage_direct(struct inode *inode, u64 block, int bsize,
+	struct page **page, int pages)
 {
-	struct inode *inode = page->mapping->host;
 	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
-	int bytes, i, offset = 0, sparse = 0;
-	struct squashfs_cache_entry *buffer = NULL;
+	struct squashfs_page_actor actor;
+	int i, avail, res;
+
+	squashfs_page_actor_init(&actor, page, pages);
+	res = squashfs_read_data(inode->i_sb, &actor, block, bsize, NULL,
+		msblk->block_size);
+	if (res < 0) {
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
+		return res;
+	}
+
+	for (i = 0; i < pages; i++) {
+		if (page[i] == NULL)
+			continue;
+		avail = clamp_t(int, res - i * PAGE_CACHE_SIZE, 0,
+			PAGE_CACHE_SIZE);
+		if (avail < PAGE_CACHE_SIZE)
+			zero_user_segment(page[i], avail, PAGE_CACHE_SIZE);
+	}
+
+	return 0;
+}
+
+
+/*
+ * Copy the tail end of the file out of its fragment block.
+ */
+static int squashfs_readpage_fragment(struct inode *inode, struct page **page,
+	int pages)
+{
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	struct squashfs_cache_entry *buffer;
+	int i, avail, bytes, offset, res;
 	void *pageaddr;
 
-	int mask = (1 << (msblk->block_log - PAGE_CACHE_SHIFT)) - 1;
-	int index = page->index >> (msblk->block_log - PAGE_CACHE_SHIFT);
-	int start_index = page->index & ~mask;
-	int end_index = start_index | mask;
-	int file_end = i_size_read(inode) >> msblk->block_log;
+	buffer = squashfs_get_fragment(inode->i_sb,
+			squashfs_i(inode)->fragment_block,
+			squashfs_i(inode)->fragment_size);
+	res = buffer->error;
+	if (res) {
+		ERROR("Unable to read page, block %llx, size %x\n",
+			squashfs_i(inode)->fragment_block,
+			squashfs_i(inode)->fragment_size);
+		squashfs_cache_put(buffer);
+		return res;
+	}
 
-	TRACE("Entered squashfs_readpage, page index %lx, start block %llx\n",
-				page->index, squashfs_i(inode)->start);
+	bytes = i_size_read(inode) & (msblk->block_size - 1);
+	offset = squashfs_i(inode)->fragment_offset;
+	for (i = 0; i < pages; i++, bytes -= PAGE_CACHE_SIZE,
+			offset += PAGE_CACHE_SIZE) {
+		if (page[i] == NULL)
+			continue;
+
+		avail = clamp_t(int, bytes, 0, PAGE_CACHE_SIZE);
+		pageaddr = kmap_atomic(page[i], KM_USER0);
+		squashfs_copy_data(pageaddr, buffer, offset, avail);
+		memset(pageaddr + avail, 0, PAGE_CACHE_SIZE - avail);
+		kunmap_atomic(pageaddr, KM_USER0);
+	}
+
+	squashfs_cache_put(buffer);
+	return 0;
+}
 
-	if (page->index >= ((i_size_read(inode) + PAGE_CACHE_SIZE - 1) >>
-					PAGE_CACHE_SHIFT))
-		goto out;
+
+/*
+ * Read datablock <index> of the file into the page cache.  <page> has a
+ * slot for each page of the block; the caller fills in the locked pages it
+ * needs read (the page readpage was called for, or the pages readahead
+ * allocated), the others are grabbed here if that can be done without
+ * blocking, so that one decompression fills as much of the block as
+ * possible.  On return all pages are unlocked, and all except <keep> are
+ * released.  If the block can't be read <keep> is marked in error.
+ */
+static void squashfs_readpage_block(struct inode *inode, int index,
+	struct page **page, struct page *keep)
+{
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int pages = msblk->block_size >> PAGE_CACHE_SHIFT;
+	int start_index = index << (msblk->block_log - PAGE_CACHE_SHIFT);
+	int file_end = i_size_read(inode) >> msblk->block_log;
+	int file_pages = (i_size_read(inode) + PAGE_CACHE_SIZE - 1) >>
+		PAGE_CACHE_SHIFT;
+	int i, res;
+
+	for (i = 0; i < pages && start_index + i < file_pages; i++) {
+		if (page[i])
+			continue;
+		page[i] = grab_cache_page_nowait(inode->i_mapping,
+			start_index + i);
+		if (page[i] && PageUptodate(page[i])) {
+			unlock_page(page[i]);
+			page_cache_release(page[i]);
+			page[i] = NULL;
+		}
+	}
 
 	if (index < file_end || squashfs_i(inode)->fragment_block ==
 					SQUASHFS_INVALID_BLK) {
@@ -400,89 +490,74 @@ static int squashfs_readpage(struct file *file, struct page *page)
 		 */
 		u64 block = 0;
 		int bsize = read_blocklist(inode, index, &block);
-		if (bsize < 0)
-			goto error_out;
 
-		if (bsize == 0) { /* hole */
-			bytes = index == file_end ?
-				(i_size_read(inode) & (msblk->block_size - 1)) :
-				 msblk->block_size;
-			sparse = 1;
-		} else {
-			/*
-			 * Read and decompress datablock.
-			 */
-			buffer = squashfs_get_datablock(inode->i_sb,
-								block, bsize);
-			if (buffer->error) {
-				ERROR("Unable to read page, block %llx, size %x"
-					"\n", block, bsize);
-				squashfs_cache_put(buffer);
-				goto error_out;
-			}
-			bytes = buffer->length;
-		}
-	} else {
+		if (bsize < 0)
+			res = bsize;
+		else if (bsize == 0) { /* hole */
+			for (i = 0; i < pages; i++)
+				if (page[i])
+					zero_user(page[i], 0, PAGE_CACHE_SIZE);
+			res = 0;
+		} else
+			res = squashfs_readpage_direct(inode, block, bsize,
+				page, pages);
+	} else
 		/*
 		 * Datablock is stored inside a fragment (tail-end packed
 		 * block).
 		 */
-		buffer = squashfs_get_fragment(inode->i_sb,
-				squashfs_i(inode)->fragment_block,
-				squashfs_i(inode)->fragment_size);
-
-		if (buffer->error) {
-			ERROR("Unable to read page, block %llx, size %x\n",
-				squashfs_i(inode)->fragment_block,
-				squashfs_i(inode)->fragment_size);
-			squashfs_cache_put(buffer);
-			goto error_out;
+		res = squashfs_readpage_fragment(inode, page, pages);
+
+	for (i = 0; i < pages; i++) {
+		if (page[i] == NULL)
+			continue;
+
+		if (res == 0) {
+			flush_dcache_page(page[i]);
+			SetPageUptodate(page[i]);
+		} else if (page[i] == keep) {
+			zero_user(page[i], 0, PAGE_CACHE_SIZE);
+			SetPageError(page[i]);
 		}
-		bytes = i_size_read(inode) & (msblk->block_size - 1);
-		offset = squashfs_i(inode)->fragment_offset;
+		unlock_page(page[i]);
+		if (page[i] != keep)
+			page_cache_release(page[i]);
 	}
+}
 
-	/*
-	 * Loop copying datablock into pages.  As the datablock likely covers
-	 * many PAGE_CACHE_SIZE pages (default block size is 128 KiB) explicitly
-	 * grab the pages from the page cache, except for the page that we've
-	 * been called to fill.
-	 */
-	for (i = start_index; i <= end_index && bytes > 0; i++,
-			bytes -= PAGE_CACHE_SIZE, offset += PAGE_CACHE_SIZE) {
-		struct page *push_page;
-		int avail = sparse ? 0 : min_t(int, bytes, PAGE_CACHE_SIZE);
-
-		TRACE("bytes %d, i %d, available_bytes %d\n", bytes, i, avail);
 
-		push_page = (i == page->index) ? page :
-			grab_cache_page_nowait(page->mapping, i);
+static int squashfs_readpage(struct file *file, struct page *page)
+{
+	struct inode *inode = page->mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int shift = msblk->block_log - PAGE_CACHE_SHIFT;
+	struct page **block_page;
+	void *pageaddr;
 
-		if (!push_page)
-			continue;
+	TRACE("Entered squashfs_readpage, page index %lx, start block %llx\n",
+				page->index, squashfs_i(inode)->start);
 
-		if (PageUptodate(push_page))
-			goto skip_page;
+	if (page->index >= ((i_size_read(inode) + PAGE_CACHE_SIZE - 1) >>
+					PAGE_CACHE_SHIFT))
+		goto out;
 
-		pageaddr = kmap_atomic(push_page, KM_USER0);
-		squashfs_copy_data(pageaddr, buffer, offset, avail);
-		memset(pageaddr + avail, 0, PAGE_CACHE_SIZE - avail);
-		kunmap_atomic(pageaddr, KM_USER0);
-		flush_dcache_page(push_page);
-		SetPageUptodate(push_page);
-skip_page:
-		unlock_page(push_page);
-		if (i != page->index)
-			page_cache_release(push_page);
+	block_page = kcalloc(1 << shift, sizeof(*block_page), GFP_KERNEL);
+	if (block_page == NULL) {
+		/* Short of memory, use the array kept for this instead */
+		mutex_lock(&msblk->page_array_mutex);
+		block_page = msblk->page_array;
+		memset(block_page, 0, sizeof(*block_page) << shift);
 	}
 
-	if (!sparse)
-		squashfs_cache_put(buffer);
+	block_page[page->index & ((1 << shift) - 1)] = page;
+	squashfs_readpage_block(inode, page->index >> shift, block_page, page);
 
+	if (block_page == msblk->page_array)
+		mutex_unlock(&msblk->page_array_mutex);
+	else
+		kfree(block_page);
 	return 0;
 
-error_out:
-	SetPageError(page);
 out:
 	pageaddr = kmap_atomic(page, KM_USER0);
 	memset(pageaddr, 0, PAGE_CACHE_SIZE);
@@ -496,6 +571,57 @@ out:
 }
 
 
+#define list_to_page(head) (list_entry((head)->prev, struct page, lru))
+
+/*
+ * Readahead hands over its pages in ascending index order.  Put each run
+ * of pages from the same datablock into the page cache and read them with
+ * one decompression of the block.
+ */
+static int squashfs_readpages(struct file *file, struct address_space *mapping,
+	struct list_head *pages, unsigned nr_pages)
+{
+	struct inode *inode = mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int shift = msblk->block_log - PAGE_CACHE_SHIFT;
+	struct page **block_page, *page;
+	int index, added;
+
+	block_page = kmalloc(sizeof(*block_page) << shift, GFP_KERNEL);
+	if (block_page == NULL)
+		return -ENOMEM;
+
+	while (!list_empty(pages)) {
+		memset(block_page, 0, sizeof(*block_page) << shift);
+		index = list_to_page(pages)->index >> shift;
+		added = 0;
+
+		do {
+			page = list_to_page(pages);
+			if (page->index >> shift != index)
+				break;
+
+			list_del(&page->lru);
+			if (add_to_page_cache_lru(page, mapping, page->index,
+					GFP_KERNEL)) {
+				page_cache_release(page);
+				continue;
+			}
+			block_page[page->index & ((1 << shift) - 1)] = page;
+			added++;
+		} while (!list_empty(pages));
+
+		if (added)
+			squashfs_readpage_block(inode, index, block_page,
+				NULL);
+	}
+
+	kfree(block_page);
+	return 0;
+}
+
+
 const struct address_space_operations squashfs_aops = {
-	.readpage = squashfs_readpage
+	.readpage = squashfs_readpage,
+	.readpages = squashfs_readpages
 };
@@ -0,0 +1,161 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * lzma_wrapper.c
+ */
+
+#include <asm/unaligned.h>
+#include <linux/buffer_head.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/decompress/unlzma.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "squashfs_fs_i.h"
+#include "squashfs.h"
+#include "decompressor.h"
+#include "page_actor.h"
+
+/*
+ * Blocks are in the lzma "alone" format written by mksquashfs -comp lzma:
+ * a 13 byte header (properties, dictionary size and 64-bit uncompressed
+ * size) followed by the lzma stream.  unlzma() needs contiguous input and
+ * output, so as with lzo the block is gathered into input, decompressed
+ * into output and copied out to the pages from there.
+ *
+ * Each stream also keeps the probability table, which is sized for
+ * lc + lp <= 4.  mksquashfs writes lc=3 lp=0, and images with larger
+ * settings fail to read rather than allocate on every block.
+ */
+#define LZMA_HEADER_SIZE	13
+#define LZMA_MAX_LCLP		4
+
+struct squashfs_lzma {
+	void	*input;
+	void	*output;
+	void	*probs;
+};
+
+static void *lzma_init(struct squashfs_sb_info *msblk)
+{
+	int block_size = max_t(int, msblk->block_size, SQUASHFS_METADATA_SIZE);
+
+	struct squashfs_lzma *stream = kzalloc(sizeof(*stream), GFP_KERNEL);
+	if (stream == NULL)
+		goto failed;
+	stream->input = vmalloc(block_size);
+	if (stream->input == NULL)
+		goto failed;
+	stream->output = vmalloc(block_size);
+	if (stream->output == NULL)
+		goto failed2;
+	stream->probs = vmalloc(LZMA_PROBS_SIZE(LZMA_MAX_LCLP));
+	if (stream->probs == NULL)
+		goto failed3;
+
+	return stream;
+
+failed3:
+	vfree(stream->output);
+failed2:
+	vfree(stream->input);
+failed:
+	ERROR("Failed to allocate lzma workspace\n");
+	kfree(stream);
+	return NULL;
+}
+
+
+static void lzma_free(void *strm)
+{
+	struct squashfs_lzma *stream = strm;
+
+	if (stream) {
+		vfree(stream->input);
+		vfree(stream->output);
+		vfree(stream->probs);
+	}
+	kfree(stream);
+}
+
+
+static void lzma_error(char *m)
+{
+	ERROR("unlzma error: %s\n", m);
+}
+
+
+static int lzma_uncompress(struct squashfs_sb_info *msblk, void *strm,
+	struct squashfs_page_actor *output, struct buffer_head **bh, int b,
+	int offset, int length, int srclength)
+{
+	struct squashfs_lzma *stream = strm;
+	void *buff = stream->input, *pageaddr;
+	int avail, i, bytes = length, res, pos = 0;
+	u64 out_len;
+
+	for (i = 0; i < b; i++) {
+		avail = min(bytes, msblk->devblksize - offset);
+		memcpy(buff, bh[i]->b_data + offset, avail);
+		buff += avail;
+		bytes -= avail;
+		offset = 0;
+		put_bh(bh[i]);
+	}
+
+	/*
+	 * unlzma() trusts the uncompressed size in the header and writes
+	 * that much, so check it fits before letting it loose on output.
+	 */
+	if (length < LZMA_HEADER_SIZE)
+		goto failed;
+	out_len = get_unaligned_le64(stream->input + 5);
+	if (out_len > srclength)
+		goto failed;
+
+	res = unlzma_probs(stream->input, length, stream->output, &pos,
+		lzma_error, stream->probs, LZMA_PROBS_SIZE(LZMA_MAX_LCLP));
+	if (res || pos > length)
+		goto failed;
+
+	res = bytes = (int)out_len;
+	pageaddr = squashfs_first_page(output);
+	for (buff = stream->output; bytes && pageaddr;
+			pageaddr = squashfs_next_page(output)) {
+		avail = min_t(int, bytes, PAGE_CACHE_SIZE);
+		memcpy(pageaddr, buff, avail);
+		buff += avail;
+		bytes -= avail;
+	}
+	squashfs_finish_page(output);
+
+	return res;
+
+failed:
+	ERROR("lzma decompression failed, data probably corrupt\n");
+	return -EIO;
+}
+
+const struct squashfs_decompressor squashfs_lzma_comp_ops = {
+	.init = lzma_init,
+	.free = lzma_free,
+	.decompress = lzma_uncompress,
+	.id = LZMA_COMPRESSION,
+	.name = "lzma",
+	.supported = 1
+};
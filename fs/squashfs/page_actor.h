@@ -0,0 +1,95 @@
+#ifndef PAGE_ACTOR_H
+#define PAGE_ACTOR_H
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * page_actor.h
+ */
+
+#include <linux/highmem.h>
+
+/*
+ * Where squashfs_read_data() puts a block, one page sized piece at a time.
+ *
+ * Cache entries and tables are already mapped and are handed over as an
+ * array of buffers.  Datablocks read straight into the page cache are
+ * handed over as their pages, and each page is mapped with kmap_atomic()
+ * only while it is being filled, so nothing may sleep between
+ * squashfs_first_page() and squashfs_finish_page().  Pages missing from
+ * the page cache (NULL) are filled through scratch, a page the decompressor
+ * stream owns, and thrown away.
+ */
+struct squashfs_page_actor {
+	void		**buffer;
+	struct page	**page;
+	void		*scratch;
+	void		*pageaddr;
+	int		pages;
+	int		next_page;
+};
+
+static inline void squashfs_buffer_actor_init(
+	struct squashfs_page_actor *actor, void **buffer, int pages)
+{
+	actor->buffer = buffer;
+	actor->page = NULL;
+	actor->scratch = NULL;
+	actor->pageaddr = NULL;
+	actor->pages = pages;
+	actor->next_page = 0;
+}
+
+static inline void squashfs_page_actor_init(
+	struct squashfs_page_actor *actor, struct page **page, int pages)
+{
+	squashfs_buffer_actor_init(actor, NULL, pages);
+	actor->page = page;
+}
+
+static inline void squashfs_finish_page(struct squashfs_page_actor *actor)
+{
+	if (actor->pageaddr) {
+		kunmap_atomic(actor->pageaddr, KM_USER0);
+		actor->pageaddr = NULL;
+	}
+}
+
+/* Returns NULL once all the pages have been handed out */
+static inline void *squashfs_next_page(struct squashfs_page_actor *actor)
+{
+	struct page *page;
+
+	squashfs_finish_page(actor);
+	if (actor->next_page == actor->pages)
+		return NULL;
+	if (actor->buffer)
+		return actor->buffer[actor->next_page++];
+
+	page = actor->page[actor->next_page++];
+	if (page == NULL)
+		return actor->scratch;
+	actor->pageaddr = kmap_atomic(page, KM_USER0);
+	return actor->pageaddr;
+}
+
+static inline void *squashfs_first_page(struct squashfs_page_actor *actor)
+{
+	squashfs_finish_page(actor);
+	actor->next_page = 0;
+	return squashfs_next_page(actor);
+}
+#endif
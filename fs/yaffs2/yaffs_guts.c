@@ -83,6 +83,8 @@ static int yaffs_TagsMatch(const yaffs_ExtendedTags *tags, int objectId,
 static int yaffs_AllocateChunk(yaffs_Device *dev, int useReserve,
 				yaffs_BlockInfo **blockUsedPtr);
 
+static void yaffs_GCIndexUpdate(yaffs_Device *dev, int blockNo);
+
 static void yaffs_CheckObjectDetailsLoaded(yaffs_Object *in);
 
 static void yaffs_InvalidateWholeChunkCache(yaffs_Object *in);
@@ -177,6 +179,24 @@ static __u32 Shifts(__u32 x)
 
 
 
+/*
+ * Read side locking.
+ * The OS may let several readers into yaffs at once. Whatever those
+ * readers still modify is done between these.
+ */
+
+static void yaffs_ReadLock(yaffs_Device *dev)
+{
+	if (dev->param.readLock)
+		dev->param.readLock(dev);
+}
+
+static void yaffs_ReadUnlock(yaffs_Device *dev)
+{
+	if (dev->param.readUnlock)
+		dev->param.readUnlock(dev);
+}
+
 /*
  * Temporary buffer manipulations.
  */
@@ -984,6 +1004,9 @@ static int yaffs_DeleteWorker(yaffs_Object *in, yaffs_Tnode *tn, __u32 level,
 								in->objectId,
 								chunkInInode);
 
+					/* Unhook the chunk before deleting it */
+					yaffs_LoadLevel0Tnode(dev, tn, i, 0);
+
 					if (foundChunk > 0) {
 						yaffs_DeleteChunk(dev,
 								  foundChunk, 1,
@@ -996,8 +1019,6 @@ static int yaffs_DeleteWorker(yaffs_Object *in, yaffs_Tnode *tn, __u32 level,
 						}
 
 					}
-
-					yaffs_LoadLevel0Tnode(dev, tn, i, 0);
 				}
 
 			}
@@ -1026,6 +1047,7 @@ static void yaffs_SoftDeleteChunk(yaffs_Device *dev, int chunk)
 		theBlock->softDeletions++;
 		dev->nFreeChunks++;
 		yaffs2_UpdateOldestDirtySequence(dev, blockNo, theBlock);
+		yaffs_GCIndexUpdate(dev, blockNo);
 	}
 }
 
@@ -1822,6 +1844,7 @@ static int yaffs_InitialiseBlocks(yaffs_Device *dev)
 
 	dev->blockInfo = NULL;
 	dev->chunkBits = NULL;
+	dev->gcIndex = NULL;
 
 	dev->allocationBlock = -1;	/* force it to get a new one */
 
@@ -1845,8 +1868,18 @@ static int yaffs_InitialiseBlocks(yaffs_Device *dev)
 	}
 
 	if (dev->blockInfo && dev->chunkBits) {
+		dev->gcIndex = YMALLOC(nBlocks * sizeof(*dev->gcIndex));
+		if (!dev->gcIndex) {
+			dev->gcIndex = YMALLOC_ALT(nBlocks * sizeof(*dev->gcIndex));
+			dev->gcIndexAlt = 1;
+		} else
+			dev->gcIndexAlt = 0;
+	}
+
+	if (dev->blockInfo && dev->chunkBits && dev->gcIndex) {
 		memset(dev->blockInfo, 0, nBlocks * sizeof(yaffs_BlockInfo));
 		memset(dev->chunkBits, 0, dev->chunkBitmapStride * nBlocks);
+		dev->gcIndexStale = 1;
 		return YAFFS_OK;
 	}
 
@@ -1870,6 +1903,106 @@ static void yaffs_DeinitialiseBlocks(yaffs_Device *dev)
 		YFREE(dev->chunkBits);
 	dev->chunkBitsAlt = 0;
 	dev->chunkBits = NULL;
+
+	if (dev->gcIndexAlt && dev->gcIndex)
+		YFREE_ALT(dev->gcIndex);
+	else if (dev->gcIndex)
+		YFREE(dev->gcIndex);
+	dev->gcIndexAlt = 0;
+	dev->gcIndex = NULL;
+}
+
+/*
+ * Garbage collection candidate index.
+ * Full blocks are kept in YAFFS_GC_BUCKETS lists by how many of their
+ * chunks are still in use, bucket 0 being the dirtiest. Callers update a
+ * block whenever it fills up, loses chunks or stops being full. The block
+ * info is still checked when the index is walked, so a bucket that is a
+ * little out of date only costs a look at the wrong block.
+ */
+
+static int yaffs_GCBucket(yaffs_Device *dev, yaffs_BlockInfo *bi)
+{
+	int pagesUsed = bi->pagesInUse - bi->softDeletions;
+
+	if (pagesUsed < 0)
+		pagesUsed = 0;
+	if (pagesUsed > dev->param.nChunksPerBlock)
+		pagesUsed = dev->param.nChunksPerBlock;
+
+	return pagesUsed * YAFFS_GC_BUCKETS / (dev->param.nChunksPerBlock + 1);
+}
+
+static void yaffs_GCIndexRemove(yaffs_Device *dev, int blockNo)
+{
+	int i = blockNo - dev->internalStartBlock;
+	int next = dev->gcIndex[i].next;
+	int prev = dev->gcIndex[i].prev;
+
+	if (dev->gcIndex[i].bucket < 0)
+		return;
+
+	if (prev >= 0)
+		dev->gcIndex[prev - dev->internalStartBlock].next = next;
+	else
+		dev->gcIndexHead[dev->gcIndex[i].bucket] = next;
+	if (next >= 0)
+		dev->gcIndex[next - dev->internalStartBlock].prev = prev;
+
+	dev->gcIndex[i].bucket = -1;
+}
+
+static void yaffs_GCIndexInsert(yaffs_Device *dev, int blockNo, int bucket)
+{
+	int i = blockNo - dev->internalStartBlock;
+	int head = dev->gcIndexHead[bucket];
+
+	dev->gcIndex[i].bucket = bucket;
+	dev->gcIndex[i].prev = -1;
+	dev->gcIndex[i].next = head;
+	if (head >= 0)
+		dev->gcIndex[head - dev->internalStartBlock].prev = blockNo;
+	dev->gcIndexHead[bucket] = blockNo;
+}
+
+static void yaffs_GCIndexUpdate(yaffs_Device *dev, int blockNo)
+{
+	yaffs_BlockInfo *bi;
+	int bucket;
+
+	if (!dev->gcIndex || dev->gcIndexStale)
+		return;
+
+	bi = yaffs_GetBlockInfo(dev, blockNo);
+	if (bi->blockState != YAFFS_BLOCK_STATE_FULL) {
+		yaffs_GCIndexRemove(dev, blockNo);
+		return;
+	}
+
+	bucket = yaffs_GCBucket(dev, bi);
+	if (bucket != dev->gcIndex[blockNo - dev->internalStartBlock].bucket) {
+		yaffs_GCIndexRemove(dev, blockNo);
+		yaffs_GCIndexInsert(dev, blockNo, bucket);
+	}
+}
+
+/*
+ * Scanning and checkpoint restore set up the block info wholesale, so the
+ * index starts out stale and is built on the first walk after mounting.
+ */
+static void yaffs_GCIndexRebuild(yaffs_Device *dev)
+{
+	int i;
+
+	for (i = 0; i < YAFFS_GC_BUCKETS; i++)
+		dev->gcIndexHead[i] = -1;
+	for (i = dev->internalStartBlock; i <= dev->internalEndBlock; i++)
+		dev->gcIndex[i - dev->internalStartBlock].bucket = -1;
+
+	dev->gcIndexStale = 0;
+
+	for (i = dev->internalStartBlock; i <= dev->internalEndBlock; i++)
+		yaffs_GCIndexUpdate(dev, i);
 }
 
 void yaffs_BlockBecameDirty(yaffs_Device *dev, int blockNo)
@@ -1945,6 +2078,8 @@ void yaffs_BlockBecameDirty(yaffs_Device *dev, int blockNo)
 		T(YAFFS_TRACE_ERROR | YAFFS_TRACE_BAD_BLOCKS,
 		  (TSTR("**>> Block %d retired" TENDSTR), blockNo));
 	}
+
+	yaffs_GCIndexUpdate(dev, blockNo);
 }
 
 static int yaffs_FindBlockForAllocation(yaffs_Device *dev)
@@ -2052,6 +2187,7 @@ static int yaffs_AllocateChunk(yaffs_Device *dev, int useReserve,
 		/* If the block is full set the state to full */
 		if (dev->allocationPage >= dev->param.nChunksPerBlock) {
 			bi->blockState = YAFFS_BLOCK_STATE_FULL;
+			yaffs_GCIndexUpdate(dev, dev->allocationBlock);
 			dev->allocationBlock = -1;
 		}
 
@@ -2090,6 +2226,7 @@ void yaffs_SkipRestOfBlock(yaffs_Device *dev)
 		yaffs_BlockInfo *bi = yaffs_GetBlockInfo(dev, dev->allocationBlock);
 		if(bi->blockState == YAFFS_BLOCK_STATE_ALLOCATING){
 			bi->blockState = YAFFS_BLOCK_STATE_FULL;
+			yaffs_GCIndexUpdate(dev, dev->allocationBlock);
 			dev->allocationBlock = -1;
 		}
 	}
@@ -2327,6 +2464,7 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 		 * because checkpointing does not restore gc.
 		 */
 		bi->blockState = YAFFS_BLOCK_STATE_FULL;
+		yaffs_GCIndexUpdate(dev, block);
 	} else {
 		/* The gc completed. */
 		/* Do any required cleanups */
@@ -2368,6 +2506,84 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 	return retVal;
 }
 
+/*
+ * Cost-benefit of collecting a block: the space it frees up, weighted by
+ * how long its data has been left alone, against the cost of reading and
+ * rewriting the chunks still in use. Old data is unlikely to be rewritten
+ * soon, so a slightly less dirty but old block is often the better buy
+ * than a dirtier block whose remaining chunks are about to be deleted
+ * anyway.
+ */
+static __u32 yaffs_GCBenefit(yaffs_Device *dev, yaffs_BlockInfo *bi,
+				int pagesUsed)
+{
+	__u32 age = 0;
+
+	if (dev->param.isYaffs2 && dev->sequenceNumber > bi->sequenceNumber)
+		age = dev->sequenceNumber - bi->sequenceNumber;
+	if (age > 0xffff)
+		age = 0xffff;
+
+	return ((dev->param.nChunksPerBlock - pagesUsed) * (age + 1) << 4) /
+		(dev->param.nChunksPerBlock + pagesUsed);
+}
+
+/*
+ * Pick the full block with the best cost-benefit among those with at most
+ * maxPagesUsed chunks in use, looking at no more than maxScan blocks.
+ * Walks the index from the dirtiest bucket and stops one bucket past the
+ * first candidate, so age only trades against a little extra copying.
+ * Sets gcDirtiest and gcPagesInUse to the block found.
+ */
+static void yaffs_GCIndexSelect(yaffs_Device *dev, int maxPagesUsed,
+				int maxScan)
+{
+	int nChunks = dev->param.nChunksPerBlock;
+	int lastBucket = YAFFS_GC_BUCKETS - 1;
+	yaffs_BlockInfo *bi;
+	__u32 bestBenefit = 0;
+	__u32 benefit;
+	int pagesUsed;
+	int bucket;
+	int blk;
+
+	if (dev->gcIndexStale)
+		yaffs_GCIndexRebuild(dev);
+
+	dev->gcDirtiest = 0;
+	dev->gcPagesInUse = 0;
+
+	for (bucket = 0; bucket <= lastBucket && maxScan > 0; bucket++) {
+		/* Smallest pagesUsed that lands in this bucket */
+		if ((bucket * (nChunks + 1) + YAFFS_GC_BUCKETS - 1) /
+			YAFFS_GC_BUCKETS > maxPagesUsed)
+			break;
+
+		for (blk = dev->gcIndexHead[bucket];
+			blk >= 0 && maxScan > 0;
+			blk = dev->gcIndex[blk - dev->internalStartBlock].next) {
+			maxScan--;
+			bi = yaffs_GetBlockInfo(dev, blk);
+			pagesUsed = bi->pagesInUse - bi->softDeletions;
+
+			if (bi->blockState != YAFFS_BLOCK_STATE_FULL ||
+				pagesUsed >= nChunks ||
+				pagesUsed > maxPagesUsed ||
+				!yaffs2_BlockNotDisqualifiedFromGC(dev, bi))
+				continue;
+
+			benefit = yaffs_GCBenefit(dev, bi, pagesUsed);
+			if (dev->gcDirtiest < 1 || benefit > bestBenefit) {
+				dev->gcDirtiest = blk;
+				dev->gcPagesInUse = pagesUsed;
+				bestBenefit = benefit;
+				if (lastBucket > bucket + 1)
+					lastBucket = bucket + 1;
+			}
+		}
+	}
+}
+
 /*
  * FindBlockForgarbageCollection is used to select the dirtiest block (or close enough)
  * for garbage collection.
@@ -2419,16 +2635,16 @@ static unsigned yaffs_FindBlockForGarbageCollection(yaffs_Device *dev,
 			dev->hasPendingPrioritisedGCs = 0;
 	}
 
-	/* If we're doing aggressive GC then we are happy to take a less-dirty block, and
+	/* If we're doing aggressive GC, or the background thread is short of
+	 * erased blocks, then we are happy to take a less-dirty block, and
 	 * search harder.
 	 * else (we're doing a leasurely gc), then we only bother to do this if the
 	 * block has only a few pages in use.
 	 */
 
 	if (!selected){
-		int pagesUsed;
 		int nBlocks = dev->internalEndBlock - dev->internalStartBlock + 1;
-		if (aggressive){
+		if (aggressive || background > 1){
 			threshold = dev->param.nChunksPerBlock;
 			iterations = nBlocks;
 		} else {
@@ -2454,28 +2670,7 @@ static unsigned yaffs_FindBlockForGarbageCollection(yaffs_Device *dev,
 				iterations = 100;
 		}
 
-		for (i = 0;
-			i < iterations &&
-			(dev->gcDirtiest < 1 ||
-				dev->gcPagesInUse > YAFFS_GC_GOOD_ENOUGH);
-			i++) {
-			dev->gcBlockFinder++;
-			if (dev->gcBlockFinder < dev->internalStartBlock ||
-				dev->gcBlockFinder > dev->internalEndBlock)
-				dev->gcBlockFinder = dev->internalStartBlock;
-
-			bi = yaffs_GetBlockInfo(dev, dev->gcBlockFinder);
-
-			pagesUsed = bi->pagesInUse - bi->softDeletions;
-
-			if (bi->blockState == YAFFS_BLOCK_STATE_FULL &&
-				pagesUsed < dev->param.nChunksPerBlock &&
-				(dev->gcDirtiest < 1 || pagesUsed < dev->gcPagesInUse) &&
-				yaffs2_BlockNotDisqualifiedFromGC(dev, bi)) {
-				dev->gcDirtiest = dev->gcBlockFinder;
-				dev->gcPagesInUse = pagesUsed;
-			}
-		}
+		yaffs_GCIndexSelect(dev, threshold, iterations);
 
 		if(dev->gcDirtiest > 0 && dev->gcPagesInUse <= threshold)
 			selected = dev->gcDirtiest;
@@ -2518,8 +2713,8 @@ static unsigned yaffs_FindBlockForGarbageCollection(yaffs_Device *dev,
 	} else{
 		dev->gcNotDone++;
 		T(YAFFS_TRACE_GC,
-		  (TSTR("GC none: finder %d skip %d threshold %d dirtiest %d using %d oldest %d%s" TENDSTR),
-		  dev->gcBlockFinder, dev->gcNotDone,
+		  (TSTR("GC none: skip %d threshold %d dirtiest %d using %d oldest %d%s" TENDSTR),
+		  dev->gcNotDone,
 		  threshold,
 		  dev->gcDirtiest, dev->gcPagesInUse,
 		  dev->oldestDirtyBlock,
@@ -2546,9 +2741,14 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev, int background)
 	int minErased;
 	int erasedChunks;
 	int checkpointBlockAdjust;
+	unsigned control = YAFFS_GC_CONTROL_ENABLE;
+	__u64 start;
+	__u64 elapsed;
+
+	if(dev->param.gcControl)
+		control = dev->param.gcControl(dev);
 
-	if(dev->param.gcControl &&
-		(dev->param.gcControl(dev) & 1) == 0)
+	if((control & YAFFS_GC_CONTROL_ENABLE) == 0)
 		return YAFFS_OK;
 
 	if (dev->gcDisable) {
@@ -2575,6 +2775,10 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev, int background)
 			if(!background && erasedChunks > (dev->nFreeChunks / 4))
 				break;
 
+			/* The background thread is keeping up, don't stall the writer */
+			if(!background && (control & YAFFS_GC_CONTROL_DEFER))
+				break;
+
 			if(dev->gcSkip > 20)
 				dev->gcSkip = 20;
 			if(erasedChunks < dev->nFreeChunks/2 ||
@@ -2612,7 +2816,21 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev, int background)
 			   ("yaffs: GC erasedBlocks %d aggressive %d" TENDSTR),
 			   dev->nErasedBlocks, aggressive));
 
-			gcOk = yaffs_GarbageCollectBlock(dev, dev->gcBlock, aggressive);
+			/* Background gc below the low water mark collects the
+			 * whole block rather than a few chunks per call.
+			 */
+			start = Y_TIME_NS();
+			gcOk = yaffs_GarbageCollectBlock(dev, dev->gcBlock,
+					aggressive || background > 1);
+			elapsed = Y_TIME_NS() - start;
+
+			if (background)
+				dev->backgroundGCTime += elapsed;
+			else {
+				dev->gcTime += elapsed;
+				if (elapsed > dev->maxGCStall)
+					dev->maxGCStall = elapsed;
+			}
 		}
 
 		if (dev->nErasedBlocks < (dev->param.nReservedBlocks) && dev->gcBlock > 0) {
@@ -2639,7 +2857,7 @@ int yaffs_BackgroundGarbageCollect(yaffs_Device *dev, unsigned urgency)
 
 	T(YAFFS_TRACE_BACKGROUND, (TSTR("Background gc %u" TENDSTR),urgency));
 
-	yaffs_CheckGarbageCollection(dev, 1);
+	yaffs_CheckGarbageCollection(dev, urgency > 1 ? 2 : 1);
 	return erasedChunks > dev->nFreeChunks/2;
 }
 
@@ -2918,6 +3136,7 @@ void yaffs_DeleteChunk(yaffs_Device *dev, int chunkId, int markNAND, int lyn)
 		yaffs_ClearChunkBit(dev, block, page);
 
 		bi->pagesInUse--;
+		yaffs_GCIndexUpdate(dev, block);
 
 		if (bi->pagesInUse == 0 &&
 		    !bi->hasShrinkHeader &&
@@ -3463,6 +3682,8 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 		else
 			nToCopy = dev->nDataBytesPerChunk - start;
 
+		yaffs_ReadLock(dev);
+
 		cache = yaffs_FindChunkCache(in, chunk);
 
 		/* If the chunk is already in the cache or it is less than a whole chunk
@@ -3516,6 +3737,8 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 
 		}
 
+		yaffs_ReadUnlock(dev);
+
 		n -= nToCopy;
 		offset += nToCopy;
 		buffer += nToCopy;
@@ -3526,6 +3749,84 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 	return nDone;
 }
 
+/*
+ * Reading whole chunks of file data without holding yaffs across the NAND
+ * read, for OS flavours that let readers in while a writer waits on the
+ * NAND (see nandIOStart).
+ *
+ * yaffs_FindDataChunk() is called with yaffs locked, at least shared, for
+ * the chunk at offset.  It fills buffer from the cache or with zeroes for
+ * a hole and returns 0, or returns the chunk to read and, in eraseCount,
+ * how many blocks had been erased by then.  The caller then reads it with
+ * yaffs_ReadDataChunk() unlocked, locks again and asks
+ * yaffs_DataChunkStillValid().  A live chunk stays where it is until its
+ * block is erased, so the data is good unless a block was erased in
+ * between; then gc may have moved the chunk and the lookup must be redone.
+ */
+int yaffs_FindDataChunk(yaffs_Object *in, loff_t offset, __u8 *buffer,
+			__u32 *eraseCount)
+{
+	yaffs_Device *dev = in->myDev;
+	yaffs_ChunkCache *cache;
+	int chunk;
+	int chunkInNAND;
+	__u32 start;
+
+	yaffs_AddrToChunk(dev, offset, &chunk, &start);
+	chunk++;
+
+	yaffs_ReadLock(dev);
+
+	cache = yaffs_FindChunkCache(in, chunk);
+	if (cache) {
+		yaffs_UseChunkCache(dev, cache, 0);
+		memcpy(buffer, cache->data, dev->nDataBytesPerChunk);
+		chunkInNAND = 0;
+	} else {
+		chunkInNAND = yaffs_FindChunkInFile(in, chunk, NULL);
+		if (chunkInNAND < 0) {
+			memset(buffer, 0, dev->nDataBytesPerChunk);
+			chunkInNAND = 0;
+		}
+	}
+	*eraseCount = dev->nBlockErasures;
+
+	yaffs_ReadUnlock(dev);
+
+	return chunkInNAND;
+}
+
+/*
+ * Runs unlocked.  The only device state it changes is the driver's ECC
+ * statistics (eccFixed/eccUnfixed in mtdif2), which may miss a count when
+ * this races with another read that hits an ECC error.  The error itself
+ * comes back in tags and is handled by yaffs_DataChunkStillValid().
+ */
+int yaffs_ReadDataChunk(yaffs_Device *dev, int chunkInNAND, __u8 *buffer,
+			yaffs_ExtendedTags *tags)
+{
+	return dev->param.readChunkWithTagsFromNAND(dev,
+				chunkInNAND - dev->chunkOffset, buffer, tags);
+}
+
+int yaffs_DataChunkStillValid(yaffs_Device *dev, int chunkInNAND,
+			      const yaffs_ExtendedTags *tags, __u32 eraseCount)
+{
+	int valid;
+
+	yaffs_ReadLock(dev);
+
+	dev->nPageReads++;
+	valid = (dev->nBlockErasures == eraseCount);
+	if (valid && tags->eccResult > YAFFS_ECC_RESULT_NO_ERROR)
+		yaffs_HandleChunkError(dev, yaffs_GetBlockInfo(dev,
+				chunkInNAND / dev->param.nChunksPerBlock));
+
+	yaffs_ReadUnlock(dev);
+
+	return valid;
+}
+
 int yaffs_DoWriteDataToFile(yaffs_Object *in, const __u8 *buffer, loff_t offset,
 			int nBytes, int writeThrough)
 {
@@ -3876,6 +4177,7 @@ int yaffs_FlushFile(yaffs_Object *in, int updateTime, int dataSync)
 
 static int yaffs_DoGenericObjectDeletion(yaffs_Object *in)
 {
+	int hdrChunk;
 
 	/* First off, invalidate the file's data in the cache, without flushing. */
 	yaffs_InvalidateWholeChunkCache(in);
@@ -3887,8 +4189,9 @@ static int yaffs_DoGenericObjectDeletion(yaffs_Object *in)
 	}
 
 	yaffs_RemoveObjectFromDirectory(in);
-	yaffs_DeleteChunk(in->myDev, in->hdrChunk, 1, __LINE__);
+	hdrChunk = in->hdrChunk;
 	in->hdrChunk = 0;
+	yaffs_DeleteChunk(in->myDev, hdrChunk, 1, __LINE__);
 
 	yaffs_FreeObject(in);
 	return YAFFS_OK;
@@ -4362,8 +4665,15 @@ static void yaffs_CheckObjectDetailsLoaded(yaffs_Object *in)
 		in->lazyLoaded ? "not yet" : "already"));
 #endif
 
+	if (!in->lazyLoaded || in->hdrChunk <= 0) {
+		/* Pairs with the barrier before lazyLoaded is cleared below */
+		Y_RMB();
+		return;
+	}
+
+	yaffs_ReadLock(dev);
+
 	if (in->lazyLoaded && in->hdrChunk > 0) {
-		in->lazyLoaded = 0;
 		chunkData = yaffs_GetTempBuffer(dev, __LINE__);
 
 		result = yaffs_ReadChunkWithTagsFromNAND(dev, in->hdrChunk, chunkData, &tags);
@@ -4396,7 +4706,13 @@ static void yaffs_CheckObjectDetailsLoaded(yaffs_Object *in)
 		}
 
 		yaffs_ReleaseTempBuffer(dev, chunkData, __LINE__);
+
+		/* Readers test lazyLoaded without the read lock */
+		Y_WMB();
+		in->lazyLoaded = 0;
 	}
+
+	yaffs_ReadUnlock(dev);
 }
 
 /*------------------------------  Directory Functions ----------------------------- */
@@ -4757,9 +5073,13 @@ int yaffs_GetObjectName(yaffs_Object * obj, YCHAR * name, int buffSize)
 #endif
 	else if(obj->hdrChunk > 0) {
 		int result;
-		__u8 *buffer = yaffs_GetTempBuffer(obj->myDev, __LINE__);
+		__u8 *buffer;
+		yaffs_ObjectHeader *oh;
+
+		yaffs_ReadLock(obj->myDev);
 
-		yaffs_ObjectHeader *oh = (yaffs_ObjectHeader *) buffer;
+		buffer = yaffs_GetTempBuffer(obj->myDev, __LINE__);
+		oh = (yaffs_ObjectHeader *) buffer;
 
 		memset(buffer, 0, obj->myDev->nDataBytesPerChunk);
 
@@ -4771,6 +5091,8 @@ int yaffs_GetObjectName(yaffs_Object * obj, YCHAR * name, int buffSize)
 		yaffs_LoadNameFromObjectHeader(obj->myDev,name,oh->name,buffSize);
 
 		yaffs_ReleaseTempBuffer(obj->myDev, buffer, __LINE__);
+
+		yaffs_ReadUnlock(obj->myDev);
 	}
 
 	yaffs_FixNullName(obj,name,buffSize);
@@ -5270,7 +5592,9 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	dev->passiveGCs = 0;
 	dev->oldestDirtyGCs = 0;
 	dev->backgroundGCs = 0;
-	dev->gcBlockFinder = 0;
+	dev->gcTime = 0;
+	dev->backgroundGCTime = 0;
+	dev->maxGCStall = 0;
 	dev->bufferedBlock = -1;
 	dev->doingBufferedBlockRewrite = 0;
 	dev->nDeletedFiles = 0;
@@ -92,6 +92,15 @@
 
 #define YAFFS_N_TEMP_BUFFERS		6
 
+/* Number of buckets garbage collection candidates are sorted into by
+ * how many of their chunks are still in use.
+ */
+#define YAFFS_GC_BUCKETS		16
+
+/* Bits returned by the gcControl() callback */
+#define YAFFS_GC_CONTROL_ENABLE		1	/* Garbage collection allowed */
+#define YAFFS_GC_CONTROL_DEFER		2	/* Leave passive gc to the background */
+
 /* We limit the number attempts at sucessfully saving a chunk of data.
  * Small-page devices have 32 pages per block; large-page devices have 64.
  * Default to something in the order of 5 to 10 blocks worth of chunks.
@@ -587,9 +596,21 @@ struct yaffs_DeviceParamStruct {
 	/* Callback to mark the superblock dirty */
 	void (*markSuperBlockDirty)(struct yaffs_DeviceStruct *dev);
 	
-	/*  Callback to control garbage collection. */
+	/*  Callback to control garbage collection, returns YAFFS_GC_CONTROL_ bits */
 	unsigned (*gcControl)(struct yaffs_DeviceStruct *dev);
 
+	/* Optional callbacks for OS flavours that let readers into yaffs
+	 * concurrently. readLock/readUnlock serialise the state that reads
+	 * still modify: lazy loading of objects, the short op cache, the
+	 * temp buffers and the NAND read path. nandIOStart/nandIODone
+	 * bracket every program and erase, so that the OS can let readers
+	 * in while the NAND is busy.
+	 */
+	void (*readLock)(struct yaffs_DeviceStruct *dev);
+	void (*readUnlock)(struct yaffs_DeviceStruct *dev);
+	void (*nandIOStart)(struct yaffs_DeviceStruct *dev);
+	void (*nandIODone)(struct yaffs_DeviceStruct *dev);
+
         /* Debug control flags. Don't use unless you know what you're doing */
 	int useHeaderFileSize;	/* Flag to determine if we should use file sizes from the header */
 	int disableLazyLoad;	/* Disable lazy loading on this device */
@@ -698,7 +719,6 @@ struct yaffs_DeviceStruct {
 
 	unsigned hasPendingPrioritisedGCs; /* We think this device might have pending prioritised gcs */
 	unsigned gcDisable;
-	unsigned gcBlockFinder;
 	unsigned gcDirtiest;
 	unsigned gcPagesInUse;
 	unsigned gcNotDone;
@@ -706,6 +726,19 @@ struct yaffs_DeviceStruct {
 	unsigned gcChunk;
 	unsigned gcSkip;
 
+	/* Garbage collection candidates: full blocks in doubly linked lists,
+	 * one per bucket of chunks in use, indexed by block number less
+	 * internalStartBlock. Lists are terminated by -1.
+	 */
+	struct {
+		int next;
+		int prev;
+		int bucket;	/* -1 if not indexed */
+	} *gcIndex;
+	int gcIndexHead[YAFFS_GC_BUCKETS];
+	unsigned gcIndexAlt:1;	/* was allocated using alternative strategy */
+	unsigned gcIndexStale:1; /* must be rebuilt from the block info */
+
 	/* Special directories */
 	yaffs_Object *rootDir;
 	yaffs_Object *lostNFoundDir;
@@ -769,6 +802,9 @@ struct yaffs_DeviceStruct {
 	__u32 nUnmarkedDeletions;
 	__u32 refreshCount;
 	__u32 cacheHits;
+	__u64 gcTime;		/* ns spent collecting in line with writes */
+	__u64 backgroundGCTime;	/* ns spent collecting in the background */
+	__u64 maxGCStall;	/* longest single collection in line with writes */
 
 };
 
@@ -855,6 +891,12 @@ int yaffs_GetAttributes(yaffs_Object *obj, struct iattr *attr);
 /* File operations */
 int yaffs_ReadDataFromFile(yaffs_Object *obj, __u8 *buffer, loff_t offset,
 				int nBytes);
+int yaffs_FindDataChunk(yaffs_Object *obj, loff_t offset, __u8 *buffer,
+			__u32 *eraseCount);
+int yaffs_ReadDataChunk(yaffs_Device *dev, int chunkInNAND, __u8 *buffer,
+			yaffs_ExtendedTags *tags);
+int yaffs_DataChunkStillValid(yaffs_Device *dev, int chunkInNAND,
+			      const yaffs_ExtendedTags *tags, __u32 eraseCount);
 int yaffs_WriteDataToFile(yaffs_Object *obj, const __u8 *buffer, loff_t offset,
 				int nBytes, int writeThrough);
 int yaffs_ResizeFile(yaffs_Object *obj, loff_t newSize);
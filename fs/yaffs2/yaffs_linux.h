@@ -25,14 +25,17 @@ struct yaffs_LinuxContext {
 	struct super_block * superBlock;
 	struct task_struct *bgThread; /* Background thread for this device */
 	int bgRunning;
-        struct semaphore grossLock;     /* Gross locking semaphore */
+	int bgSleeping; /* Background thread waits for work or its timer */
+	struct mutex allocLock;		/* Serialises writers, gc included */
+	struct rw_semaphore grossLock;	/* Gross lock, shared by readers */
+	struct task_struct *grossLockOwner; /* Holds allocLock */
+	struct mutex readLock;		/* Serialises readers' updates */
 	__u8 *spareBuffer;      /* For mtdif2 use. Don't know the size of the buffer
 				 * at compile time so we have to allocate it.
 				 */
 	struct ylist_head searchContexts;
 	void (*putSuperFunc)(struct super_block *sb);
 
-	struct task_struct *readdirProcess;
 	unsigned mount_id;
 };
 
@@ -17,6 +17,30 @@
 
 #include "yaffs_getblockinfo.h"
 
+/*
+ * Programs and erases are bracketed by the nandIOStart/nandIODone callbacks,
+ * which may let readers run while the NAND is busy.  Everything a reader
+ * can see must be consistent here: new chunks are not in any tree yet and
+ * old ones are still on the NAND, and nBlockErasures is bumped before an
+ * erase so that readers can tell a chunk they read may have gone.
+ *
+ * Deleting the last live chunk of a block erases it, so every caller of
+ * yaffs_DeleteChunk() must first unhook the chunk from its tnode or object
+ * header.  Otherwise a reader could look it up after nBlockErasures was
+ * bumped and take the erased flash for data.
+ */
+static void yaffs_StartNANDIO(yaffs_Device *dev)
+{
+	if (dev->param.nandIOStart)
+		dev->param.nandIOStart(dev);
+}
+
+static void yaffs_EndNANDIO(yaffs_Device *dev)
+{
+	if (dev->param.nandIODone)
+		dev->param.nandIODone(dev);
+}
+
 int yaffs_ReadChunkWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
 					   __u8 *buffer,
 					   yaffs_ExtendedTags *tags)
@@ -56,6 +80,7 @@ int yaffs_WriteChunkWithTagsToNAND(yaffs_Device *dev,
 						   const __u8 *buffer,
 						   yaffs_ExtendedTags *tags)
 {
+	int result;
 
 	dev->nPageWrites++;
 
@@ -78,14 +103,20 @@ int yaffs_WriteChunkWithTagsToNAND(yaffs_Device *dev,
 		YBUG();
 	}
 
+	yaffs_StartNANDIO(dev);
+
 	if (dev->param.writeChunkWithTagsToNAND)
-		return dev->param.writeChunkWithTagsToNAND(dev, chunkInNAND, buffer,
+		result = dev->param.writeChunkWithTagsToNAND(dev, chunkInNAND, buffer,
 						     tags);
 	else
-		return yaffs_TagsCompatabilityWriteChunkWithTagsToNAND(dev,
+		result = yaffs_TagsCompatabilityWriteChunkWithTagsToNAND(dev,
 								       chunkInNAND,
 								       buffer,
 								       tags);
+
+	yaffs_EndNANDIO(dev);
+
+	return result;
 }
 
 int yaffs_MarkBlockBad(yaffs_Device *dev, int blockNo)
@@ -124,7 +155,9 @@ int yaffs_EraseBlockInNAND(struct yaffs_DeviceStruct *dev,
 
 	dev->nBlockErasures++;
 
+	yaffs_StartNANDIO(dev);
 	result = dev->param.eraseBlockInNAND(dev, blockInNAND);
+	yaffs_EndNANDIO(dev);
 
 	return result;
 }
@@ -67,6 +67,7 @@
 #endif
 
 #include <linux/kernel.h>
+#include <linux/math64.h>
 #include <linux/module.h>
 #include <linux/slab.h>
 #include <linux/init.h>
@@ -175,6 +176,9 @@ unsigned int yaffs_wr_attempts = YAFFS_WR_ATTEMPTS;
 unsigned int yaffs_auto_checkpoint = 1;
 unsigned int yaffs_gc_control = 1;
 unsigned int yaffs_bg_enable = 1;
+/* Erased blocks above the reserve the background gc tries to keep */
+unsigned int yaffs_gc_low_water = 4;
+unsigned int yaffs_gc_high_water = 16;
 
 /* Module Parameters */
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 5, 0))
@@ -183,6 +187,8 @@ module_param(yaffs_wr_attempts, uint, 0644);
 module_param(yaffs_auto_checkpoint, uint, 0644);
 module_param(yaffs_gc_control, uint, 0644);
 module_param(yaffs_bg_enable, uint, 0644);
+module_param(yaffs_gc_low_water, uint, 0644);
+module_param(yaffs_gc_high_water, uint, 0644);
 #else
 MODULE_PARM(yaffs_traceMask, "i");
 MODULE_PARM(yaffs_wr_attempts, "i");
@@ -507,22 +513,81 @@ static  int yaffs_vfs_setsize(struct inode *inode, loff_t newsize)
 
 }
 
-static unsigned yaffs_gc_control_callback(yaffs_Device *dev)
-{
-	return yaffs_gc_control;
-}
                 	                                                                                          	
+/*
+ * Locking.
+ * yaffs_GrossLock() gives the caller yaffs to itself, which anything that
+ * may write to the NAND needs.  Operations that only look things up and
+ * read take yaffs_GrossLockShared() instead and may run side by side; the
+ * little they still modify inside yaffs_guts (lazy loading, the short op
+ * cache, temp buffers, NAND reads) is serialised through the readLock
+ * callbacks, which are free for the exclusive holder.
+ *
+ * Writers, and gc with them, are serialised by allocLock, which they hold
+ * for the whole operation.  grossLock they give up while the NAND programs
+ * or erases (the nandIO callbacks), so readers only wait for the yaffs
+ * bookkeeping of a write, not for the flash.
+ */
 static void yaffs_GrossLock(yaffs_Device *dev)
 {
 	T(YAFFS_TRACE_LOCK, (TSTR("yaffs locking %p\n"), current));
-	down(&(yaffs_DeviceToLC(dev)->grossLock));
+	mutex_lock(&(yaffs_DeviceToLC(dev)->allocLock));
+	down_write(&(yaffs_DeviceToLC(dev)->grossLock));
+	yaffs_DeviceToLC(dev)->grossLockOwner = current;
 	T(YAFFS_TRACE_LOCK, (TSTR("yaffs locked %p\n"), current));
 }
 
 static void yaffs_GrossUnlock(yaffs_Device *dev)
 {
 	T(YAFFS_TRACE_LOCK, (TSTR("yaffs unlocking %p\n"), current));
-	up(&(yaffs_DeviceToLC(dev)->grossLock));
+	yaffs_DeviceToLC(dev)->grossLockOwner = NULL;
+	up_write(&(yaffs_DeviceToLC(dev)->grossLock));
+	mutex_unlock(&(yaffs_DeviceToLC(dev)->allocLock));
+}
+
+static void yaffs_GrossLockShared(yaffs_Device *dev)
+{
+	T(YAFFS_TRACE_LOCK, (TSTR("yaffs locking shared %p\n"), current));
+	down_read(&(yaffs_DeviceToLC(dev)->grossLock));
+	T(YAFFS_TRACE_LOCK, (TSTR("yaffs locked shared %p\n"), current));
+}
+
+static void yaffs_GrossUnlockShared(yaffs_Device *dev)
+{
+	T(YAFFS_TRACE_LOCK, (TSTR("yaffs unlocking shared %p\n"), current));
+	up_read(&(yaffs_DeviceToLC(dev)->grossLock));
+}
+
+static void yaffs_read_lock_callback(yaffs_Device *dev)
+{
+	struct yaffs_LinuxContext *lc = yaffs_DeviceToLC(dev);
+
+	if (lc->grossLockOwner != current)
+		mutex_lock(&lc->readLock);
+}
+
+static void yaffs_read_unlock_callback(yaffs_Device *dev)
+{
+	struct yaffs_LinuxContext *lc = yaffs_DeviceToLC(dev);
+
+	if (lc->grossLockOwner != current)
+		mutex_unlock(&lc->readLock);
+}
+
+static void yaffs_nand_io_start_callback(yaffs_Device *dev)
+{
+	struct yaffs_LinuxContext *lc = yaffs_DeviceToLC(dev);
+
+	if (lc->grossLockOwner == current)
+		up_write(&lc->grossLock);
+}
+
+static void yaffs_nand_io_done_callback(yaffs_Device *dev)
+{
+	struct yaffs_LinuxContext *lc = yaffs_DeviceToLC(dev);
+
+	if (lc->grossLockOwner == current)
+		down_write(&lc->grossLock);
 }
 
 #ifdef YAFFS_COMPILE_EXPORTFS
@@ -607,7 +672,8 @@ static struct export_operations yaffs_export_ops =
  *
  * A seach context lives for the duration of a readdir.
  *
- * All these functions must be called while yaffs is locked.
+ * All these functions must be called while yaffs is locked, at least
+ * shared.  The list itself is only changed under the read lock.
  */
 
 struct yaffs_SearchContext {
@@ -637,7 +703,9 @@ static struct yaffs_SearchContext * yaffs_NewSearch(yaffs_Object *dir)
                                 dir->variant.directoryVariant.children.next,
 				yaffs_Object,siblings);
 		YINIT_LIST_HEAD(&sc->others);
+		yaffs_read_lock_callback(dev);
 		ylist_add(&sc->others,&(yaffs_DeviceToLC(dev)->searchContexts));
+		yaffs_read_unlock_callback(dev);
 	}
 	return sc;
 }
@@ -648,7 +716,9 @@ static struct yaffs_SearchContext * yaffs_NewSearch(yaffs_Object *dir)
 static void yaffs_EndSearch(struct yaffs_SearchContext * sc)
 {
 	if(sc){
+		yaffs_read_lock_callback(sc->dev);
 		ylist_del(&sc->others);
+		yaffs_read_unlock_callback(sc->dev);
 		YFREE(sc);
 	}
 }
@@ -714,11 +784,11 @@ static int yaffs_readlink(struct dentry *dentry, char __user *buffer,
 
 	yaffs_Device *dev = yaffs_DentryToObject(dentry)->myDev;
 
-	yaffs_GrossLock(dev);
+	yaffs_GrossLockShared(dev);
 
 	alias = yaffs_GetSymlinkAlias(yaffs_DentryToObject(dentry));
 
-	yaffs_GrossUnlock(dev);
+	yaffs_GrossUnlockShared(dev);
 
 	if (!alias)
 		return -ENOMEM;
@@ -738,10 +808,10 @@ static int yaffs_follow_link(struct dentry *dentry, struct nameidata *nd)
 	int ret;
 	yaffs_Device *dev = yaffs_DentryToObject(dentry)->myDev;
 
-	yaffs_GrossLock(dev);
+	yaffs_GrossLockShared(dev);
 
 	alias = yaffs_GetSymlinkAlias(yaffs_DentryToObject(dentry));
-	yaffs_GrossUnlock(dev);
+	yaffs_GrossUnlockShared(dev);
 
 	if (!alias) {
 		ret = -ENOMEM;
@@ -786,8 +856,7 @@ static struct dentry *yaffs_lookup(struct inode *dir, struct dentry *dentry)
 
 	yaffs_Device *dev = yaffs_InodeToObject(dir)->myDev;
 
-	if(current != yaffs_DeviceToLC(dev)->readdirProcess)
-		yaffs_GrossLock(dev);
+	yaffs_GrossLockShared(dev);
 
 	T(YAFFS_TRACE_OS,
 		(TSTR("yaffs_lookup for %d:%s\n"),
@@ -799,8 +868,7 @@ static struct dentry *yaffs_lookup(struct inode *dir, struct dentry *dentry)
 	obj = yaffs_GetEquivalentObject(obj);	/* in case it was a hardlink */
 
 	/* Can't hold gross lock when calling yaffs_get_inode() */
-	if(current != yaffs_DeviceToLC(dev)->readdirProcess)
-		yaffs_GrossUnlock(dev);
+	yaffs_GrossUnlockShared(dev);
 
 	if (obj) {
 		T(YAFFS_TRACE_OS,
@@ -985,6 +1053,45 @@ static int yaffs_file_flush(struct file *file)
 	return 0;
 }
 
+/*
+ * Reads a page of whole chunks with yaffs locked only to look each chunk
+ * up and to check it afterwards, so that the NAND reads of several readers
+ * and of a writer's programs and erases all overlap.
+ */
+static int yaffs_ReadPageUnlocked(yaffs_Object *obj, unsigned char *pg_buf,
+				  loff_t pos)
+{
+	yaffs_Device *dev = obj->myDev;
+	yaffs_ExtendedTags tags;
+	__u32 eraseCount;
+	int chunkInNAND;
+	int offset;
+	int valid;
+
+	for (offset = 0; offset < PAGE_CACHE_SIZE;
+	     offset += dev->nDataBytesPerChunk) {
+		do {
+			yaffs_GrossLockShared(dev);
+			chunkInNAND = yaffs_FindDataChunk(obj, pos + offset,
+						pg_buf + offset, &eraseCount);
+			yaffs_GrossUnlockShared(dev);
+
+			if (!chunkInNAND)
+				break;
+
+			yaffs_ReadDataChunk(dev, chunkInNAND, pg_buf + offset,
+					    &tags);
+
+			yaffs_GrossLockShared(dev);
+			valid = yaffs_DataChunkStillValid(dev, chunkInNAND,
+							  &tags, eraseCount);
+			yaffs_GrossUnlockShared(dev);
+		} while (!valid);
+	}
+
+	return PAGE_CACHE_SIZE;
+}
+
 static int yaffs_readpage_nolock(struct file *f, struct page *pg)
 {
 	/* Lifted from jffs2 */
@@ -992,6 +1099,7 @@ static int yaffs_readpage_nolock(struct file *f, struct page *pg)
 	yaffs_Object *obj;
 	unsigned char *pg_buf;
 	int ret;
+	int shared;
 
 	yaffs_Device *dev;
 
@@ -1014,13 +1122,32 @@ static int yaffs_readpage_nolock(struct file *f, struct page *pg)
 	pg_buf = kmap(pg);
 	/* FIXME: Can kmap fail? */
 
-	yaffs_GrossLock(dev);
+	/* Whole chunks come straight off the NAND or out of the cache, which
+	 * is safe shared, and on yaffs2 even unlocked.  Partial chunks may
+	 * have to make room in the cache, which can write.
+	 */
+	shared = !dev->param.inbandTags &&
+		 !(PAGE_CACHE_SIZE % dev->nDataBytesPerChunk);
 
-	ret = yaffs_ReadDataFromFile(obj, pg_buf,
-				pg->index << PAGE_CACHE_SHIFT,
-				PAGE_CACHE_SIZE);
+	if (shared && dev->param.isYaffs2 &&
+	    dev->param.readChunkWithTagsFromNAND)
+		ret = yaffs_ReadPageUnlocked(obj, pg_buf,
+				(loff_t)pg->index << PAGE_CACHE_SHIFT);
+	else {
+		if (shared)
+			yaffs_GrossLockShared(dev);
+		else
+			yaffs_GrossLock(dev);
 
-	yaffs_GrossUnlock(dev);
+		ret = yaffs_ReadDataFromFile(obj, pg_buf,
+					pg->index << PAGE_CACHE_SHIFT,
+					PAGE_CACHE_SIZE);
+
+		if (shared)
+			yaffs_GrossUnlockShared(dev);
+		else
+			yaffs_GrossUnlock(dev);
+	}
 
 	if (ret >= 0)
 		ret = 0;
@@ -1575,9 +1702,7 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 	obj = yaffs_DentryToObject(f->f_dentry);
 	dev = obj->myDev;
 
-	yaffs_GrossLock(dev);
-
-	yaffs_DeviceToLC(dev)->readdirProcess = current;
+	yaffs_GrossLockShared(dev);
 
 	offset = f->f_pos;
 
@@ -1593,12 +1718,12 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 		T(YAFFS_TRACE_OS,
 			(TSTR("yaffs_readdir: entry . ino %d \n"),
 			(int)inode->i_ino));
-		yaffs_GrossUnlock(dev);
+		yaffs_GrossUnlockShared(dev);
 		if (filldir(dirent, ".", 1, offset, inode->i_ino, DT_DIR) < 0){
-			yaffs_GrossLock(dev);
+			yaffs_GrossLockShared(dev);
 			goto out;
 		}
-		yaffs_GrossLock(dev);
+		yaffs_GrossLockShared(dev);
 		offset++;
 		f->f_pos++;
 	}
@@ -1606,13 +1731,13 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 		T(YAFFS_TRACE_OS,
 			(TSTR("yaffs_readdir: entry .. ino %d \n"),
 			(int)f->f_dentry->d_parent->d_inode->i_ino));
-		yaffs_GrossUnlock(dev);
+		yaffs_GrossUnlockShared(dev);
 		if (filldir(dirent, "..", 2, offset,
 			f->f_dentry->d_parent->d_inode->i_ino, DT_DIR) < 0){
-			yaffs_GrossLock(dev);
+			yaffs_GrossLockShared(dev);
 			goto out;
 		}
-		yaffs_GrossLock(dev);
+		yaffs_GrossLockShared(dev);
 		offset++;
 		f->f_pos++;
 	}
@@ -1640,7 +1765,7 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 			  (TSTR("yaffs_readdir: %s inode %d\n"),
 			  name, yaffs_GetObjectInode(l)));
 
-                        yaffs_GrossUnlock(dev);
+                        yaffs_GrossUnlockShared(dev);
 
 			if (filldir(dirent,
 					name,
@@ -1648,11 +1773,11 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 					offset,
 					this_inode,
 					this_type) < 0){
-				yaffs_GrossLock(dev);
+				yaffs_GrossLockShared(dev);
 				goto out;
 			}
 
-                        yaffs_GrossLock(dev);
+                        yaffs_GrossLockShared(dev);
 
 			offset++;
 			f->f_pos++;
@@ -1662,8 +1787,7 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 
 out:
 	yaffs_EndSearch(sc);
-	yaffs_DeviceToLC(dev)->readdirProcess = NULL;
-	yaffs_GrossUnlock(dev);
+	yaffs_GrossUnlockShared(dev);
 
 	return retVal;
 }
@@ -2240,11 +2364,24 @@ static void yaffs_FlushSuperBlock(struct super_block *sb, int do_checkpoint)
 }
 
 
+/*
+ * How hard the background thread should be collecting, from the erased
+ * blocks left above the reserve: flat out (2) below yaffs_gc_low_water,
+ * steadily (1) below yaffs_gc_high_water, otherwise only now and then.
+ * The high water mark is held to a quarter of the device so that small
+ * devices are not collected continuously.
+ */
 static unsigned yaffs_bg_gc_urgency(yaffs_Device *dev)
 {
 	unsigned erasedChunks = dev->nErasedBlocks * dev->param.nChunksPerBlock;
 	struct yaffs_LinuxContext *context = yaffs_DeviceToLC(dev);
 	unsigned scatteredFree = 0; /* Free chunks not in an erased block */
+	int nBlocks = dev->internalEndBlock - dev->internalStartBlock + 1;
+	int spareBlocks = dev->nErasedBlocks - dev->param.nReservedBlocks;
+	int highWater = yaffs_gc_high_water;
+
+	if(highWater > nBlocks / 4)
+		highWater = nBlocks / 4;
 
 	if(erasedChunks < dev->nFreeChunks)
 		scatteredFree = (dev->nFreeChunks - erasedChunks);
@@ -2253,12 +2390,40 @@ static unsigned yaffs_bg_gc_urgency(yaffs_Device *dev)
 		return 0;
 	else if(scatteredFree < (dev->param.nChunksPerBlock * 2))
 		return 0;
-	else if(erasedChunks > dev->nFreeChunks/2)
-		return 0;
-	else if(erasedChunks > dev->nFreeChunks/4)
+	else if(spareBlocks < (int)yaffs_gc_low_water)
+		return 2;
+	else if(spareBlocks < highWater)
 		return 1;
 	else
-		return 2;
+		return 0;
+}
+
+/*
+ * While the background thread is running it does the leisurely gc, so
+ * writers only collect in line once it has fallen behind. Writers wake
+ * it when there is gc to be done and it is waiting for work (bgSleeping),
+ * not when it is merely blocked on a lock or the NAND; once it is being
+ * stopped they do all the gc themselves again.
+ */
+static unsigned yaffs_gc_control_callback(yaffs_Device *dev)
+{
+	struct yaffs_LinuxContext *context = yaffs_DeviceToLC(dev);
+	unsigned control = yaffs_gc_control;
+	unsigned urgency;
+
+	if(!yaffs_bg_enable || !context->bgThread || !context->bgRunning ||
+		dev->isCheckpointed)
+		return control;
+
+	urgency = yaffs_bg_gc_urgency(dev);
+	/* Pairs with set_current_state() before the thread's last look */
+	smp_mb();
+	if(urgency > 0 && context->bgSleeping)
+		wake_up_process(context->bgThread);
+	if(urgency < 2)
+		control |= YAFFS_GC_CONTROL_DEFER;
+
+	return control;
 }
 
 static int yaffs_do_sync_fs(struct super_block *sb,
@@ -2321,6 +2486,8 @@ static int yaffs_BackgroundThread(void *data)
 	unsigned long next_gc = now;
 	unsigned long expires;
 	unsigned int urgency;
+	int erased;
+	int progress;
 
 	int gcResult;
 	struct timer_list timer;
@@ -2346,29 +2513,46 @@ static int yaffs_BackgroundThread(void *data)
 		yaffs_GrossLock(dev);
 
 		now = jiffies;
+		urgency = 0;
+		progress = 0;
+		erased = dev->nErasedBlocks;
 
 		if(time_after(now, next_dir_update) && yaffs_bg_enable){
 			yaffs_UpdateDirtyDirectories(dev);
 			next_dir_update = now + HZ;
 		}
 
-		if(time_after(now,next_gc) && yaffs_bg_enable){
-			if(!dev->isCheckpointed){
-				urgency = yaffs_bg_gc_urgency(dev);
+		/*
+		 * Below the high water mark take one gc step per wake up, writers
+		 * wake us as they use up blocks. Below the low water mark collect
+		 * whole blocks and keep going, letting go of the lock between
+		 * blocks.
+		 */
+		if(yaffs_bg_enable && !dev->isCheckpointed){
+			urgency = yaffs_bg_gc_urgency(dev);
+			if(urgency > 0 || time_after(now,next_gc)){
 				gcResult = yaffs_BackgroundGarbageCollect(dev, urgency);
-				if(urgency > 1)
-					next_gc = now + HZ/20+1;
-				else if(urgency > 0)
-					next_gc = now + HZ/10+1;
+				progress = dev->gcBlock > 0 ||
+					dev->nErasedBlocks > erased;
+				if(urgency > 0)
+					next_gc = now + HZ/50+1;
 				else
 					next_gc = now + HZ * 2;
-			} else /*
-				* gc not running so set to next_dir_update
-				* to cut down on wake ups
-				*/
-				next_gc = next_dir_update;
-		}
+			}
+		} else if(time_after(now,next_gc))
+			/*
+			 * gc not running so set to next_dir_update
+			 * to cut down on wake ups
+			 */
+			next_gc = next_dir_update;
+
 		yaffs_GrossUnlock(dev);
+
+		/* Keep going while short of blocks and gc is getting somewhere */
+		if(urgency > 1 && progress){
+			cond_resched();
+			continue;
+		}
 #if 1
 		expires = next_dir_update;
 		if (time_before(next_gc,expires))
@@ -2381,9 +2565,18 @@ static int yaffs_BackgroundThread(void *data)
 		timer.data = (unsigned long) current;
 		timer.function = yaffs_background_waker;
 
+		context->bgSleeping = 1;
                 set_current_state(TASK_INTERRUPTIBLE);
+		/* A writer may have found gc for us since we last looked */
+		if(!urgency && yaffs_bg_enable && !dev->isCheckpointed &&
+			yaffs_bg_gc_urgency(dev) > 0){
+			__set_current_state(TASK_RUNNING);
+			context->bgSleeping = 0;
+			continue;
+		}
 		add_timer(&timer);
 		schedule();
+		context->bgSleeping = 0;
 		del_timer_sync(&timer);
 #else
 		msleep(10);
@@ -2402,6 +2595,7 @@ static int yaffs_BackgroundStart(yaffs_Device *dev)
 		return -1;
 
 	context->bgRunning = 1;
+	context->bgSleeping = 0;
 
 	context->bgThread = kthread_run(yaffs_BackgroundThread,
 	                        (void *)dev,"yaffs-bg-%d",context->mount_id);
@@ -2501,13 +2695,13 @@ static struct inode *yaffs_iget(struct super_block *sb, unsigned long ino)
 	 * need to lock again.
 	 */
 
-	yaffs_GrossLock(dev);
+	yaffs_GrossLockShared(dev);
 
 	obj = yaffs_FindObjectByNumber(dev, inode->i_ino);
 
 	yaffs_FillInodeFromObject(inode, obj);
 
-	yaffs_GrossUnlock(dev);
+	yaffs_GrossUnlockShared(dev);
 
 	unlock_new_inode(inode);
 	return inode;
@@ -2528,15 +2722,13 @@ static void yaffs_read_inode(struct inode *inode)
 	T(YAFFS_TRACE_OS,
 		(TSTR("yaffs_read_inode for %d\n"), (int)inode->i_ino));
 
-	if(current != yaffs_DeviceToLC(dev)->readdirProcess)
-		yaffs_GrossLock(dev);
+	yaffs_GrossLockShared(dev);
 
 	obj = yaffs_FindObjectByNumber(dev, inode->i_ino);
 
 	yaffs_FillInodeFromObject(inode, obj);
 
-	if(current != yaffs_DeviceToLC(dev)->readdirProcess)
-		yaffs_GrossUnlock(dev);
+	yaffs_GrossUnlockShared(dev);
 }
 
 #endif
@@ -3036,7 +3228,13 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
         YINIT_LIST_HEAD(&(yaffs_DeviceToLC(dev)->searchContexts));
         param->removeObjectCallback = yaffs_RemoveObjectCallback;
 
-	init_MUTEX(&(yaffs_DeviceToLC(dev)->grossLock));
+	mutex_init(&(yaffs_DeviceToLC(dev)->allocLock));
+	init_rwsem(&(yaffs_DeviceToLC(dev)->grossLock));
+	mutex_init(&(yaffs_DeviceToLC(dev)->readLock));
+	param->readLock = yaffs_read_lock_callback;
+	param->readUnlock = yaffs_read_unlock_callback;
+	param->nandIOStart = yaffs_nand_io_start_callback;
+	param->nandIODone = yaffs_nand_io_done_callback;
 
 	yaffs_GrossLock(dev);
 
@@ -3228,6 +3426,19 @@ static char *yaffs_dump_dev_part1(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "oldestDirtyGCs..... %u\n", dev->oldestDirtyGCs);
 	buf += sprintf(buf, "nGCBlocks.......... %u\n", dev->nGCBlocks);
 	buf += sprintf(buf, "backgroundGCs...... %u\n", dev->backgroundGCs);
+	buf += sprintf(buf, "gcTimeMs........... %llu\n",
+			(unsigned long long)div_u64(dev->gcTime, 1000000));
+	buf += sprintf(buf, "backgroundGCTimeMs. %llu\n",
+			(unsigned long long)div_u64(dev->backgroundGCTime, 1000000));
+	buf += sprintf(buf, "maxGCStallUs....... %llu\n",
+			(unsigned long long)div_u64(dev->maxGCStall, 1000));
+	if(dev->nPageWrites > dev->nGCCopies) {
+		unsigned wa = div_u64((__u64)dev->nPageWrites * 100,
+					dev->nPageWrites - dev->nGCCopies);
+		buf += sprintf(buf, "writeAmplification. %u.%02u\n",
+				wa / 100, wa % 100);
+	} else
+		buf += sprintf(buf, "writeAmplification. -\n");
 	buf += sprintf(buf, "nRetriedWrites..... %u\n", dev->nRetriedWrites);
 	buf += sprintf(buf, "nRetireBlocks...... %u\n", dev->nRetiredBlocks);
 	buf += sprintf(buf, "eccFixed........... %u\n", dev->eccFixed);
@@ -43,6 +43,7 @@
 #endif
 
 #include <linux/kernel.h>
+#include <linux/ktime.h>
 #include <linux/mm.h>
 #include <linux/sched.h>
 #include <linux/string.h>
@@ -76,6 +77,11 @@
 #define YYIELD() schedule()
 #define Y_DUMP_STACK() dump_stack()
 
+#define Y_WMB() smp_wmb()
+#define Y_RMB() smp_rmb()
+
+#define Y_TIME_NS() ktime_to_ns(ktime_get())
+
 #define YAFFS_ROOT_MODE			0755
 #define YAFFS_LOSTNFOUND_MODE		0700
 
@@ -320,6 +326,15 @@
 #define Y_DUMP_STACK() do { } while (0)
 #endif
 
+#ifndef Y_WMB
+#define Y_WMB() do { } while (0)
+#define Y_RMB() do { } while (0)
+#endif
+
+#ifndef Y_TIME_NS
+#define Y_TIME_NS() 0
+#endif
+
 #ifndef YBUG
 #define YBUG() do {\
 	T(YAFFS_TRACE_BUG,\
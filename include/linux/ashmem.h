@@ -45,4 +45,29 @@ struct ashmem_pin {
 #define ASHMEM_GET_PIN_STATUS	_IO(__ASHMEMIOC, 9)
 #define ASHMEM_PURGE_ALL_CACHES	_IO(__ASHMEMIOC, 10)
 
+#ifdef __KERNEL__
+
+struct ashmem_area;
+struct vm_area_struct;
+
+#ifdef CONFIG_ASHMEM
+extern struct ashmem_area *ashmem_share_get(struct vm_area_struct *vma,
+					    unsigned long start,
+					    unsigned long end);
+extern void ashmem_share_put(struct ashmem_area *asma);
+#else
+static inline struct ashmem_area *
+ashmem_share_get(struct vm_area_struct *vma, unsigned long start,
+		 unsigned long end)
+{
+	return NULL;
+}
+
+static inline void ashmem_share_put(struct ashmem_area *asma)
+{
+}
+#endif
+
+#endif	/* __KERNEL__ */
+
 #endif	/* _LINUX_ASHMEM_H */
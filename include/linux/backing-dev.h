@@ -62,6 +62,7 @@ struct backing_dev_info {
 	struct list_head bdi_list;
 	struct rcu_head rcu_head;
 	unsigned long ra_pages;	/* max readahead in PAGE_CACHE_SIZE units */
+	unsigned int fault_around_pages; /* pages mapped per read fault, 0: off */
 	unsigned long state;	/* Always use atomic bitops on this */
 	unsigned int capabilities; /* Device capabilities */
 	congested_fn *congested_fn; /* Function pointer if device is md/dm */
@@ -95,6 +96,9 @@ struct backing_dev_info {
 #endif
 };
 
+/* Upper bound of fault_around_pages, sizes an on-stack array */
+#define FAULT_AROUND_MAX_PAGES	32
+
 int bdi_init(struct backing_dev_info *bdi);
 void bdi_destroy(struct backing_dev_info *bdi);
 
@@ -87,7 +87,14 @@ static void free(void *where)
 static void(*error)(char *m);
 #define set_error_fn(x) error = x;
 
+/*
+ * Decompressors that are also used after boot (see lib/unlzma.c) define
+ * INIT empty before including this, so they are not discarded with the
+ * init sections.
+ */
+#ifndef INIT
 #define INIT __init
+#endif
 #define STATIC
 
 #include <linux/init.h>
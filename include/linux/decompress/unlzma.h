@@ -9,4 +9,19 @@ int unlzma(unsigned char *, int,
 	   void(*error)(char *x)
 	);
 
+/*
+ * Like unlzma() with the whole input in buf and no fill or flush, but
+ * decodes using the caller's probability table of probs_size bytes
+ * instead of allocating one per call.  LZMA_PROBS_SIZE(n) is enough for
+ * streams with lc + lp <= n; streams needing more are refused.
+ */
+#define LZMA_PROBS_SIZE(lclp)	((1846 + (768 << (lclp))) * 2)
+
+int unlzma_probs(unsigned char *buf, int in_len,
+		 unsigned char *output,
+		 int *posp,
+		 void(*error)(char *x),
+		 void *probs, int probs_size
+	);
+
 #endif
@@ -899,6 +899,17 @@ struct file_ra_state {
 	unsigned int ra_pages;		/* Maximum readahead window */
 	unsigned int mmap_miss;		/* Cache miss stat for mmap accesses */
 	loff_t prev_pos;		/* Cache last read() position */
+
+	/* Strided and backward streams, see try_stride_readahead() */
+	pgoff_t prev_index;		/* last read that missed, or was
+					   read ahead in a strided stream */
+	long stride;			/* distance between such reads */
+	unsigned int stride_count;	/* times in a row it was seen */
+
+	/* Feedback on how much of the readahead gets used */
+	unsigned long hit_pages;	/* readahead pages used */
+	unsigned long miss_pages;	/* readahead pages evicted unused */
+	unsigned int size_limit;	/* window limit, 0 if ra_pages */
 };
 
 /*
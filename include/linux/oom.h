@@ -14,6 +14,7 @@
 
 struct zonelist;
 struct notifier_block;
+struct task_struct;
 
 /*
  * Types of limitations to the nodes from which allocations may occur
@@ -43,5 +44,35 @@ static inline void oom_killer_enable(void)
 {
 	oom_killer_disabled = false;
 }
+
+/*
+ * The Android low memory killer keeps processes indexed by oom_adj; these
+ * are called with tasklist_lock write-locked as processes come and go, and
+ * after a process's oom_adj changed.
+ */
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+extern void lowmem_add_process(struct task_struct *p);
+extern void lowmem_del_process(struct task_struct *p);
+extern void lowmem_replace_process(struct task_struct *old,
+				   struct task_struct *new);
+extern void lowmem_adj_changed(struct task_struct *p);
+#else
+static inline void lowmem_add_process(struct task_struct *p)
+{
+}
+
+static inline void lowmem_del_process(struct task_struct *p)
+{
+}
+
+static inline void lowmem_replace_process(struct task_struct *old,
+					  struct task_struct *new)
+{
+}
+
+static inline void lowmem_adj_changed(struct task_struct *p)
+{
+}
+#endif
 #endif /* __KERNEL__*/
 #endif /* _INCLUDE_LINUX_OOM_H */
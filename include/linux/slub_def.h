@@ -32,12 +32,25 @@ enum stat_item {
 	DEACTIVATE_TO_TAIL,	/* Cpu slab was moved to the tail of partials */
 	DEACTIVATE_REMOTE_FREES,/* Slab contained remotely freed objects */
 	ORDER_FALLBACK,		/* Number of times fallback was necessary */
+	ALLOC_MAGAZINE,		/* Bulk allocation from the cpu magazine */
+	FREE_MAGAZINE,		/* Bulk free to the cpu magazine */
+	MAGAZINE_FLUSH,		/* Objects flushed from the cpu magazine */
 	NR_SLUB_STAT_ITEMS };
 
+/*
+ * Objects freed by kmem_cache_free_bulk() that do not belong to the cpu
+ * slab are parked in a small per cpu magazine instead of taking the slab
+ * lock of their page, and kmem_cache_alloc_bulk() takes them from there
+ * first.
+ */
+#define SLUB_MAGAZINE_SIZE	16
+
 struct kmem_cache_cpu {
 	void **freelist;	/* Pointer to first free per cpu object */
 	struct page *page;	/* The slab from which we are allocating */
 	int node;		/* The node of the page (or -1 for debug) */
+	unsigned int mag_count;	/* Objects in the magazine */
+	void *mag[SLUB_MAGAZINE_SIZE];
 #ifdef CONFIG_SLUB_STATS
 	unsigned stat[NR_SLUB_STAT_ITEMS];
 #endif
@@ -0,0 +1,130 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM readahead
+
+#if !defined(_TRACE_READAHEAD_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_READAHEAD_H
+
+#include <linux/fs.h>
+#include <linux/tracepoint.h>
+
+#ifndef _TRACE_READAHEAD_PATTERNS
+#define _TRACE_READAHEAD_PATTERNS
+/* How ondemand_readahead() classified a read */
+enum readahead_pattern {
+	RA_PATTERN_INITIAL,	/* start of file or of a sequential stream */
+	RA_PATTERN_SEQUENTIAL,	/* continues the current window */
+	RA_PATTERN_MARKER,	/* hit a readahead mark of another stream */
+	RA_PATTERN_CONTEXT,	/* sequential according to the page cache */
+	RA_PATTERN_STRIDE,	/* equally spaced reads, forward */
+	RA_PATTERN_BACKWARD,	/* equally spaced reads, backward */
+	RA_PATTERN_RANDOM,	/* none of the above */
+};
+
+/* Percentage of the readahead pages that got used */
+static inline unsigned int ra_accuracy(unsigned long hit, unsigned long miss)
+{
+	unsigned long total = hit + miss;
+
+	if (!total)
+		return 100;
+	/* hit * 100 would overflow, but then total / 100 is precise enough */
+	if (hit > ULONG_MAX / 100)
+		return hit / (total / 100);
+	return hit * 100 / total;
+}
+#endif
+
+#define show_ra_pattern(pattern)					\
+	__print_symbolic(pattern,					\
+		{ RA_PATTERN_INITIAL,		"initial" },		\
+		{ RA_PATTERN_SEQUENTIAL,	"sequential" },		\
+		{ RA_PATTERN_MARKER,		"marker" },		\
+		{ RA_PATTERN_CONTEXT,		"context" },		\
+		{ RA_PATTERN_STRIDE,		"stride" },		\
+		{ RA_PATTERN_BACKWARD,		"backward" },		\
+		{ RA_PATTERN_RANDOM,		"random" })
+
+TRACE_EVENT(readahead,
+
+	TP_PROTO(struct address_space *mapping, struct file_ra_state *ra,
+		 pgoff_t offset, unsigned long req_size, int pattern,
+		 unsigned long actual),
+
+	TP_ARGS(mapping, ra, offset, req_size, pattern, actual),
+
+	TP_STRUCT__entry(
+		__field(	dev_t,		dev		)
+		__field(	ino_t,		ino		)
+		__field(	pgoff_t,	offset		)
+		__field(	unsigned long,	req_size	)
+		__field(	int,		pattern		)
+		__field(	pgoff_t,	start		)
+		__field(	unsigned int,	size		)
+		__field(	unsigned int,	async_size	)
+		__field(	long,		stride		)
+		__field(	unsigned long,	actual		)
+		__field(	unsigned int,	accuracy	)
+	),
+
+	TP_fast_assign(
+		__entry->dev		= mapping->host->i_sb->s_dev;
+		__entry->ino		= mapping->host->i_ino;
+		__entry->offset		= offset;
+		__entry->req_size	= req_size;
+		__entry->pattern	= pattern;
+		__entry->start		= ra->start;
+		__entry->size		= ra->size;
+		__entry->async_size	= ra->async_size;
+		__entry->stride		= ra->stride;
+		__entry->actual		= actual;
+		__entry->accuracy	= ra_accuracy(ra->hit_pages,
+						      ra->miss_pages);
+	),
+
+	TP_printk("dev %d,%d ino %lu %s offset=%lu req=%lu ra=%lu+%u-%u "
+		  "stride=%ld actual=%lu accuracy=%u%%",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  (unsigned long)__entry->ino, show_ra_pattern(__entry->pattern),
+		  (unsigned long)__entry->offset, __entry->req_size,
+		  (unsigned long)__entry->start, __entry->size,
+		  __entry->async_size, __entry->stride, __entry->actual,
+		  __entry->accuracy)
+);
+
+TRACE_EVENT(readahead_thrash,
+
+	TP_PROTO(struct address_space *mapping, struct file_ra_state *ra,
+		 pgoff_t offset, unsigned long lost),
+
+	TP_ARGS(mapping, ra, offset, lost),
+
+	TP_STRUCT__entry(
+		__field(	dev_t,		dev		)
+		__field(	ino_t,		ino		)
+		__field(	pgoff_t,	offset		)
+		__field(	unsigned long,	lost		)
+		__field(	unsigned int,	size_limit	)
+		__field(	unsigned int,	accuracy	)
+	),
+
+	TP_fast_assign(
+		__entry->dev		= mapping->host->i_sb->s_dev;
+		__entry->ino		= mapping->host->i_ino;
+		__entry->offset		= offset;
+		__entry->lost		= lost;
+		__entry->size_limit	= ra->size_limit;
+		__entry->accuracy	= ra_accuracy(ra->hit_pages,
+						      ra->miss_pages);
+	),
+
+	TP_printk("dev %d,%d ino %lu offset=%lu lost=%lu limit=%u "
+		  "accuracy=%u%%",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  (unsigned long)__entry->ino, (unsigned long)__entry->offset,
+		  __entry->lost, __entry->size_limit, __entry->accuracy)
+);
+
+#endif /* _TRACE_READAHEAD_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
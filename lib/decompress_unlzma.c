@@ -74,6 +74,7 @@ struct rc {
 	uint32_t code;
 	uint32_t range;
 	uint32_t bound;
+	int eof;
 };
 
 
@@ -87,12 +88,20 @@ static int nofill(void *buffer, unsigned int len)
 	return -1;
 }
 
-/* Called twice: once at startup and once in rc_normalize() */
+/*
+ * Called twice: once at startup and once in rc_normalize().  At the end of
+ * the input the first byte of the buffer is read over and over, and eof
+ * tells unlzma() to give up.
+ */
 static void INIT rc_read(struct rc *rc)
 {
 	rc->buffer_size = rc->fill((char *)rc->buffer, LZMA_IOBUF_SIZE);
-	if (rc->buffer_size <= 0)
-		error("unexpected EOF");
+	if (rc->buffer_size <= 0) {
+		if (!rc->eof)
+			error("unexpected EOF");
+		rc->eof = 1;
+		rc->buffer_size = 1;
+	}
 	rc->ptr = rc->buffer;
 	rc->buffer_end = rc->buffer + rc->buffer_size;
 }
@@ -113,6 +122,7 @@ static inline void INIT rc_init(struct rc *rc,
 
 	rc->code = 0;
 	rc->range = 0xFFFFFFFF;
+	rc->eof = 0;
 }
 
 static inline void INIT rc_init_code(struct rc *rc)
@@ -288,6 +298,7 @@ struct writer {
 	size_t global_pos;
 	int(*flush)(void*, unsigned int);
 	struct lzma_header *header;
+	int corrupt;
 };
 
 struct cstate {
@@ -304,19 +315,20 @@ static inline size_t INIT get_pos(struct writer *wr)
 static inline uint8_t INIT peek_old_byte(struct writer *wr,
 						uint32_t offs)
 {
+	/* A corrupt stream can point before the start or outside the window */
+	if (offs > wr->header->dict_size || offs > get_pos(wr)) {
+		wr->corrupt = 1;
+		return 0;
+	}
+
 	if (!wr->flush) {
-		int32_t pos;
-		while (offs > wr->header->dict_size)
-			offs -= wr->header->dict_size;
-		pos = wr->buffer_pos - offs;
-		return wr->buffer[pos];
+		return wr->buffer[wr->buffer_pos - offs];
 	} else {
 		uint32_t pos = wr->buffer_pos - offs;
-		while (pos >= wr->header->dict_size)
+		if (pos >= wr->header->dict_size)
 			pos += wr->header->dict_size;
 		return wr->buffer[pos];
 	}
-
 }
 
 static inline void INIT write_byte(struct writer *wr, uint8_t byte)
@@ -531,12 +543,18 @@ static inline void INIT process_bit1(struct writer *wr, struct rc *rc,
 
 
 
-STATIC inline int INIT unlzma(unsigned char *buf, int in_len,
+/*
+ * If probs is given it is used as the probability table instead of
+ * allocating one, and streams needing more than probs_size bytes of it
+ * are refused.
+ */
+static inline int INIT __unlzma(unsigned char *buf, int in_len,
 			      int(*fill)(void*, unsigned int),
 			      int(*flush)(void*, unsigned int),
 			      unsigned char *output,
 			      int *posp,
-			      void(*error_fn)(char *x)
+			      void(*error_fn)(char *x),
+			      uint16_t *probs, int probs_size
 	)
 {
 	struct lzma_header header;
@@ -571,6 +589,7 @@ STATIC inline int INIT unlzma(unsigned char *buf, int in_len,
 	wr.global_pos = 0;
 	wr.previous_byte = 0;
 	wr.buffer_pos = 0;
+	wr.corrupt = 0;
 
 	rc_init(&rc, fill, inbuf, in_len);
 
@@ -580,8 +599,10 @@ STATIC inline int INIT unlzma(unsigned char *buf, int in_len,
 		((unsigned char *)&header)[i] = *rc.ptr++;
 	}
 
-	if (header.pos >= (9 * 5 * 5))
+	if (rc.eof || header.pos >= (9 * 5 * 5)) {
 		error("bad header");
+		goto exit_1;
+	}
 
 	mi = 0;
 	lc = header.pos;
@@ -614,7 +635,14 @@ STATIC inline int INIT unlzma(unsigned char *buf, int in_len,
 		goto exit_1;
 
 	num_probs = LZMA_BASE_SIZE + (LZMA_LIT_SIZE << (lc + lp));
-	p = (uint16_t *) large_malloc(num_probs * sizeof(*p));
+	if (probs) {
+		p = probs;
+		if (num_probs * sizeof(*p) > probs_size) {
+			error("lc + lp too large");
+			goto exit_2;
+		}
+	} else
+		p = (uint16_t *) large_malloc(num_probs * sizeof(*p));
 	if (p == 0)
 		goto exit_2;
 	num_probs = LZMA_LITERAL + (LZMA_LIT_SIZE << (lc + lp));
@@ -635,6 +663,11 @@ STATIC inline int INIT unlzma(unsigned char *buf, int in_len,
 			if (cst.rep0 == 0)
 				break;
 		}
+		if (wr.corrupt || rc.eof) {
+			if (wr.corrupt)
+				error("lzma data corruption");
+			goto exit_3;
+		}
 	}
 
 	if (posp)
@@ -642,7 +675,9 @@ STATIC inline int INIT unlzma(unsigned char *buf, int in_len,
 	if (wr.flush)
 		wr.flush(wr.buffer, wr.buffer_pos);
 	ret = 0;
-	large_free(p);
+exit_3:
+	if (!probs)
+		large_free(p);
 exit_2:
 	if (!output)
 		large_free(wr.buffer);
@@ -653,6 +688,18 @@ exit_0:
 	return ret;
 }
 
+STATIC inline int INIT unlzma(unsigned char *buf, int in_len,
+			      int(*fill)(void*, unsigned int),
+			      int(*flush)(void*, unsigned int),
+			      unsigned char *output,
+			      int *posp,
+			      void(*error_fn)(char *x)
+	)
+{
+	return __unlzma(buf, in_len, fill, flush, output, posp, error_fn,
+			NULL, 0);
+}
+
 #ifdef PREBOOT
 STATIC int INIT decompress(unsigned char *buf, int in_len,
 			      int(*fill)(void*, unsigned int),
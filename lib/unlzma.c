@@ -0,0 +1,38 @@
+/*
+ * unlzma() for use after boot
+ *
+ * lib/decompress_unlzma.c is built for the initramfs and boot image
+ * decompression code, so all of it is __init.  This builds it once more
+ * without that, for users such as squashfs which decompress lzma data
+ * at run time.  It is the same one-shot interface: the whole input and
+ * an output buffer large enough for the uncompressed size stored in the
+ * lzma header.  unlzma_probs() also takes the probability table, so that
+ * callers decoding many small streams don't vmalloc() one every time.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+
+#define INIT
+
+#include "decompress_unlzma.c"
+
+int unlzma_probs(unsigned char *buf, int in_len, unsigned char *output,
+		 int *posp, void(*error_fn)(char *x), void *probs,
+		 int probs_size)
+{
+	BUILD_BUG_ON(LZMA_PROBS_SIZE(0) !=
+		     (LZMA_BASE_SIZE + LZMA_LIT_SIZE) * sizeof(uint16_t));
+	return __unlzma(buf, in_len, NULL, NULL, output, posp, error_fn,
+			probs, probs_size);
+}
+
+EXPORT_SYMBOL(unlzma);
+EXPORT_SYMBOL(unlzma_probs);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZMA decompressor");
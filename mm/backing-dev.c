@@ -10,6 +10,7 @@
 #include <linux/module.h>
 #include <linux/writeback.h>
 #include <linux/device.h>
+#include <linux/log2.h>
 
 static atomic_long_t bdi_seq = ATOMIC_LONG_INIT(0);
 
@@ -220,12 +221,33 @@ static ssize_t max_ratio_store(struct device *dev,
 }
 BDI_SHOW(max_ratio, bdi->max_ratio)
 
+static ssize_t fault_around_kb_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct backing_dev_info *bdi = dev_get_drvdata(dev);
+	char *end;
+	unsigned long pages;
+	ssize_t ret = -EINVAL;
+
+	pages = simple_strtoul(buf, &end, 10) >> (PAGE_SHIFT - 10);
+	if (*buf && (end[0] == '\0' || (end[0] == '\n' && end[1] == '\0'))) {
+		/* the window is naturally aligned, so a power of two */
+		pages = min_t(unsigned long, pages, FAULT_AROUND_MAX_PAGES);
+		bdi->fault_around_pages =
+			pages > 1 ? rounddown_pow_of_two(pages) : 0;
+		ret = count;
+	}
+	return ret;
+}
+BDI_SHOW(fault_around_kb, K(bdi->fault_around_pages))
+
 #define __ATTR_RW(attr) __ATTR(attr, 0644, attr##_show, attr##_store)
 
 static struct device_attribute bdi_dev_attrs[] = {
 	__ATTR_RW(read_ahead_kb),
 	__ATTR_RW(min_ratio),
 	__ATTR_RW(max_ratio),
+	__ATTR_RW(fault_around_kb),
 	__ATTR_NULL,
 };
 
@@ -666,6 +688,7 @@ int bdi_init(struct backing_dev_info *bdi)
 	bdi->min_ratio = 0;
 	bdi->max_ratio = 100;
 	bdi->max_prop_frac = PROP_FRAC_BASE;
+	bdi->fault_around_pages = 0;
 	spin_lock_init(&bdi->wb_lock);
 	INIT_RCU_HEAD(&bdi->rcu_head);
 	INIT_LIST_HEAD(&bdi->bdi_list);
@@ -24,6 +24,7 @@
 #include <linux/rmap.h>
 #include <linux/spinlock.h>
 #include <linux/jhash.h>
+#include <linux/math64.h>
 #include <linux/delay.h>
 #include <linux/kthread.h>
 #include <linux/wait.h>
@@ -83,12 +84,22 @@
  * @mm_list: link into the mm_slots list, rooted in ksm_mm_head
  * @rmap_list: head for this mm_slot's singly-linked list of rmap_items
  * @mm: the mm that this information is valid for
+ * @pages_scanned: pages looked at in the current scan of this mm
+ * @pages_merged: pages merged in the current scan of this mm
+ * @yield: running average of merged per scanned pages, in KSM_YIELD_SCALE
+ * @idle_scans: consecutive full scans that found yield below KSM_YIELD_LOW
+ * @skip_scans: number of coming full scans that will skip this mm
  */
 struct mm_slot {
 	struct hlist_node link;
 	struct list_head mm_list;
 	struct rmap_item *rmap_list;
 	struct mm_struct *mm;
+	unsigned long pages_scanned;
+	unsigned long pages_merged;
+	unsigned int yield;
+	unsigned int idle_scans;
+	unsigned int skip_scans;
 };
 
 /**
@@ -126,6 +137,9 @@ struct stable_node {
  * @mm: the memory structure this rmap_item is pointing into
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
  * @oldchecksum: previous checksum of the page at that virtual address
+ * @oldsample: previous checksum of a sample of that page
+ * @age: number of scans that found the page unchanged but unmerged
+ * @skips: number of coming scans that will skip the page
  * @node: rb node of this rmap_item in the unstable tree
  * @head: pointer to stable_node heading this list in the stable tree
  * @hlist: link into hlist of rmap_items hanging off that stable_node
@@ -136,6 +150,9 @@ struct rmap_item {
 	struct mm_struct *mm;
 	unsigned long address;		/* + low bits used for flags below */
 	unsigned int oldchecksum;	/* when unstable */
+	unsigned int oldsample;
+	unsigned char age;
+	unsigned char skips;
 	union {
 		struct rb_node node;	/* when node of unstable tree */
 		struct {		/* when listed from stable tree */
@@ -185,6 +202,35 @@ static unsigned int ksm_thread_pages_to_scan = 100;
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/*
+ * With ksm_auto_tune, ksmd scans ksm_scan_batch pages per batch instead of
+ * pages_to_scan: the batch doubles, up to pages_to_scan, after a batch that
+ * merged something and shrinks by a quarter, down to KSM_MIN_SCAN_BATCH,
+ * after one that merged nothing.
+ */
+static unsigned int ksm_auto_tune = 1;
+static unsigned int ksm_scan_batch = 100;
+#define KSM_MIN_SCAN_BATCH	16
+
+/*
+ * Each mm keeps a running average of the share of its pages merged per
+ * full scan.  An mm below KSM_YIELD_LOW is left out of 1, 2, 4 and then
+ * up to KSM_MAX_SKIP_SCANS full scans between the ones that look at it.
+ * Pages are backed off the same way once they were seen unchanged but
+ * unmerged KSM_PAGE_AGE_SKIP times.
+ */
+#define KSM_YIELD_SCALE		1024
+#define KSM_YIELD_LOW		(KSM_YIELD_SCALE / 128)
+#define KSM_MAX_SKIP_SCANS	8
+#define KSM_PAGE_AGE_SKIP	2
+
+/* Cost statistics */
+static unsigned long ksm_pages_scanned;
+static unsigned long ksm_pages_skipped;
+static unsigned long ksm_pages_merged;
+static unsigned long ksm_mm_scans_skipped;
+static u64 ksm_scan_cpu_ns;
+
 #define KSM_RUN_STOP	0
 #define KSM_RUN_MERGE	1
 #define KSM_RUN_UNMERGE	2
@@ -695,6 +741,33 @@ static u32 calc_checksum(struct page *page)
 	return checksum;
 }
 
+/*
+ * Checksum of KSM_SAMPLE_CHUNKS runs of KSM_SAMPLE_WORDS words spread over
+ * the page, a sixteenth of it in all.  A page that is being written to
+ * nearly always changes in the sample too, so most volatile pages are told
+ * apart without reading all of them; calc_checksum() catches the rest.
+ */
+#define KSM_SAMPLE_CHUNKS	16
+#define KSM_SAMPLE_WORDS	(PAGE_SIZE / 4 / KSM_SAMPLE_CHUNKS / 16)
+#define KSM_SAMPLE_STRIDE	(PAGE_SIZE / 4 / KSM_SAMPLE_CHUNKS)
+
+static u32 calc_sample_checksum(struct page *page)
+{
+	u32 *addr = kmap_atomic(page, KM_USER0);
+	u32 checksum = 17;
+	int i;
+
+	for (i = 0; i < KSM_SAMPLE_CHUNKS; i++) {
+		/* vary the offset so as not to sample only aligned fields */
+		unsigned int offset = i * KSM_SAMPLE_STRIDE + (i * 7) %
+				(KSM_SAMPLE_STRIDE - KSM_SAMPLE_WORDS + 1);
+
+		checksum = jhash2(addr + offset, KSM_SAMPLE_WORDS, checksum);
+	}
+	kunmap_atomic(addr, KM_USER0);
+	return checksum;
+}
+
 static int memcmp_pages(struct page *page1, struct page *page2)
 {
 	char *addr1, *addr2;
@@ -1139,8 +1212,22 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 		ksm_pages_shared++;
 }
 
+static void ksm_note_merged(struct rmap_item *rmap_item, unsigned int nr)
+{
+	rmap_item->age = 0;
+	ksm_pages_merged += nr;
+	ksm_scan.mm_slot->pages_merged += nr;
+}
+
+static void ksm_note_unmerged(struct rmap_item *rmap_item)
+{
+	if (rmap_item->age < 255)
+		rmap_item->age++;
+}
+
 /*
- * cmp_and_merge_page - first see if page can be merged into the stable tree;
+ * cmp_and_merge_page - skip the page if its sample checksum changed since the
+ * last scan; else see if page can be merged into the stable tree;
  * if not, compare checksum to previous and if it's the same, see if page can
  * be inserted into the unstable tree, or merged with a page already there and
  * both transferred to the stable tree.
@@ -1155,10 +1242,25 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	struct stable_node *stable_node;
 	struct page *kpage;
 	unsigned int checksum;
+	unsigned int sample;
 	int err;
 
 	remove_rmap_item_from_tree(rmap_item);
 
+	/*
+	 * A page that changed since the last scan is likely to change again
+	 * soon, and merging it would only be undone by the next write fault:
+	 * note its sample and don't search either tree for it this time.
+	 * Its full checksum is then unknown until it settles down.
+	 */
+	sample = calc_sample_checksum(page);
+	if (rmap_item->oldsample != sample) {
+		rmap_item->oldsample = sample;
+		rmap_item->oldchecksum = 0;
+		rmap_item->age = 0;
+		return;
+	}
+
 	/* We first start with searching the page inside the stable tree */
 	kpage = stable_tree_search(page);
 	if (kpage) {
@@ -1171,7 +1273,9 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			lock_page(kpage);
 			stable_tree_append(rmap_item, page_stable_node(kpage));
 			unlock_page(kpage);
-		}
+			ksm_note_merged(rmap_item, 1);
+		} else
+			ksm_note_unmerged(rmap_item);
 		put_page(kpage);
 		return;
 	}
@@ -1181,11 +1285,17 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	 * we calculated it, this page is changing frequently: therefore we
 	 * don't want to insert it in the unstable tree, and we don't want
 	 * to waste our time searching for something identical to it there.
+	 * The sample was unchanged, so if the full checksum is not known
+	 * yet this is the first scan that found the page settled.
 	 */
 	checksum = calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
+		if (rmap_item->oldchecksum) {
+			rmap_item->oldchecksum = checksum;
+			rmap_item->age = 0;
+			return;
+		}
 		rmap_item->oldchecksum = checksum;
-		return;
 	}
 
 	tree_rmap_item =
@@ -1207,6 +1317,7 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			if (stable_node) {
 				stable_tree_append(tree_rmap_item, stable_node);
 				stable_tree_append(rmap_item, stable_node);
+				ksm_note_merged(rmap_item, 2);
 			}
 			unlock_page(kpage);
 
@@ -1220,8 +1331,10 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 				break_cow(tree_rmap_item);
 				break_cow(rmap_item);
 			}
+			return;
 		}
 	}
+	ksm_note_unmerged(rmap_item);
 }
 
 static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
@@ -1252,6 +1365,80 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
+/*
+ * Back off from a page that was found unchanged but unmerged in
+ * KSM_PAGE_AGE_SKIP scans: after each scan that looks at it, skip one more
+ * scan than the time before, up to KSM_MAX_SKIP_SCANS, until it changes or
+ * gets merged.
+ */
+static bool ksm_skip_rmap_item(struct page *page, struct rmap_item *rmap_item)
+{
+	if (PageKsm(page) || (rmap_item->address & STABLE_FLAG) ||
+	    rmap_item->age < KSM_PAGE_AGE_SKIP)
+		return false;
+
+	if (!rmap_item->skips) {
+		rmap_item->skips = min(rmap_item->age - KSM_PAGE_AGE_SKIP + 1,
+				       KSM_MAX_SKIP_SCANS);
+		return false;
+	}
+
+	rmap_item->skips--;
+	/* Its unstable tree node, if any, went with the previous scan */
+	remove_rmap_item_from_tree(rmap_item);
+	ksm_pages_skipped++;
+	return true;
+}
+
+/*
+ * Leave an mm with a low merge yield out of this full scan if it is not
+ * due yet.  Its rmap_items are taken out of the unstable tree of the
+ * previous scan, as cmp_and_merge_page would have done.
+ */
+static bool ksm_skip_mm_slot(struct mm_slot *slot)
+{
+	struct rmap_item *rmap_item;
+
+	if (!slot->skip_scans || ksm_test_exit(slot->mm))
+		return false;
+
+	slot->skip_scans--;
+	for (rmap_item = slot->rmap_list; rmap_item;
+	     rmap_item = rmap_item->rmap_list) {
+		if (rmap_item->address & UNSTABLE_FLAG)
+			remove_rmap_item_from_tree(rmap_item);
+	}
+	ksm_mm_scans_skipped++;
+	return true;
+}
+
+/*
+ * Called when a full scan is done with an mm: fold the share of its pages
+ * merged in this scan into its yield and decide how many of the following
+ * full scans may skip it.
+ */
+static void ksm_update_yield(struct mm_slot *slot)
+{
+	unsigned int yield = 0;
+
+	if (slot->pages_scanned)
+		yield = min(slot->pages_merged * KSM_YIELD_SCALE /
+			    slot->pages_scanned, (unsigned long)KSM_YIELD_SCALE);
+	slot->yield = (slot->yield + yield) / 2;
+	slot->pages_scanned = 0;
+	slot->pages_merged = 0;
+
+	if (slot->yield >= KSM_YIELD_LOW) {
+		slot->idle_scans = 0;
+		return;
+	}
+
+	slot->skip_scans = min_t(unsigned int, 1U << slot->idle_scans,
+				 KSM_MAX_SKIP_SCANS);
+	if (slot->skip_scans < KSM_MAX_SKIP_SCANS)
+		slot->idle_scans++;
+}
+
 static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 {
 	struct mm_struct *mm;
@@ -1273,6 +1460,14 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 next_mm:
 		ksm_scan.address = 0;
 		ksm_scan.rmap_list = &slot->rmap_list;
+
+		if (ksm_skip_mm_slot(slot)) {
+			spin_lock(&ksm_mmlist_lock);
+			ksm_scan.mm_slot = list_entry(slot->mm_list.next,
+						struct mm_slot, mm_list);
+			spin_unlock(&ksm_mmlist_lock);
+			goto next_slot;
+		}
 	}
 
 	mm = slot->mm;
@@ -1303,6 +1498,13 @@ next_mm:
 					ksm_scan.rmap_list =
 							&rmap_item->rmap_list;
 					ksm_scan.address += PAGE_SIZE;
+					slot->pages_scanned++;
+					ksm_pages_scanned++;
+					if (ksm_skip_rmap_item(*page, rmap_item)) {
+						put_page(*page);
+						cond_resched();
+						continue;
+					}
 				} else
 					put_page(*page);
 				up_read(&mm->mmap_sem);
@@ -1324,6 +1526,7 @@ next_mm:
 	 * because there were no VM_MERGEABLE vmas with such addresses.
 	 */
 	remove_trailing_rmap_items(slot, ksm_scan.rmap_list);
+	ksm_update_yield(slot);
 
 	spin_lock(&ksm_mmlist_lock);
 	ksm_scan.mm_slot = list_entry(slot->mm_list.next,
@@ -1351,6 +1554,7 @@ next_mm:
 		up_read(&mm->mmap_sem);
 	}
 
+next_slot:
 	/* Repeat until we've completed scanning the whole list */
 	slot = ksm_scan.mm_slot;
 	if (slot != &ksm_mm_head)
@@ -1360,6 +1564,18 @@ next_mm:
 	return NULL;
 }
 
+static void ksm_tune_scan_batch(bool merged)
+{
+	unsigned long batch = ksm_scan_batch;
+
+	if (merged)
+		batch *= 2;
+	else
+		batch -= batch / 4;
+	batch = max_t(unsigned long, batch, KSM_MIN_SCAN_BATCH);
+	ksm_scan_batch = min_t(unsigned long, batch, ksm_thread_pages_to_scan);
+}
+
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
  * @scan_npages - number of pages we want to scan before we return.
@@ -1368,16 +1584,21 @@ static void ksm_do_scan(unsigned int scan_npages)
 {
 	struct rmap_item *rmap_item;
 	struct page *uninitialized_var(page);
+	unsigned long merged = ksm_pages_merged;
+	u64 start = task_sched_runtime(current);
 
 	while (scan_npages--) {
 		cond_resched();
 		rmap_item = scan_get_next_rmap_item(&page);
 		if (!rmap_item)
-			return;
+			break;
 		if (!PageKsm(page) || !in_stable_tree(rmap_item))
 			cmp_and_merge_page(page, rmap_item);
 		put_page(page);
 	}
+
+	ksm_scan_cpu_ns += task_sched_runtime(current) - start;
+	ksm_tune_scan_batch(ksm_pages_merged != merged);
 }
 
 static int ksmd_should_run(void)
@@ -1392,7 +1613,8 @@ static int ksm_scan_thread(void *nothing)
 	while (!kthread_should_stop()) {
 		mutex_lock(&ksm_thread_mutex);
 		if (ksmd_should_run())
-			ksm_do_scan(ksm_thread_pages_to_scan);
+			ksm_do_scan(ksm_auto_tune ? ksm_scan_batch :
+				    ksm_thread_pages_to_scan);
 		mutex_unlock(&ksm_thread_mutex);
 
 		if (ksmd_should_run()) {
@@ -1463,6 +1685,8 @@ int __ksm_enter(struct mm_struct *mm)
 
 	spin_lock(&ksm_mmlist_lock);
 	insert_to_mm_slots_hash(mm, mm_slot);
+	/* Give a new mm a few full scans before judging its yield */
+	mm_slot->yield = KSM_YIELD_SCALE;
 	/*
 	 * Insert just behind the scanning cursor, to let the area settle
 	 * down a little; when fork is followed by immediate exec, we don't
@@ -1821,6 +2045,37 @@ static ssize_t pages_to_scan_store(struct kobject *kobj,
 }
 KSM_ATTR(pages_to_scan);
 
+static ssize_t auto_tune_show(struct kobject *kobj,
+			      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_auto_tune);
+}
+
+static ssize_t auto_tune_store(struct kobject *kobj,
+			       struct kobj_attribute *attr,
+			       const char *buf, size_t count)
+{
+	int err;
+	unsigned long enable;
+
+	err = strict_strtoul(buf, 10, &enable);
+	if (err || enable > 1)
+		return -EINVAL;
+
+	ksm_auto_tune = enable;
+
+	return count;
+}
+KSM_ATTR(auto_tune);
+
+static ssize_t scan_batch_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_auto_tune ? ksm_scan_batch :
+						   ksm_thread_pages_to_scan);
+}
+KSM_ATTR_RO(scan_batch);
+
 static ssize_t run_show(struct kobject *kobj, struct kobj_attribute *attr,
 			char *buf)
 {
@@ -1913,6 +2168,55 @@ static ssize_t full_scans_show(struct kobject *kobj,
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t pages_scanned_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_scanned);
+}
+KSM_ATTR_RO(pages_scanned);
+
+static ssize_t pages_skipped_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_skipped);
+}
+KSM_ATTR_RO(pages_skipped);
+
+static ssize_t pages_merged_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_merged);
+}
+KSM_ATTR_RO(pages_merged);
+
+static ssize_t mm_scans_skipped_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_mm_scans_skipped);
+}
+KSM_ATTR_RO(mm_scans_skipped);
+
+static ssize_t scan_cpu_msecs_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%llu\n",
+		       (unsigned long long)div_u64(ksm_scan_cpu_ns,
+						   NSEC_PER_MSEC));
+}
+KSM_ATTR_RO(scan_cpu_msecs);
+
+static ssize_t cpu_usecs_per_merge_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	unsigned long merged = ksm_pages_merged;
+	u64 usecs = 0;
+
+	if (merged)
+		usecs = div64_u64(ksm_scan_cpu_ns, (u64)merged * NSEC_PER_USEC);
+	return sprintf(buf, "%llu\n", (unsigned long long)usecs);
+}
+KSM_ATTR_RO(cpu_usecs_per_merge);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
@@ -1922,6 +2226,14 @@ static struct attribute *ksm_attrs[] = {
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
 	&full_scans_attr.attr,
+	&auto_tune_attr.attr,
+	&scan_batch_attr.attr,
+	&pages_scanned_attr.attr,
+	&pages_skipped_attr.attr,
+	&pages_merged_attr.attr,
+	&mm_scans_skipped_attr.attr,
+	&scan_cpu_msecs_attr.attr,
+	&cpu_usecs_per_merge_attr.attr,
 	NULL,
 };
 
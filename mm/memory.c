@@ -57,6 +57,7 @@
 #include <linux/swapops.h>
 #include <linux/elf.h>
 #include <linux/gfp.h>
+#include <linux/backing-dev.h>
 
 #include <asm/io.h>
 #include <asm/pgalloc.h>
@@ -2892,6 +2893,87 @@ oom:
 	return VM_FAULT_OOM;
 }
 
+/*
+ * Fault-around: a read fault on a file mapping also maps the neighbours
+ * of the faulting page that are already uptodate in the page cache, so
+ * a program walking through its text takes one fault per window instead
+ * of one per page.  The window is fault_around_kb of the backing device
+ * (off by default), naturally aligned and clipped to the vma and to the
+ * page table.  Nothing is read in and nothing is waited for: pages that
+ * are missing, not uptodate or locked are left to their own faults, as
+ * are PageReadahead pages, whose fault starts the next async readahead.
+ */
+static unsigned int fault_around_pages(struct vm_area_struct *vma)
+{
+	if (!vma->vm_file || vma->vm_ops->fault != filemap_fault)
+		return 0;
+	if (vma->vm_flags & (VM_NONLINEAR | VM_LOCKED | VM_RAND_READ))
+		return 0;
+	return vma->vm_file->f_mapping->backing_dev_info->fault_around_pages;
+}
+
+/*
+ * Called with the page table lock held and the pte of the faulting page
+ * (@address, @pgoff) at @page_table already set up.
+ */
+static void do_fault_around(struct mm_struct *mm, struct vm_area_struct *vma,
+		unsigned long address, pte_t *page_table, pgoff_t pgoff,
+		unsigned int nr_pages)
+{
+	struct address_space *mapping = vma->vm_file->f_mapping;
+	struct page *pages[FAULT_AROUND_MAX_PAGES];
+	unsigned long start, end, addr;
+	pgoff_t start_pgoff, end_pgoff, size;
+	unsigned int i, nr, mapped = 0;
+
+	address &= PAGE_MASK;
+	start = address & ~((unsigned long)nr_pages * PAGE_SIZE - 1);
+	end = min(start + nr_pages * PAGE_SIZE - 1,
+		  pmd_addr_end(address, vma->vm_end) - 1) + 1;
+	start = max(max(start, address & PMD_MASK), vma->vm_start);
+	start_pgoff = pgoff - ((address - start) >> PAGE_SHIFT);
+	end_pgoff = pgoff + ((end - address) >> PAGE_SHIFT);
+
+	nr = find_get_pages(mapping, start_pgoff, end_pgoff - start_pgoff,
+			    pages);
+	for (i = 0; i < nr; i++) {
+		struct page *page = pages[i];
+		pte_t *pte;
+
+		if (page->index >= end_pgoff || page->index == pgoff)
+			goto skip;
+		addr = start + ((page->index - start_pgoff) << PAGE_SHIFT);
+		pte = page_table + ((long)(addr - address) >> PAGE_SHIFT);
+		if (!pte_none(*pte))
+			goto skip;
+		if (!PageUptodate(page) || PageReadahead(page) ||
+		    PageHWPoison(page) || !trylock_page(page))
+			goto skip;
+
+		/* Recheck against truncation, as filemap_fault() does */
+		size = (i_size_read(mapping->host) + PAGE_CACHE_SIZE - 1) >>
+				PAGE_CACHE_SHIFT;
+		if (page->mapping != mapping || page->index >= size) {
+			unlock_page(page);
+			goto skip;
+		}
+
+		/* The page cache reference is the one the pte keeps */
+		flush_icache_page(vma, page);
+		inc_mm_counter_fast(mm, MM_FILEPAGES);
+		page_add_file_rmap(page);
+		set_pte_at(mm, addr, pte, mk_pte(page, vma->vm_page_prot));
+		update_mmu_cache(vma, addr, pte);
+		unlock_page(page);
+		mapped++;
+		continue;
+skip:
+		page_cache_release(page);
+	}
+
+	count_vm_events(PGFAULT_AROUND, mapped);
+}
+
 /*
  * __do_fault() tries to create a new page mapping. It aggressively
  * tries to share with existing pages, but makes a separate copy if
@@ -3040,6 +3122,14 @@ static int __do_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 
 		/* no need to invalidate: a not-present page won't be cached */
 		update_mmu_cache(vma, address, page_table);
+
+		if (!anon && !(flags & FAULT_FLAG_WRITE)) {
+			unsigned int nr_pages = fault_around_pages(vma);
+
+			if (nr_pages > 1)
+				do_fault_around(mm, vma, address, page_table,
+						pgoff, nr_pages);
+		}
 	} else {
 		if (charged)
 			mem_cgroup_uncharge_page(page);
@@ -0,0 +1,57 @@
+/*
+ * Self-test for high-order pages on the per-cpu free lists
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/page-flags.h>
+
+#define PCP_TEST_ORDER	2
+#define PCP_TEST_PAGES	64
+#define PCP_TEST_LOOPS	16
+
+/*
+ * Frees batches of compound and plain order-2 pages in turn, so that
+ * each batch is mostly served from pages the previous one left on the
+ * pcp lists.  A page that comes back with stale compound state trips
+ * check_new_page(), which taints the kernel with TAINT_BAD_PAGE.
+ */
+static __init int test_pcp_highorder(void)
+{
+	static struct page *pages[PCP_TEST_PAGES] __initdata;
+	int bad = test_taint(TAINT_BAD_PAGE);
+	int loop, i, j;
+
+	for (loop = 0; loop < PCP_TEST_LOOPS; loop++) {
+		gfp_t gfp = GFP_KERNEL | ((loop & 1) ? 0 : __GFP_COMP);
+
+		for (i = 0; i < PCP_TEST_PAGES; i++) {
+			struct page *page;
+
+			page = alloc_pages(gfp, PCP_TEST_ORDER);
+			pages[i] = page;
+			if (!page)
+				continue;
+
+			BUG_ON(!!PageCompound(page) != !!(gfp & __GFP_COMP));
+			for (j = 1; j < 1 << PCP_TEST_ORDER; j++)
+				BUG_ON(!!PageTail(page + j) !=
+				       !!(gfp & __GFP_COMP));
+		}
+		for (i = 0; i < PCP_TEST_PAGES; i++)
+			if (pages[i])
+				__free_pages(pages[i], PCP_TEST_ORDER);
+	}
+
+	BUG_ON(!bad && test_taint(TAINT_BAD_PAGE));
+	printk(KERN_INFO "pcp high-order page test passed\n");
+
+	return 0;
+}
+
+late_initcall(test_pcp_highorder);
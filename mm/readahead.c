@@ -18,6 +18,9 @@
 #include <linux/pagevec.h>
 #include <linux/pagemap.h>
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/readahead.h>
+
 /*
  * Initialise a struct file's readahead state.  Assumes that the caller has
  * memset *ra to zero.
@@ -291,6 +294,115 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
 	return min(newsize, max);
 }
 
+/*
+ * The window limit, lowered when readahead pages get evicted before
+ * they are used and raised back as windows get used.
+ */
+static unsigned long ra_max_pages(struct file_ra_state *ra)
+{
+	unsigned long max = ra->ra_pages;
+
+	if (ra->size_limit && ra->size_limit < max)
+		max = ra->size_limit;
+
+	return max_sane_readahead(max);
+}
+
+/* Smallest window the limit may shrink to */
+#define MIN_RA_LIMIT	4UL
+
+/*
+ * The application reached the next readahead window, so the pages of
+ * the current one were there when needed.
+ */
+static void ra_window_used(struct file_ra_state *ra, unsigned long pages)
+{
+	ra->hit_pages += pages;
+
+	if (ra->size_limit) {
+		ra->size_limit += ra->size_limit / 4 + 1;
+		if (ra->size_limit >= ra->ra_pages)
+			ra->size_limit = 0;
+	}
+}
+
+/*
+ * A page inside the current readahead window is missing: it was read
+ * ahead and reclaimed before the application got to it, together with
+ * (likely) the rest of the window. Halve the window limit.
+ */
+static void ra_window_thrashed(struct address_space *mapping,
+			       struct file_ra_state *ra, pgoff_t offset)
+{
+	unsigned long lost = ra->start + ra->size - offset;
+	unsigned long limit = ra->size_limit ? ra->size_limit : ra->ra_pages;
+
+	ra->miss_pages += lost;
+	ra->size_limit = max(min(limit, (unsigned long)ra->size) / 2,
+			     MIN_RA_LIMIT);
+
+	trace_readahead_thrash(mapping, ra, offset, lost);
+}
+
+/* Number of reads of a strided stream to submit at once */
+static unsigned long stride_batch(struct file_ra_state *ra,
+				  unsigned long req_size, unsigned long max)
+{
+	return min(1UL << min(ra->stride_count, 16U), max / req_size);
+}
+
+/*
+ * Strided and backward streams: a read that misses at the same
+ * distance from the previous miss as that one from its predecessor
+ * starts a stream of reads of req_size pages, spaced ra->stride apart.
+ * The next reads of the stream are read ahead at once, twice as many
+ * every time the stream misses at the predicted place again.
+ *
+ * ra->prev_index is set to the last read ahead, so the next miss is
+ * again one stride away. Returns the number of pages submitted, or
+ * -1 if the read does not continue a stream.
+ */
+static long try_stride_readahead(struct address_space *mapping,
+				 struct file_ra_state *ra, struct file *filp,
+				 pgoff_t offset, unsigned long req_size,
+				 unsigned long max)
+{
+	long stride = offset - ra->prev_index;
+	unsigned long nr, i, step;
+	long actual = 0;
+
+	step = stride < 0 ? -stride : stride;
+	if (!stride || stride != ra->stride || step < req_size ||
+	    req_size > max) {
+		ra->stride = stride;
+		ra->stride_count = 0;
+		ra->prev_index = offset;
+		return -1;
+	}
+
+	/* The reads read ahead last time all got used */
+	if (ra->stride_count)
+		ra->hit_pages += (stride_batch(ra, req_size, max) - 1) *
+				 req_size;
+	ra->stride_count++;
+
+	nr = stride_batch(ra, req_size, max);
+	for (i = 0; i < nr; i++) {
+		if (stride < 0 && i * step > offset)
+			break;
+		actual += __do_page_cache_readahead(mapping, filp,
+					offset + i * stride, req_size, 0);
+	}
+	ra->prev_index = offset + (i - 1) * stride;
+
+	/* Not a sequential window */
+	ra->start = offset;
+	ra->size = 0;
+	ra->async_size = 0;
+
+	return actual;
+}
+
 /*
  * On-demand readahead design.
  *
@@ -384,7 +496,8 @@ static int try_context_readahead(struct address_space *mapping,
 }
 
 /*
- * A minimal readahead algorithm for trivial sequential/random reads.
+ * A readahead algorithm for sequential, strided, backward and random
+ * reads.
  */
 static unsigned long
 ondemand_readahead(struct address_space *mapping,
@@ -392,7 +505,19 @@ ondemand_readahead(struct address_space *mapping,
 		   bool hit_readahead_marker, pgoff_t offset,
 		   unsigned long req_size)
 {
-	unsigned long max = max_sane_readahead(ra->ra_pages);
+	unsigned long max;
+	unsigned long actual;
+	long stride_actual;
+	int pattern;
+
+	/*
+	 * A cache miss inside the readahead window: its pages were
+	 * evicted before being used.
+	 */
+	if (!hit_readahead_marker && ra_has_index(ra, offset))
+		ra_window_thrashed(mapping, ra, offset);
+
+	max = ra_max_pages(ra);
 
 	/*
 	 * start of file
@@ -406,9 +531,12 @@ ondemand_readahead(struct address_space *mapping,
 	 */
 	if ((offset == (ra->start + ra->size - ra->async_size) ||
 	     offset == (ra->start + ra->size))) {
+		ra_window_used(ra, ra->size);
+		max = ra_max_pages(ra);
 		ra->start += ra->size;
 		ra->size = get_next_ra_size(ra, max);
 		ra->async_size = ra->size;
+		pattern = RA_PATTERN_SEQUENTIAL;
 		goto readit;
 	}
 
@@ -433,6 +561,7 @@ ondemand_readahead(struct address_space *mapping,
 		ra->size += req_size;
 		ra->size = get_next_ra_size(ra, max);
 		ra->async_size = ra->size;
+		pattern = RA_PATTERN_MARKER;
 		goto readit;
 	}
 
@@ -448,23 +577,41 @@ ondemand_readahead(struct address_space *mapping,
 	if (offset - (ra->prev_pos >> PAGE_CACHE_SHIFT) <= 1UL)
 		goto initial_readahead;
 
+	/*
+	 * Equally spaced reads, forward or backward
+	 */
+	stride_actual = try_stride_readahead(mapping, ra, filp, offset,
+					     req_size, max);
+	if (stride_actual >= 0) {
+		trace_readahead(mapping, ra, offset, req_size,
+				ra->stride < 0 ? RA_PATTERN_BACKWARD :
+				RA_PATTERN_STRIDE, stride_actual);
+		return stride_actual;
+	}
+
 	/*
 	 * Query the page cache and look for the traces(cached history pages)
 	 * that a sequential stream would leave behind.
 	 */
-	if (try_context_readahead(mapping, ra, offset, req_size, max))
+	if (try_context_readahead(mapping, ra, offset, req_size, max)) {
+		pattern = RA_PATTERN_CONTEXT;
 		goto readit;
+	}
 
 	/*
 	 * standalone, small random read
 	 * Read as is, and do not pollute the readahead state.
 	 */
-	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
+	actual = __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
+	trace_readahead(mapping, ra, offset, req_size, RA_PATTERN_RANDOM,
+			actual);
+	return actual;
 
 initial_readahead:
 	ra->start = offset;
 	ra->size = get_init_ra_size(req_size, max);
 	ra->async_size = ra->size > req_size ? ra->size - req_size : ra->size;
+	pattern = RA_PATTERN_INITIAL;
 
 readit:
 	/*
@@ -477,7 +624,9 @@ readit:
 		ra->size += ra->async_size;
 	}
 
-	return ra_submit(ra, mapping, filp);
+	actual = ra_submit(ra, mapping, filp);
+	trace_readahead(mapping, ra, offset, req_size, pattern, actual);
+	return actual;
 }
 
 /**
@@ -1483,6 +1483,23 @@ static inline void flush_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 	deactivate_slab(s, c);
 }
 
+static void __slab_free(struct kmem_cache *s, struct page *page,
+			void *x, unsigned long addr);
+
+/*
+ * Return the objects parked in the magazine to their slabs.
+ */
+static void flush_magazine(struct kmem_cache *s, struct kmem_cache_cpu *c)
+{
+	void *object;
+
+	while (c->mag_count) {
+		object = c->mag[--c->mag_count];
+		stat(s, MAGAZINE_FLUSH);
+		__slab_free(s, virt_to_head_page(object), object, _RET_IP_);
+	}
+}
+
 /*
  * Flush cpu slab.
  *
@@ -1492,7 +1509,12 @@ static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu)
 {
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
 
-	if (likely(c && c->page))
+	if (unlikely(!c))
+		return;
+
+	if (c->mag_count)
+		flush_magazine(s, c);
+	if (likely(c->page))
 		flush_slab(s, c);
 }
 
@@ -1879,6 +1901,131 @@ void kmem_cache_free(struct kmem_cache *s, void *x)
 }
 EXPORT_SYMBOL(kmem_cache_free);
 
+static void slab_post_alloc_bulk(struct kmem_cache *s, gfp_t flags,
+				 size_t nr, void **p)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++) {
+		if (unlikely(flags & __GFP_ZERO))
+			memset(p[i], 0, s->objsize);
+
+		kmemcheck_slab_alloc(s, flags, p[i], s->objsize);
+		kmemleak_alloc_recursive(p[i], s->objsize, 1, s->flags, flags);
+		trace_kmem_cache_alloc(_RET_IP_, p[i], s->objsize, s->size,
+				       flags);
+	}
+}
+
+/**
+ * kmem_cache_alloc_bulk - Allocate several objects at once
+ * @s: The cache to allocate from.
+ * @flags: See kmalloc().
+ * @nr: Number of objects to allocate.
+ * @p: Array receiving the objects.
+ *
+ * Takes objects from the cpu magazine first, then from the cpu slab,
+ * with interrupts disabled only once for the whole batch.  Returns @nr,
+ * or 0 if not all objects could be allocated; nothing is allocated then.
+ */
+int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t nr,
+			  void **p)
+{
+	struct kmem_cache_cpu *c;
+	unsigned long irqflags;
+	size_t i = 0;
+
+	flags &= gfp_allowed_mask;
+
+	lockdep_trace_alloc(flags);
+	might_sleep_if(flags & __GFP_WAIT);
+
+	if (should_failslab(s->objsize, flags, s->flags))
+		return 0;
+
+	local_irq_save(irqflags);
+	c = __this_cpu_ptr(s->cpu_slab);
+	while (i < nr && c->mag_count) {
+		p[i++] = c->mag[--c->mag_count];
+		stat(s, ALLOC_MAGAZINE);
+	}
+
+	for (; i < nr; i++) {
+		void **object = c->freelist;
+
+		if (unlikely(!object)) {
+			object = __slab_alloc(s, flags, -1, _RET_IP_, c);
+			if (unlikely(!object))
+				goto error;
+			/* __slab_alloc() may have enabled interrupts */
+			c = __this_cpu_ptr(s->cpu_slab);
+		} else {
+			c->freelist = get_freepointer(s, object);
+			stat(s, ALLOC_FASTPATH);
+		}
+		p[i] = object;
+	}
+	local_irq_restore(irqflags);
+
+	slab_post_alloc_bulk(s, flags, nr, p);
+	return nr;
+
+error:
+	local_irq_restore(irqflags);
+	slab_post_alloc_bulk(s, flags & ~__GFP_ZERO, i, p);
+	kmem_cache_free_bulk(s, i, p);
+	return 0;
+}
+EXPORT_SYMBOL(kmem_cache_alloc_bulk);
+
+/**
+ * kmem_cache_free_bulk - Free several objects at once
+ * @s: The cache the objects were allocated from.
+ * @nr: Number of objects to free.
+ * @p: Array of the objects.
+ *
+ * Objects of the cpu slab go to its freelist, others to the cpu magazine
+ * while it has room, and to their slab only after that.
+ */
+void kmem_cache_free_bulk(struct kmem_cache *s, size_t nr, void **p)
+{
+	struct kmem_cache_cpu *c;
+	unsigned long flags;
+	struct page *page;
+	void **object;
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		kmemleak_free_recursive(p[i], s->flags);
+
+	local_irq_save(flags);
+	c = __this_cpu_ptr(s->cpu_slab);
+	for (i = 0; i < nr; i++) {
+		object = p[i];
+		page = virt_to_head_page(object);
+
+		kmemcheck_slab_free(s, object, s->objsize);
+		debug_check_no_locks_freed(object, s->objsize);
+		if (!(s->flags & SLAB_DEBUG_OBJECTS))
+			debug_check_no_obj_freed(object, s->objsize);
+		if (page == c->page && c->node >= 0) {
+			set_freepointer(s, object, c->freelist);
+			c->freelist = object;
+			stat(s, FREE_FASTPATH);
+		} else if (c->mag_count < SLUB_MAGAZINE_SIZE &&
+			   !(SLABDEBUG && PageSlubDebug(page))) {
+			c->mag[c->mag_count++] = object;
+			stat(s, FREE_MAGAZINE);
+		} else
+			__slab_free(s, page, object, _RET_IP_);
+	}
+	local_irq_restore(flags);
+
+	for (i = 0; i < nr; i++)
+		trace_kmem_cache_free(_RET_IP_, p[i]);
+}
+EXPORT_SYMBOL(kmem_cache_free_bulk);
+
 /* Figure out on which slab page the object resides */
 static struct page *get_object_page(const void *x)
 {
@@ -4281,6 +4428,9 @@ STAT_ATTR(DEACTIVATE_TO_HEAD, deactivate_to_head);
 STAT_ATTR(DEACTIVATE_TO_TAIL, deactivate_to_tail);
 STAT_ATTR(DEACTIVATE_REMOTE_FREES, deactivate_remote_frees);
 STAT_ATTR(ORDER_FALLBACK, order_fallback);
+STAT_ATTR(ALLOC_MAGAZINE, alloc_magazine);
+STAT_ATTR(FREE_MAGAZINE, free_magazine);
+STAT_ATTR(MAGAZINE_FLUSH, magazine_flush);
 #endif
 
 static struct attribute *slab_attrs[] = {
@@ -4335,6 +4485,9 @@ static struct attribute *slab_attrs[] = {
 	&deactivate_to_tail_attr.attr,
 	&deactivate_remote_frees_attr.attr,
 	&order_fallback_attr.attr,
+	&alloc_magazine_attr.attr,
+	&free_magazine_attr.attr,
+	&magazine_flush_attr.attr,
 #endif
 #ifdef CONFIG_FAILSLAB
 	&failslab_attr.attr,
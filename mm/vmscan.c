@@ -40,6 +40,11 @@
 #include <linux/memcontrol.h>
 #include <linux/delayacct.h>
 #include <linux/sysctl.h>
+#include <linux/ktime.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/sort.h>
+#include <linux/workqueue.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -405,6 +410,118 @@ static pageout_t pageout(struct page *page, struct address_space *mapping,
 	return PAGE_CLEAN;
 }
 
+/*
+ * Direct reclaim does not write dirty file pages itself: ->writepage can
+ * block in the filesystem and on the device for a long time, and the
+ * task that only wanted a free page pays for all of it.  Instead the
+ * pages are handed to a reclaim flusher which writes them in batches,
+ * sorted by file offset.  pageout() sets PG_reclaim, so the pages are
+ * rotated to the tail of the inactive list when the write completes and
+ * the next scan frees them.  kswapd, the synchronous pass of lumpy
+ * reclaim and swap cache pages still go through pageout() directly.
+ */
+#define RECLAIM_HANDOFF_MAX	(4 * SWAP_CLUSTER_MAX)
+
+static struct {
+	spinlock_t lock;
+	unsigned int nr;
+	struct page *pages[RECLAIM_HANDOFF_MAX];
+} reclaim_handoff = {
+	.lock = __SPIN_LOCK_UNLOCKED(reclaim_handoff.lock),
+};
+
+static struct workqueue_struct *reclaim_handoff_wq;
+
+/*
+ * Queue a locked, dirty file page for the reclaim flusher.  Returns false
+ * if the queue is full, the caller then writes the page itself.
+ */
+static bool reclaim_handoff_page(struct page *page)
+{
+	bool queued = false;
+
+	if (unlikely(!reclaim_handoff_wq))
+		return false;
+
+	spin_lock(&reclaim_handoff.lock);
+	if (reclaim_handoff.nr < RECLAIM_HANDOFF_MAX) {
+		page_cache_get(page);
+		reclaim_handoff.pages[reclaim_handoff.nr++] = page;
+		queued = true;
+	}
+	spin_unlock(&reclaim_handoff.lock);
+
+	if (queued)
+		count_vm_event(PGRECLAIM_HANDOFF);
+	return queued;
+}
+
+static int reclaim_handoff_cmp(const void *a, const void *b)
+{
+	const struct page *pa = *(const struct page **)a;
+	const struct page *pb = *(const struct page **)b;
+
+	if (pa->mapping != pb->mapping)
+		return pa->mapping < pb->mapping ? -1 : 1;
+	if (pa->index != pb->index)
+		return pa->index < pb->index ? -1 : 1;
+	return 0;
+}
+
+static void reclaim_handoff_write(struct page *page)
+{
+	struct address_space *mapping;
+
+	lock_page(page);
+	/*
+	 * The page may have been truncated, cleaned, redirtied and written,
+	 * activated or queued twice while it waited.  Only write it if it
+	 * is still what reclaim saw.
+	 */
+	mapping = page->mapping;
+	if (!mapping || !PageDirty(page) || PageWriteback(page) ||
+	    PageActive(page) || PageUnevictable(page)) {
+		unlock_page(page);
+		return;
+	}
+
+	if (pageout(page, mapping, PAGEOUT_IO_ASYNC) == PAGE_SUCCESS)
+		count_vm_event(PGRECLAIM_HANDOFF_WRITE);
+	else
+		unlock_page(page);
+}
+
+static void reclaim_handoff_fn(struct work_struct *work)
+{
+	struct page *pages[SWAP_CLUSTER_MAX];
+	unsigned int i, nr;
+
+	do {
+		spin_lock(&reclaim_handoff.lock);
+		nr = min_t(unsigned int, reclaim_handoff.nr, SWAP_CLUSTER_MAX);
+		reclaim_handoff.nr -= nr;
+		memcpy(pages, reclaim_handoff.pages, nr * sizeof(pages[0]));
+		memmove(reclaim_handoff.pages, reclaim_handoff.pages + nr,
+			reclaim_handoff.nr * sizeof(pages[0]));
+		spin_unlock(&reclaim_handoff.lock);
+
+		sort(pages, nr, sizeof(pages[0]), reclaim_handoff_cmp, NULL);
+		for (i = 0; i < nr; i++) {
+			reclaim_handoff_write(pages[i]);
+			page_cache_release(pages[i]);
+		}
+		cond_resched();
+	} while (nr);
+}
+
+static DECLARE_WORK(reclaim_handoff_work, reclaim_handoff_fn);
+
+static void reclaim_handoff_kick(void)
+{
+	if (reclaim_handoff.nr)
+		queue_work(reclaim_handoff_wq, &reclaim_handoff_work);
+}
+
 /*
  * Same as remove_mapping, but if the page is removed from the mapping, it
  * gets returned with a refcount of 0.
@@ -728,6 +845,12 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			if (!sc->may_writepage)
 				goto keep_locked;
 
+			/* Leave file writeback to the reclaim flusher */
+			if (page_is_file_cache(page) && !current_is_kswapd() &&
+			    sync_writeback == PAGEOUT_IO_ASYNC &&
+			    reclaim_handoff_page(page))
+				goto keep_locked;
+
 			/* Page is dirty, try to write it out here */
 			switch (pageout(page, mapping, sync_writeback)) {
 			case PAGE_KEEP:
@@ -1111,6 +1234,29 @@ static int too_many_isolated(struct zone *zone, int file,
 	return isolated > inactive;
 }
 
+/*
+ * zone->lru_lock is taken with interrupts disabled and every CPU adding
+ * pages to the LRU contends on it.  Isolation and putback therefore hold
+ * it for at most LRU_LOCK_BATCH pages at a time, and drop it earlier if
+ * somebody is spinning on it or we should reschedule.
+ */
+#define LRU_LOCK_BATCH	SWAP_CLUSTER_MAX
+
+static void lru_lock_break(struct zone *zone, unsigned int *held,
+			   unsigned int nr)
+{
+	*held += nr;
+	if (*held <= LRU_LOCK_BATCH && !need_resched() &&
+	    !spin_is_contended(&zone->lru_lock))
+		return;
+
+	*held = 0;
+	spin_unlock_irq(&zone->lru_lock);
+	count_vm_event(LRU_LOCK_BREAK);
+	cond_resched();
+	spin_lock_irq(&zone->lru_lock);
+}
+
 /*
  * shrink_inactive_list() is a helper for shrink_zone().  It returns the number
  * of reclaimed pages
@@ -1123,6 +1269,7 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 	struct pagevec pvec;
 	unsigned long nr_scanned = 0;
 	unsigned long nr_reclaimed = 0;
+	unsigned int held = 0;
 	struct zone_reclaim_stat *reclaim_stat = get_reclaim_stat(zone, sc);
 
 	while (unlikely(too_many_isolated(zone, file, sc))) {
@@ -1149,6 +1296,7 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 		unsigned long nr_anon;
 		unsigned long nr_file;
 
+		lru_lock_break(zone, &held, SWAP_CLUSTER_MAX);
 		if (scanning_global_lru(sc)) {
 			nr_taken = isolate_pages_global(SWAP_CLUSTER_MAX,
 							&page_list, &nr_scan,
@@ -1230,6 +1378,7 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 		__count_zone_vm_events(PGSTEAL, zone, nr_freed);
 
 		spin_lock(&zone->lru_lock);
+		held = 0;
 		/*
 		 * Put back any unfreeable pages.
 		 */
@@ -1242,6 +1391,7 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 				spin_unlock_irq(&zone->lru_lock);
 				putback_lru_page(page);
 				spin_lock_irq(&zone->lru_lock);
+				held = 0;
 				continue;
 			}
 			SetPageLRU(page);
@@ -1255,7 +1405,9 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 				spin_unlock_irq(&zone->lru_lock);
 				__pagevec_release(&pvec);
 				spin_lock_irq(&zone->lru_lock);
-			}
+				held = 0;
+			} else
+				lru_lock_break(zone, &held, 1);
 		}
 		__mod_zone_page_state(zone, NR_ISOLATED_ANON, -nr_anon);
 		__mod_zone_page_state(zone, NR_ISOLATED_FILE, -nr_file);
@@ -1265,6 +1417,7 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 done:
 	spin_unlock_irq(&zone->lru_lock);
 	pagevec_release(&pvec);
+	reclaim_handoff_kick();
 	return nr_reclaimed;
 }
 
@@ -1305,6 +1458,7 @@ static void move_active_pages_to_lru(struct zone *zone,
 				     enum lru_list lru)
 {
 	unsigned long pgmoved = 0;
+	unsigned int held = 0;
 	struct pagevec pvec;
 	struct page *page;
 
@@ -1326,7 +1480,9 @@ static void move_active_pages_to_lru(struct zone *zone,
 				pagevec_strip(&pvec);
 			__pagevec_release(&pvec);
 			spin_lock_irq(&zone->lru_lock);
-		}
+			held = 0;
+		} else
+			lru_lock_break(zone, &held, 1);
 	}
 	__mod_zone_page_state(zone, NR_LRU_BASE + lru, pgmoved);
 	if (!is_active_lru(lru))
@@ -1336,8 +1492,8 @@ static void move_active_pages_to_lru(struct zone *zone,
 static void shrink_active_list(unsigned long nr_pages, struct zone *zone,
 			struct scan_control *sc, int priority, int file)
 {
-	unsigned long nr_taken;
-	unsigned long pgscanned;
+	unsigned long nr_taken = 0;
+	unsigned long nr_scanned = 0;
 	unsigned long vm_flags;
 	LIST_HEAD(l_hold);	/* The pages which were snipped off */
 	LIST_HEAD(l_active);
@@ -1345,34 +1501,49 @@ static void shrink_active_list(unsigned long nr_pages, struct zone *zone,
 	struct page *page;
 	struct zone_reclaim_stat *reclaim_stat = get_reclaim_stat(zone, sc);
 	unsigned long nr_rotated = 0;
+	unsigned int held = 0;
 
 	lru_add_drain();
 	spin_lock_irq(&zone->lru_lock);
-	if (scanning_global_lru(sc)) {
-		nr_taken = isolate_pages_global(nr_pages, &l_hold,
+	while (nr_scanned < nr_pages) {
+		unsigned long nr_scan = min_t(unsigned long,
+					      nr_pages - nr_scanned,
+					      LRU_LOCK_BATCH);
+		unsigned long taken;
+		unsigned long pgscanned;
+
+		lru_lock_break(zone, &held, nr_scan);
+		if (scanning_global_lru(sc)) {
+			taken = isolate_pages_global(nr_scan, &l_hold,
 						&pgscanned, sc->order,
 						ISOLATE_ACTIVE, zone,
 						1, file);
-		zone->pages_scanned += pgscanned;
-	} else {
-		nr_taken = mem_cgroup_isolate_pages(nr_pages, &l_hold,
+			zone->pages_scanned += pgscanned;
+		} else {
+			taken = mem_cgroup_isolate_pages(nr_scan, &l_hold,
 						&pgscanned, sc->order,
 						ISOLATE_ACTIVE, zone,
 						sc->mem_cgroup, 1, file);
-		/*
-		 * mem_cgroup_isolate_pages() keeps track of
-		 * scanned pages on its own.
-		 */
-	}
+			/*
+			 * mem_cgroup_isolate_pages() keeps track of
+			 * scanned pages on its own.
+			 */
+		}
 
-	reclaim_stat->recent_scanned[file] += nr_taken;
+		reclaim_stat->recent_scanned[file] += taken;
 
-	__count_zone_vm_events(PGREFILL, zone, pgscanned);
-	if (file)
-		__mod_zone_page_state(zone, NR_ACTIVE_FILE, -nr_taken);
-	else
-		__mod_zone_page_state(zone, NR_ACTIVE_ANON, -nr_taken);
-	__mod_zone_page_state(zone, NR_ISOLATED_ANON + file, nr_taken);
+		__count_zone_vm_events(PGREFILL, zone, pgscanned);
+		if (file)
+			__mod_zone_page_state(zone, NR_ACTIVE_FILE, -taken);
+		else
+			__mod_zone_page_state(zone, NR_ACTIVE_ANON, -taken);
+		__mod_zone_page_state(zone, NR_ISOLATED_ANON + file, taken);
+
+		nr_taken += taken;
+		nr_scanned += pgscanned;
+		if (pgscanned < nr_scan)
+			break;	/* list is empty */
+	}
 	spin_unlock_irq(&zone->lru_lock);
 
 	while (!list_empty(&l_hold)) {
@@ -1913,9 +2084,36 @@ out:
 	return 0;
 }
 
+/*
+ * Histogram of the time tasks spend in direct reclaim, in power of two
+ * microsecond buckets: bucket 0 counts stalls below 1us, bucket n those
+ * from 2^(n-1) up to 2^n us and the last bucket everything longer.
+ * Shown and cleared through /proc/reclaim_latency.
+ */
+#define RECLAIM_LAT_BUCKETS	22
+
+static atomic_long_t reclaim_lat_hist[RECLAIM_LAT_BUCKETS];
+static unsigned long reclaim_lat_max;
+
+static void reclaim_lat_account(ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+	int bucket;
+
+	if (us < 0)
+		us = 0;
+	bucket = min(fls64(us), RECLAIM_LAT_BUCKETS - 1);
+	atomic_long_inc(&reclaim_lat_hist[bucket]);
+	/* racy, but a lost update only shows a slightly smaller maximum */
+	if (us > reclaim_lat_max)
+		reclaim_lat_max = us;
+}
+
 unsigned long try_to_free_pages(struct zonelist *zonelist, int order,
 				gfp_t gfp_mask, nodemask_t *nodemask)
 {
+	ktime_t start = ktime_get();
+	unsigned long nr_reclaimed;
 	struct scan_control sc = {
 		.gfp_mask = gfp_mask,
 		.may_writepage = !laptop_mode,
@@ -1928,8 +2126,68 @@ unsigned long try_to_free_pages(struct zonelist *zonelist, int order,
 		.nodemask = nodemask,
 	};
 
-	return do_try_to_free_pages(zonelist, &sc);
+	nr_reclaimed = do_try_to_free_pages(zonelist, &sc);
+	reclaim_lat_account(start);
+
+	return nr_reclaimed;
+}
+
+#ifdef CONFIG_PROC_FS
+static int reclaim_latency_show(struct seq_file *m, void *v)
+{
+	unsigned long total = 0;
+	unsigned long count;
+	int i;
+
+	seq_printf(m, "%10s %10s %10s\n", "from_us", "to_us", "stalls");
+	for (i = 0; i < RECLAIM_LAT_BUCKETS; i++) {
+		count = atomic_long_read(&reclaim_lat_hist[i]);
+		total += count;
+		if (i == RECLAIM_LAT_BUCKETS - 1)
+			seq_printf(m, "%10lu %10s %10lu\n",
+				   1UL << (i - 1), "-", count);
+		else
+			seq_printf(m, "%10lu %10lu %10lu\n",
+				   i ? 1UL << (i - 1) : 0, 1UL << i, count);
+	}
+	seq_printf(m, "total %lu max_us %lu\n", total, reclaim_lat_max);
+	return 0;
+}
+
+static int reclaim_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, reclaim_latency_show, NULL);
+}
+
+/* Any write clears the histogram */
+static ssize_t reclaim_latency_write(struct file *file,
+				     const char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	int i;
+
+	for (i = 0; i < RECLAIM_LAT_BUCKETS; i++)
+		atomic_long_set(&reclaim_lat_hist[i], 0);
+	reclaim_lat_max = 0;
+	return count;
+}
+
+static const struct file_operations proc_reclaim_latency_operations = {
+	.open		= reclaim_latency_open,
+	.read		= seq_read,
+	.write		= reclaim_latency_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init proc_reclaim_latency_init(void)
+{
+	proc_create("reclaim_latency", S_IWUSR | S_IRUGO, NULL,
+		    &proc_reclaim_latency_operations);
+	return 0;
 }
+__initcall(proc_reclaim_latency_init);
+#endif /* CONFIG_PROC_FS */
 
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR
 
@@ -2514,6 +2772,8 @@ static int __init kswapd_init(void)
 	int nid;
 
 	swap_setup();
+	/* without it, direct reclaim writes dirty file pages itself */
+	reclaim_handoff_wq = create_singlethread_workqueue("reclaim_flush");
 	for_each_node_state(nid, N_HIGH_MEMORY)
  		kswapd_run(nid);
 	hotcpu_notifier(cpu_callback, 0);
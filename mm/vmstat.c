@@ -768,6 +768,7 @@ static const char * const vmstat_text[] = {
 
 	"pgfault",
 	"pgmajfault",
+	"pgfault_around",
 
 	TEXTS_FOR_ZONES("pgrefill")
 	TEXTS_FOR_ZONES("pgsteal")
@@ -789,6 +790,14 @@ static const char * const vmstat_text[] = {
 
 	"pgrotated",
 
+	"pcp_highorder_hit",
+	"pcp_highorder_miss",
+	"pcp_highorder_drain",
+
+	"pgreclaim_handoff",
+	"pgreclaim_handoff_write",
+	"lru_lock_break",
+
 #ifdef CONFIG_COMPACTION
 	"compact_blocks_moved",
 	"compact_pages_moved",
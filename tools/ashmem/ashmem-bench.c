@@ -0,0 +1,237 @@
+/*
+ * ashmem-bench.c -- ashmem pin/unpin throughput under shrinker pressure
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Shows whether pinning and unpinning stall behind reclaim.  Each of the
+ * -n workers owns a region and cycles through it unpinning a chunk and
+ * pinning it straight back, as a tile or image cache does when it hands
+ * buffers back and forth, refilling any chunk it finds purged.  A
+ * separate process calls ASHMEM_PURGE_ALL_CACHES in a loop, the same
+ * path the shrinker takes, so unrelated areas are being purged all the
+ * time.  The latency of each PIN and UNPIN ioctl is kept, along with
+ * how often a purge got to a chunk first.
+ *
+ * Purging needs CAP_SYS_ADMIN; -P runs without it, as a baseline.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <linux/types.h>
+
+#include "../include/bench.h"
+#include "../../include/linux/ashmem.h"
+
+static const char *device = "/dev/ashmem";
+static int nr_workers = 4;
+static int iterations = 10000;
+static int region_pages = 256;
+static int chunk_pages = 4;
+static int pressure = 1;
+
+struct bench_shared {
+	volatile int workers_done;
+	uint64_t purges;
+	uint64_t purged;	/* chunks found purged on pin */
+	uint64_t elapsed[0];	/* per worker, then latencies */
+};
+
+static int region_open(size_t size)
+{
+	int fd;
+
+	fd = open(device, O_RDWR);
+	if (fd < 0)
+		die(device);
+	if (ioctl(fd, ASHMEM_SET_NAME, "ashmem-bench") < 0 ||
+	    ioctl(fd, ASHMEM_SET_SIZE, size) < 0)
+		die("ioctl");
+	return fd;
+}
+
+static void run_worker(struct bench_shared *sh, uint64_t *lat, int index,
+		       int ready_fd, int go_fd)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t size = (size_t)region_pages * page;
+	int nr_chunks = region_pages / chunk_pages;
+	uint64_t start, t, purged = 0;
+	struct ashmem_pin pin;
+	char *map, c = 0;
+	int fd, i, ret;
+
+	fd = region_open(size);
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		die("mmap");
+	memset(map, 1, size);
+
+	if (write(ready_fd, &c, 1) != 1 || read(go_fd, &c, 1) < 0)
+		die("pipe");
+
+	pin.len = chunk_pages * page;
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		pin.offset = (i % nr_chunks) * pin.len;
+
+		t = now_ns();
+		if (ioctl(fd, ASHMEM_UNPIN, &pin) < 0)
+			die("ASHMEM_UNPIN");
+		lat[2 * i] = now_ns() - t;
+
+		t = now_ns();
+		ret = ioctl(fd, ASHMEM_PIN, &pin);
+		if (ret < 0)
+			die("ASHMEM_PIN");
+		lat[2 * i + 1] = now_ns() - t;
+
+		if (ret == ASHMEM_WAS_PURGED) {
+			/* like a cache would, fill the chunk in again */
+			memset(map + pin.offset, 1, pin.len);
+			purged++;
+		}
+	}
+	sh->elapsed[index] = now_ns() - start;
+	__sync_fetch_and_add(&sh->purged, purged);
+	exit(0);
+}
+
+static void run_pressure(struct bench_shared *sh, int ready_fd, int go_fd)
+{
+	char c = 0;
+	int fd;
+
+	fd = region_open(sysconf(_SC_PAGESIZE));
+
+	if (write(ready_fd, &c, 1) != 1 || read(go_fd, &c, 1) < 0)
+		die("pipe");
+
+	while (!sh->workers_done) {
+		if (ioctl(fd, ASHMEM_PURGE_ALL_CACHES) < 0)
+			die("ASHMEM_PURGE_ALL_CACHES");
+		sh->purges++;
+	}
+	exit(0);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-d device] [-n workers] [-i iterations] "
+		"[-r region pages] [-c chunk pages] [-P]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_shared *sh;
+	int ready[2], go[2];
+	pid_t purger = 0, *pids;
+	uint64_t *lat, elapsed = 0;
+	size_t total, map_size;
+	char c;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "d:n:i:r:c:P")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'n':
+			nr_workers = atoi(optarg);
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		case 'r':
+			region_pages = atoi(optarg);
+			break;
+		case 'c':
+			chunk_pages = atoi(optarg);
+			break;
+		case 'P':
+			pressure = 0;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nr_workers <= 0 || iterations <= 0 || chunk_pages <= 0 ||
+	    region_pages < chunk_pages)
+		usage(argv[0]);
+
+	total = (size_t)nr_workers * iterations * 2;
+	map_size = sizeof(*sh) + (nr_workers + total) * sizeof(uint64_t);
+	sh = shared_alloc(map_size);
+	lat = sh->elapsed + nr_workers;
+	pids = calloc(nr_workers, sizeof(*pids));
+	if (!pids)
+		die("malloc");
+	if (pipe(ready) || pipe(go))
+		die("pipe");
+
+	if (pressure) {
+		purger = fork();
+		if (purger < 0)
+			die("fork");
+		if (!purger) {
+			close(go[1]);
+			run_pressure(sh, ready[1], go[0]);
+		}
+	}
+
+	for (i = 0; i < nr_workers; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0)
+			die("fork");
+		if (!pids[i]) {
+			close(go[1]);
+			run_worker(sh, lat + (size_t)i * iterations * 2, i,
+				   ready[1], go[0]);
+		}
+	}
+
+	for (i = 0; i < nr_workers + pressure; i++)
+		if (read(ready[0], &c, 1) != 1) {
+			fprintf(stderr, "child failed to start\n");
+			kill(0, SIGKILL);
+		}
+	close(go[1]);	/* start everybody at once */
+
+	for (i = 0; i < nr_workers; i++) {
+		int status;
+
+		waitpid(pids[i], &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			fprintf(stderr, "worker %d failed\n", i);
+			kill(0, SIGKILL);
+		}
+		if (sh->elapsed[i] > elapsed)
+			elapsed = sh->elapsed[i];
+	}
+	sh->workers_done = 1;
+	if (pressure)
+		waitpid(purger, NULL, 0);
+
+	printf("workers %d, iterations %d, region %d pages, chunk %d pages\n",
+	       nr_workers, iterations, region_pages, chunk_pages);
+	printf("pin+unpin ioctls/sec: %.0f\n", total * 1e9 / elapsed);
+	print_latency("latency", lat, total);
+	printf("purge passes: %llu, chunks found purged: %llu\n",
+	       (unsigned long long)sh->purges,
+	       (unsigned long long)sh->purged);
+	return 0;
+}
@@ -0,0 +1,593 @@
+/*
+ * binder-bench.c -- binder transaction throughput and latency benchmark
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Measures how binder scales with independent traffic: -n client/server
+ * pairs ping each other with synchronous transactions, and no pair ever
+ * talks to another, so any slowdown as pairs are added comes from
+ * locking inside the driver.  The servers are found through a small
+ * broker acting as context manager, the way servicemanager would hand
+ * them out.  The payload travels both ways, in the transaction and in
+ * the reply, and the round trip time of every call is kept.
+ *
+ * With -z the payload lives in a sealed ashmem area, mapped read-only,
+ * and is sent with TF_ZERO_COPY, so its pages are mapped into the
+ * receiver instead of copied once it is at least zero_copy_min bytes.  To compare both over
+ * a range of payload sizes:
+ *
+ *   for s in 4096 65536 262144 1048576; do
+ *	binder-bench -s $s; binder-bench -z -s $s
+ *   done
+ *
+ * The broker must be the only context manager, so this cannot run
+ * while servicemanager is active.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <linux/types.h>
+
+#include "../include/bench.h"
+#include "../../drivers/staging/android/binder.h"
+#include "../../include/linux/ashmem.h"
+
+#define MAP_SIZE	(128 * 1024)
+#define MAX_PAYLOAD	(1024 * 1024)
+
+enum {
+	CODE_REGISTER = 1,	/* server -> broker: data = index, 1 binder */
+	CODE_LOOKUP,		/* client -> broker: data = index */
+	CODE_PING,		/* client -> server */
+};
+
+struct bench_proc {
+	int fd;
+	void *map;
+	uint8_t wbuf[512];
+	size_t wlen;
+};
+
+static const char *device = "/dev/binder";
+static int nr_pairs = 4;
+static int iterations = 10000;
+static size_t payload_size = 128;
+static size_t map_size;
+static int zero_copy;
+
+static void bench_open(struct bench_proc *bp)
+{
+	struct binder_version vers;
+
+	bp->fd = open(device, O_RDWR);
+	if (bp->fd < 0)
+		die(device);
+	if (ioctl(bp->fd, BINDER_VERSION, &vers) < 0)
+		die("BINDER_VERSION");
+	if (vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "binder protocol version %ld, expected %d\n",
+			vers.protocol_version, BINDER_CURRENT_PROTOCOL_VERSION);
+		exit(1);
+	}
+	bp->map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, bp->fd, 0);
+	if (bp->map == MAP_FAILED)
+		die("mmap");
+	bp->wlen = 0;
+}
+
+static void put_bytes(struct bench_proc *bp, const void *p, size_t len)
+{
+	if (bp->wlen + len > sizeof(bp->wbuf)) {
+		fprintf(stderr, "write buffer overflow\n");
+		exit(1);
+	}
+	memcpy(bp->wbuf + bp->wlen, p, len);
+	bp->wlen += len;
+}
+
+static void put_cmd(struct bench_proc *bp, uint32_t cmd)
+{
+	put_bytes(bp, &cmd, sizeof(cmd));
+}
+
+static void put_ptr(struct bench_proc *bp, void *ptr)
+{
+	put_bytes(bp, &ptr, sizeof(ptr));
+}
+
+static void put_u32(struct bench_proc *bp, uint32_t val)
+{
+	put_bytes(bp, &val, sizeof(val));
+}
+
+/* Writes the queued commands and, if rbuf is set, reads back results. */
+static size_t bench_ioctl(struct bench_proc *bp, void *rbuf, size_t rsize)
+{
+	struct binder_write_read bwr;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_size = bp->wlen;
+	bwr.write_buffer = (unsigned long)bp->wbuf;
+	bwr.read_size = rsize;
+	bwr.read_buffer = (unsigned long)rbuf;
+	for (;;) {
+		if (ioctl(bp->fd, BINDER_WRITE_READ, &bwr) >= 0)
+			break;
+		if (errno != EINTR)
+			die("BINDER_WRITE_READ");
+	}
+	bp->wlen = 0;
+	return bwr.read_consumed;
+}
+
+static void put_transaction(struct bench_proc *bp, uint32_t cmd,
+			    uint32_t handle, uint32_t code, uint32_t flags,
+			    const void *data, size_t data_size,
+			    const void *offsets, size_t offsets_size)
+{
+	struct binder_transaction_data tr;
+
+	memset(&tr, 0, sizeof(tr));
+	tr.target.handle = handle;
+	tr.code = code;
+	tr.flags = flags;
+	tr.data_size = data_size;
+	tr.offsets_size = offsets_size;
+	tr.data.ptr.buffer = data;
+	tr.data.ptr.offsets = offsets;
+	put_cmd(bp, cmd);
+	put_bytes(bp, &tr, sizeof(tr));
+}
+
+/*
+ * Handles the bookkeeping returns every process may see.  Returns the
+ * size of the command including its payload.
+ */
+static size_t handle_common(struct bench_proc *bp, uint32_t cmd, void *payload)
+{
+	struct binder_ptr_cookie *pc = payload;
+
+	switch (cmd) {
+	case BR_INCREFS:
+		put_cmd(bp, BC_INCREFS_DONE);
+		put_ptr(bp, pc->ptr);
+		put_ptr(bp, pc->cookie);
+		break;
+	case BR_ACQUIRE:
+		put_cmd(bp, BC_ACQUIRE_DONE);
+		put_ptr(bp, pc->ptr);
+		put_ptr(bp, pc->cookie);
+		break;
+	case BR_NOOP:
+	case BR_SPAWN_LOOPER:
+	case BR_TRANSACTION_COMPLETE:
+	case BR_RELEASE:
+	case BR_DECREFS:
+		break;
+	case BR_DEAD_REPLY:
+	case BR_FAILED_REPLY:
+	case BR_ERROR:
+		fprintf(stderr, "%d: transaction failed, cmd %x\n",
+			getpid(), cmd);
+		exit(1);
+	default:
+		fprintf(stderr, "%d: unexpected command %x\n", getpid(), cmd);
+		exit(1);
+	}
+	return sizeof(uint32_t) + _IOC_SIZE(cmd);
+}
+
+/*
+ * Sends the queued commands plus a transaction and waits for the reply.
+ * The reply buffer must be freed with BC_FREE_BUFFER by the caller.
+ */
+static void bench_call(struct bench_proc *bp, struct binder_transaction_data *reply)
+{
+	uint8_t rbuf[256];
+
+	for (;;) {
+		size_t len = bench_ioctl(bp, rbuf, sizeof(rbuf));
+		size_t pos = 0;
+
+		while (pos < len) {
+			uint32_t cmd;
+
+			memcpy(&cmd, rbuf + pos, sizeof(cmd));
+			if (cmd == BR_REPLY) {
+				memcpy(reply, rbuf + pos + sizeof(cmd),
+				       sizeof(*reply));
+				if (reply->flags & TF_STATUS_CODE) {
+					fprintf(stderr, "%d: error reply\n",
+						getpid());
+					exit(1);
+				}
+				return;
+			}
+			pos += handle_common(bp, cmd, rbuf + pos + sizeof(cmd));
+		}
+	}
+}
+
+typedef void (*txn_handler)(struct bench_proc *bp,
+			    struct binder_transaction_data *tr);
+
+/* Serves incoming transactions forever. */
+static void bench_loop(struct bench_proc *bp, txn_handler handler)
+{
+	uint8_t rbuf[256];
+
+	put_cmd(bp, BC_ENTER_LOOPER);
+	for (;;) {
+		size_t len = bench_ioctl(bp, rbuf, sizeof(rbuf));
+		size_t pos = 0;
+
+		while (pos < len) {
+			uint32_t cmd;
+
+			memcpy(&cmd, rbuf + pos, sizeof(cmd));
+			if (cmd == BR_TRANSACTION) {
+				struct binder_transaction_data tr;
+
+				memcpy(&tr, rbuf + pos + sizeof(cmd),
+				       sizeof(tr));
+				handler(bp, &tr);
+				pos += sizeof(cmd) + sizeof(tr);
+				continue;
+			}
+			pos += handle_common(bp, cmd, rbuf + pos + sizeof(cmd));
+		}
+	}
+}
+
+static void put_reply(struct bench_proc *bp, struct binder_transaction_data *tr,
+		      uint32_t flags, const void *data, size_t data_size,
+		      const void *offsets, size_t offsets_size)
+{
+	put_cmd(bp, BC_FREE_BUFFER);
+	put_ptr(bp, (void *)tr->data.ptr.buffer);
+	put_transaction(bp, BC_REPLY, 0, 0, flags, data, data_size,
+			offsets, offsets_size);
+	/* data may live on the caller's stack, so send it right away */
+	bench_ioctl(bp, NULL, 0);
+}
+
+static uint32_t *server_handles;
+
+static void broker_txn(struct bench_proc *bp, struct binder_transaction_data *tr)
+{
+	const uint32_t *index = tr->data.ptr.buffer;
+	const struct flat_binder_object *in;
+	struct flat_binder_object obj;
+	size_t offset = 0;
+	uint32_t status = 0;
+
+	if (tr->data_size < sizeof(*index) || *index >= (uint32_t)nr_pairs) {
+		put_reply(bp, tr, 0, &status, sizeof(status), NULL, 0);
+		return;
+	}
+	switch (tr->code) {
+	case CODE_REGISTER:
+		if (tr->offsets_size != sizeof(size_t))
+			break;
+		in = (const void *)((const uint8_t *)tr->data.ptr.buffer +
+			*(const size_t *)tr->data.ptr.offsets);
+		server_handles[*index] = in->handle;
+		/* keep the ref once the transaction buffer is freed */
+		put_cmd(bp, BC_ACQUIRE);
+		put_u32(bp, in->handle);
+		break;
+	case CODE_LOOKUP:
+		if (!server_handles[*index])
+			break;
+		memset(&obj, 0, sizeof(obj));
+		obj.type = BINDER_TYPE_HANDLE;
+		obj.handle = server_handles[*index];
+		put_reply(bp, tr, 0, &obj, sizeof(obj), &offset,
+			  sizeof(offset));
+		return;
+	}
+	put_reply(bp, tr, 0, &status, sizeof(status), NULL, 0);
+}
+
+static void run_broker(int ready_fd)
+{
+	struct bench_proc bp;
+	char c = 0;
+
+	bench_open(&bp);
+	if (ioctl(bp.fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		perror("BINDER_SET_CONTEXT_MGR (is servicemanager running?)");
+		exit(1);
+	}
+	server_handles = calloc(nr_pairs, sizeof(*server_handles));
+	if (!server_handles)
+		die("calloc");
+	if (write(ready_fd, &c, 1) != 1)
+		die("write");
+	close(ready_fd);
+	bench_loop(&bp, broker_txn);
+}
+
+static uint8_t *payload;
+static uint32_t payload_flags;
+
+static void server_txn(struct bench_proc *bp, struct binder_transaction_data *tr)
+{
+	put_reply(bp, tr, payload_flags, payload, payload_size, NULL, 0);
+}
+
+static void run_server(int index)
+{
+	struct bench_proc bp;
+	struct binder_transaction_data reply;
+	struct flat_binder_object obj;
+	uint8_t buf[sizeof(void *) + sizeof(obj)];
+	size_t offset = sizeof(void *);	/* objects must be pointer aligned */
+	uint32_t idx = index;
+	static int cookie;
+
+	bench_open(&bp);
+	memset(&obj, 0, sizeof(obj));
+	obj.type = BINDER_TYPE_BINDER;
+	obj.binder = &cookie;
+	obj.cookie = &cookie;
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, &idx, sizeof(idx));
+	memcpy(buf + offset, &obj, sizeof(obj));
+	put_transaction(&bp, BC_TRANSACTION, 0, CODE_REGISTER, 0,
+			buf, sizeof(buf), &offset, sizeof(offset));
+	bench_call(&bp, &reply);
+	put_cmd(&bp, BC_FREE_BUFFER);
+	put_ptr(&bp, (void *)reply.data.ptr.buffer);
+	bench_loop(&bp, server_txn);
+}
+
+static void run_client(int index, int ready_fd, int go_fd, int result_fd)
+{
+	struct bench_proc bp;
+	struct binder_transaction_data reply;
+	uint32_t handle = 0;
+	uint64_t *lat, start, t0;
+	uint32_t idx = index;
+	char c = 0;
+	int i;
+
+	bench_open(&bp);
+	lat = malloc((iterations + 1) * sizeof(*lat));
+	if (!lat)
+		die("malloc");
+
+	/* the server may not have registered yet */
+	while (!handle) {
+		put_transaction(&bp, BC_TRANSACTION, 0, CODE_LOOKUP, 0,
+				&idx, sizeof(idx), NULL, 0);
+		bench_call(&bp, &reply);
+		if (reply.offsets_size) {
+			const struct flat_binder_object *obj;
+
+			obj = reply.data.ptr.buffer;
+			handle = obj->handle;
+			put_cmd(&bp, BC_ACQUIRE);
+			put_u32(&bp, handle);
+		}
+		put_cmd(&bp, BC_FREE_BUFFER);
+		put_ptr(&bp, (void *)reply.data.ptr.buffer);
+		bench_ioctl(&bp, NULL, 0);
+		if (!handle)
+			usleep(1000);
+	}
+
+	if (write(ready_fd, &c, 1) != 1)
+		die("write");
+	close(ready_fd);
+	if (read(go_fd, &c, 1) < 0)
+		die("read");
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		t0 = now_ns();
+		put_transaction(&bp, BC_TRANSACTION, handle, CODE_PING,
+				payload_flags, payload, payload_size, NULL, 0);
+		bench_call(&bp, &reply);
+		lat[i] = now_ns() - t0;
+		put_cmd(&bp, BC_FREE_BUFFER);
+		put_ptr(&bp, (void *)reply.data.ptr.buffer);
+	}
+	bench_ioctl(&bp, NULL, 0);
+	lat[iterations] = now_ns() - start;
+
+	for (i = 0; i <= iterations; ) {
+		ssize_t n = write(result_fd, lat + i,
+				  (iterations + 1 - i) * sizeof(*lat));
+		if (n < 0)
+			die("write");
+		i += n / sizeof(*lat);
+	}
+	exit(0);
+}
+
+/*
+ * The payload for -z: an ashmem area filled through a mapping that is gone
+ * again before the area is sealed, so only a read-only one is left.  The
+ * area's fd stays open for the children to inherit.
+ */
+static uint8_t *sealed_payload(size_t size)
+{
+	int fd = open("/dev/ashmem", O_RDWR);
+	void *p;
+
+	if (fd < 0)
+		die("/dev/ashmem");
+	if (ioctl(fd, ASHMEM_SET_SIZE, size) < 0)
+		die("ASHMEM_SET_SIZE");
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		die("mmap");
+	memset(p, 1, size);
+	munmap(p, size);
+	if (ioctl(fd, ASHMEM_SET_PROT_MASK, PROT_READ) < 0)
+		die("ASHMEM_SET_PROT_MASK");
+	p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		die("mmap");
+	return p;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-d device] [-n pairs] [-i iterations] "
+		"[-s payload size] [-z]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int ready[2], go[2], *results;
+	pid_t broker, *pids;
+	uint64_t *all, elapsed = 0;
+	size_t total;
+	char c;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "d:n:i:s:z")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'n':
+			nr_pairs = atoi(optarg);
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		case 's':
+			payload_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'z':
+			zero_copy = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nr_pairs <= 0 || iterations <= 0 || payload_size > MAX_PAYLOAD)
+		usage(argv[0]);
+
+	/* room for a transaction and a reply, plus page alignment slack */
+	map_size = MAP_SIZE + 2 * (payload_size + sysconf(_SC_PAGESIZE));
+
+	/* page aligned either way, so both send the same number of pages */
+	if (zero_copy && payload_size) {
+		payload = sealed_payload(payload_size);
+		payload_flags = TF_ZERO_COPY;
+	} else {
+		payload = mmap(NULL, payload_size ? payload_size : 1,
+			       PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (payload == MAP_FAILED)
+			die("mmap");
+		memset(payload, 1, payload_size);
+	}
+
+	pids = calloc(2 * nr_pairs, sizeof(*pids));
+	results = calloc(nr_pairs, sizeof(*results));
+	all = malloc((size_t)nr_pairs * (iterations + 1) * sizeof(*all));
+	if (!pids || !results || !all)
+		die("malloc");
+	if (pipe(ready) || pipe(go))
+		die("pipe");
+
+	broker = fork();
+	if (broker < 0)
+		die("fork");
+	if (!broker)
+		run_broker(ready[1]);
+	if (read(ready[0], &c, 1) != 1) {
+		fprintf(stderr, "broker failed to start\n");
+		return 1;
+	}
+
+	for (i = 0; i < nr_pairs; i++) {
+		int res[2];
+
+		pids[2 * i] = fork();
+		if (pids[2 * i] < 0)
+			die("fork");
+		if (!pids[2 * i])
+			run_server(i);
+
+		if (pipe(res))
+			die("pipe");
+		pids[2 * i + 1] = fork();
+		if (pids[2 * i + 1] < 0)
+			die("fork");
+		if (!pids[2 * i + 1]) {
+			close(res[0]);
+			close(go[1]);
+			run_client(i, ready[1], go[0], res[1]);
+		}
+		close(res[1]);
+		results[i] = res[0];
+	}
+
+	for (i = 0; i < nr_pairs; i++)
+		if (read(ready[0], &c, 1) != 1)
+			die("read");
+	close(go[1]);	/* start all clients at once */
+
+	for (i = 0; i < nr_pairs; i++) {
+		uint64_t *lat = all + (size_t)i * (iterations + 1);
+		size_t want = (iterations + 1) * sizeof(*lat), got = 0;
+
+		while (got < want) {
+			ssize_t n = read(results[i], (uint8_t *)lat + got,
+					 want - got);
+			if (n <= 0) {
+				fprintf(stderr, "client %d failed\n", i);
+				kill(0, SIGKILL);
+			}
+			got += n;
+		}
+		if (lat[iterations] > elapsed)
+			elapsed = lat[iterations];
+	}
+
+	for (i = 0; i < nr_pairs; i++)
+		waitpid(pids[2 * i + 1], NULL, 0);
+	for (i = 0; i < nr_pairs; i++) {
+		kill(pids[2 * i], SIGKILL);
+		waitpid(pids[2 * i], NULL, 0);
+	}
+	kill(broker, SIGKILL);
+	waitpid(broker, NULL, 0);
+
+	/* drop the per-client elapsed times stored after each run */
+	for (i = 0; i < nr_pairs; i++)
+		memmove(all + (size_t)i * iterations,
+			all + (size_t)i * (iterations + 1),
+			iterations * sizeof(*all));
+	total = (size_t)nr_pairs * iterations;
+
+	printf("pairs %d, iterations %d, payload %zu bytes%s\n",
+	       nr_pairs, iterations, payload_size,
+	       zero_copy ? ", zero copy" : "");
+	printf("transactions/sec: %.0f\n", total * 1e9 / elapsed);
+	printf("payload bandwidth: %.1f MB/s\n",
+	       2.0 * total * payload_size * 1e3 / elapsed);
+	print_latency("latency", all, total);
+	return 0;
+}
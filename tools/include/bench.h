@@ -0,0 +1,80 @@
+/*
+ * bench.h -- helpers shared by the benchmarks under tools/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _TOOLS_BENCH_H
+#define _TOOLS_BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+static inline void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Anonymous memory that forked children can report results in */
+static inline void *shared_alloc(size_t size)
+{
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (p == MAP_FAILED)
+		die("mmap");
+	return p;
+}
+
+static inline int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Sorts @nr latencies in ns and prints their median, p99 and maximum */
+static inline void print_latency(const char *what, uint64_t *lat, size_t nr)
+{
+	if (!nr)
+		return;
+	qsort(lat, nr, sizeof(*lat), cmp_u64);
+	printf("%s p50: %.1f us, p99: %.1f us, max: %.1f us\n", what,
+	       lat[nr / 2] / 1e3, lat[nr * 99 / 100] / 1e3,
+	       lat[nr - 1] / 1e3);
+}
+
+/*
+ * Parses a comma separated list of at most @max integers no smaller than
+ * @min into @vals.  Returns how many there were, or -1 if the list does
+ * not fit or has a value out of range.
+ */
+static inline int parse_list(char *arg, int *vals, int max, int min)
+{
+	char *tok;
+	int nr = 0;
+
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (nr == max || atoi(tok) < min)
+			return -1;
+		vals[nr++] = atoi(tok);
+	}
+	return nr;
+}
+
+#endif /* _TOOLS_BENCH_H */
@@ -0,0 +1,325 @@
+/*
+ * logger-bench.c -- Android logger write/read throughput benchmark
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Loads one log the way a busy system does: -n processes log entries as
+ * liblog writes them (priority, tag and message in a single writev()),
+ * while a logcat-like reader drains the log.  What matters is how long a
+ * writer can be held up by the others and by the reader, so the time of
+ * each writev() is kept, and whether the reader keeps up: entries it
+ * never saw were overwritten before it got to them.
+ *
+ * The reader uses plain read() by default, batched reads with -b, or
+ * walks a read-only mapping of the log with -m.
+ *
+ * Other processes logging to the same device skew the reader numbers,
+ * so use a log nobody else writes to (log_radio on most devices).
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../include/bench.h"
+#include "../../drivers/staging/android/logger.h"
+
+static const char *device = "/dev/log/radio";
+static int nr_writers = 4;
+static int iterations = 10000;
+static size_t payload_size = 64;
+static int read_batch;
+static int read_mmap;
+
+struct bench_shared {
+	volatile int writers_done;
+	uint64_t entries_read;
+	uint64_t read_ns;
+	uint64_t elapsed[0];	/* per writer, then latencies */
+};
+
+static void run_writer(struct bench_shared *sh, uint64_t *lat, int index,
+		       int ready_fd, int go_fd)
+{
+	static const char tag[] = "logger-bench";
+	unsigned char prio = 4;	/* ANDROID_LOG_INFO */
+	struct iovec iov[3];
+	uint64_t start, t;
+	char *msg, c = 0;
+	int fd, i;
+
+	fd = open(device, O_WRONLY);
+	if (fd < 0)
+		die(device);
+	msg = malloc(payload_size + 1);
+	if (!msg)
+		die("malloc");
+	memset(msg, 'a' + index % 26, payload_size);
+	msg[payload_size] = '\0';
+
+	iov[0].iov_base = &prio;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = (void *)tag;
+	iov[1].iov_len = sizeof(tag);
+	iov[2].iov_base = msg;
+	iov[2].iov_len = payload_size + 1;
+
+	if (write(ready_fd, &c, 1) != 1 || read(go_fd, &c, 1) < 0)
+		die("pipe");
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		t = now_ns();
+		if (writev(fd, iov, 3) < 0)
+			die("writev");
+		lat[i] = now_ns() - t;
+	}
+	sh->elapsed[index] = now_ns() - start;
+	exit(0);
+}
+
+/* counts the entries in 'len' bytes of a batch read */
+static uint64_t count_entries(const char *buf, size_t len)
+{
+	const struct logger_entry *e;
+	uint64_t n = 0;
+	size_t off;
+
+	for (off = 0; off < len; off += sizeof(*e) + e->len, n++)
+		e = (const struct logger_entry *)(buf + off);
+	return n;
+}
+
+static void run_mmap_reader(struct bench_shared *sh, int fd, int ready_fd,
+			    int go_fd)
+{
+	volatile struct logger_mmap_header *hdr;
+	const unsigned char *data;
+	uint64_t start, last;
+	uint32_t pos, mask;
+	long size;
+	char c = 0;
+
+	size = ioctl(fd, LOGGER_GET_LOG_BUF_SIZE);
+	if (size < 0)
+		die("ioctl");
+	hdr = mmap(NULL, sysconf(_SC_PAGESIZE) + size, PROT_READ, MAP_SHARED,
+		   fd, 0);
+	if (hdr == MAP_FAILED)
+		die("mmap");
+	data = (const unsigned char *)hdr + hdr->data_offset;
+	mask = hdr->size - 1;
+
+	/* skip whatever was logged before the run */
+	pos = hdr->tail;
+
+	if (write(ready_fd, &c, 1) != 1 || read(go_fd, &c, 1) < 0)
+		die("pipe");
+
+	start = last = now_ns();
+	for (;;) {
+		uint32_t from = pos, tail = hdr->tail;
+		uint64_t n = 0;
+
+		__sync_synchronize();
+		if ((int32_t)(pos - hdr->head) < 0)
+			pos = from = hdr->head;
+		while ((int32_t)(tail - pos) > 0) {
+			uint16_t len = data[pos & mask] |
+				       data[(pos + 1) & mask] << 8;
+
+			pos += sizeof(struct logger_entry) + len;
+			n++;
+		}
+		__sync_synchronize();
+		if ((int32_t)(hdr->head - from) > 0) {
+			/* lapped while parsing, those entries are gone */
+			pos = hdr->head;
+			continue;
+		}
+		if (n) {
+			sh->entries_read += n;
+			last = now_ns();
+			continue;
+		}
+		if (sh->writers_done && pos == hdr->tail)
+			break;
+		usleep(1000);
+	}
+	sh->read_ns = last - start;
+	exit(0);
+}
+
+static void run_reader(struct bench_shared *sh, int ready_fd, int go_fd)
+{
+	struct pollfd pfd;
+	uint64_t start, last;
+	size_t buf_size = LOGGER_ENTRY_MAX_LEN;
+	char *buf, c = 0;
+	int fd;
+
+	fd = open(device, O_RDONLY | O_NONBLOCK);
+	if (fd < 0)
+		die(device);
+	if (read_batch) {
+		buf_size = ioctl(fd, LOGGER_GET_LOG_BUF_SIZE);
+		if ((ssize_t)buf_size < 0 ||
+		    ioctl(fd, LOGGER_SET_READ_BATCH, 1) < 0)
+			die("ioctl");
+	}
+	buf = malloc(buf_size);
+	if (!buf)
+		die("malloc");
+
+	if (read_mmap)
+		run_mmap_reader(sh, fd, ready_fd, go_fd);
+
+	/* skip whatever was logged before the run */
+	while (read(fd, buf, buf_size) > 0)
+		;
+
+	if (write(ready_fd, &c, 1) != 1 || read(go_fd, &c, 1) < 0)
+		die("pipe");
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	start = last = now_ns();
+	for (;;) {
+		ssize_t n = read(fd, buf, buf_size);
+
+		if (n > 0) {
+			sh->entries_read +=
+				read_batch ? count_entries(buf, n) : 1;
+			last = now_ns();
+			continue;
+		}
+		if (n < 0 && errno != EAGAIN)
+			die("read");
+		if (sh->writers_done)
+			break;
+		poll(&pfd, 1, 100);
+	}
+	sh->read_ns = last - start;
+	exit(0);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-d device] [-n writers] [-i iterations] "
+		"[-s payload size] [-b | -m]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_shared *sh;
+	int ready[2], go[2];
+	pid_t reader, *pids;
+	uint64_t *lat, elapsed = 0;
+	size_t total, map_size;
+	char c;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "d:n:i:s:bm")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'n':
+			nr_writers = atoi(optarg);
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		case 's':
+			payload_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			read_batch = 1;
+			break;
+		case 'm':
+			read_mmap = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nr_writers <= 0 || iterations <= 0 || (read_batch && read_mmap) ||
+	    payload_size > LOGGER_ENTRY_MAX_PAYLOAD - 32)
+		usage(argv[0]);
+
+	total = (size_t)nr_writers * iterations;
+	map_size = sizeof(*sh) + (nr_writers + total) * sizeof(uint64_t);
+	sh = shared_alloc(map_size);
+	lat = sh->elapsed + nr_writers;
+	pids = calloc(nr_writers, sizeof(*pids));
+	if (!pids)
+		die("malloc");
+	if (pipe(ready) || pipe(go))
+		die("pipe");
+
+	reader = fork();
+	if (reader < 0)
+		die("fork");
+	if (!reader) {
+		close(go[1]);
+		run_reader(sh, ready[1], go[0]);
+	}
+
+	for (i = 0; i < nr_writers; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0)
+			die("fork");
+		if (!pids[i]) {
+			close(go[1]);
+			run_writer(sh, lat + (size_t)i * iterations, i,
+				   ready[1], go[0]);
+		}
+	}
+
+	for (i = 0; i < nr_writers + 1; i++)
+		if (read(ready[0], &c, 1) != 1) {
+			fprintf(stderr, "child failed to start\n");
+			kill(0, SIGKILL);
+		}
+	close(go[1]);	/* start everybody at once */
+
+	for (i = 0; i < nr_writers; i++) {
+		int status;
+
+		waitpid(pids[i], &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			fprintf(stderr, "writer %d failed\n", i);
+			kill(0, SIGKILL);
+		}
+		if (sh->elapsed[i] > elapsed)
+			elapsed = sh->elapsed[i];
+	}
+	sh->writers_done = 1;
+	waitpid(reader, NULL, 0);
+
+	printf("writers %d, iterations %d, payload %zu bytes, %s reader\n",
+	       nr_writers, iterations, payload_size,
+	       read_mmap ? "mmap" : read_batch ? "batched" : "read()");
+	printf("writes/sec: %.0f\n", total * 1e9 / elapsed);
+	print_latency("write latency", lat, total);
+	printf("reads/sec: %.0f, read %llu of %zu entries\n",
+	       sh->read_ns ? sh->entries_read * 1e9 / sh->read_ns : 0.0,
+	       (unsigned long long)sh->entries_read, total);
+	return 0;
+}
@@ -0,0 +1,241 @@
+/*
+ * swap-bench.c -- swap-out/swap-in throughput through a ramzswap device
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Measures what swapping to ramzswap costs the tasks that fault.  -n hog
+ * processes each fill a private region of -m MB and then dirty random
+ * pages of it for -p passes; the regions together should not fit in free
+ * memory, so each touch may have to wait for a page to be decompressed
+ * while other hogs are compressing theirs out.  -c sets how much of every
+ * page is zero, from -c 0 (hardly compressible) to -c 100 (zero pages).
+ *
+ * Reported are page touches per second, the touch latency distribution
+ * and the swap-in rate.  When the device named by -d can be opened, the
+ * pages per second it stored and returned are given as well, and how it
+ * stored them: zero, same-filled, deduplicated, compressed and written
+ * back.  Use the ramzswap device as the only active swap.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../include/bench.h"
+
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#include "../../drivers/staging/ramzswap/ramzswap_ioctl.h"
+
+static const char *device = "/dev/ramzswap0";
+static int nr_hogs = 4;
+static int passes = 4;
+static size_t region_mb = 64;
+static int compress_pct = 50;
+
+struct bench_shared {
+	uint64_t majflt;
+	uint64_t elapsed[0];	/* per hog, then latencies */
+};
+
+/* fills one page, 'compress_pct' percent of it zeroes */
+static void fill_page(unsigned char *p, size_t page, uint32_t seed)
+{
+	size_t zero = page * compress_pct / 100, i;
+
+	for (i = 0; i < page - zero; i++) {
+		seed = seed * 1103515245 + 12345;
+		p[i] = seed >> 16;
+	}
+	memset(p + page - zero, 0, zero);
+}
+
+static void run_hog(struct bench_shared *sh, uint64_t *lat, int index,
+		    int ready_fd, int go_fd)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t nr_pages = (region_mb << 20) / page, i, n;
+	uint64_t start, t;
+	struct rusage ru;
+	unsigned char *map;
+	uint32_t rnd = index + 1;
+	char c = 0;
+	int pass;
+
+	map = mmap(NULL, nr_pages * page, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED)
+		die("mmap");
+
+	if (write(ready_fd, &c, 1) != 1 || read(go_fd, &c, 1) < 0)
+		die("pipe");
+
+	/* the first pass faults the region in, later ones swap */
+	start = now_ns();
+	for (i = 0; i < nr_pages; i++)
+		fill_page(map + i * page, page, index * nr_pages + i);
+
+	for (pass = 0, n = 0; pass < passes; pass++) {
+		for (i = 0; i < nr_pages; i++, n++) {
+			unsigned char *p;
+
+			rnd = rnd * 1103515245 + 12345;
+			p = map + (size_t)(rnd >> 4) % nr_pages * page;
+
+			t = now_ns();
+			p[0]++;		/* swap in and dirty again */
+			lat[n] = now_ns() - t;
+		}
+	}
+	sh->elapsed[index] = now_ns() - start;
+
+	getrusage(RUSAGE_SELF, &ru);
+	__sync_fetch_and_add(&sh->majflt, ru.ru_majflt);
+	exit(0);
+}
+
+static int get_stats(struct ramzswap_ioctl_stats2 *s)
+{
+	int fd, ret;
+
+	fd = open(device, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	ret = ioctl(fd, RZSIO_GET_STATS2, s);
+	close(fd);
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-d device] [-n hogs] [-p passes] "
+		"[-m region MB] [-c zero percent]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct ramzswap_ioctl_stats2 before, after;
+	struct bench_shared *sh;
+	int ready[2], go[2], have_stats;
+	pid_t *pids;
+	uint64_t *lat, elapsed = 0;
+	size_t per_hog, total, map_size;
+	char c;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "d:n:p:m:c:")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'n':
+			nr_hogs = atoi(optarg);
+			break;
+		case 'p':
+			passes = atoi(optarg);
+			break;
+		case 'm':
+			region_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			compress_pct = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nr_hogs <= 0 || passes <= 0 || !region_mb ||
+	    compress_pct < 0 || compress_pct > 100)
+		usage(argv[0]);
+
+	per_hog = (region_mb << 20) / sysconf(_SC_PAGESIZE) * passes;
+	total = per_hog * nr_hogs;
+	map_size = sizeof(*sh) + (nr_hogs + total) * sizeof(uint64_t);
+	sh = shared_alloc(map_size);
+	/* keep the latency buffer itself out of swap */
+	if (mlock(sh, map_size))
+		perror("mlock");
+	lat = sh->elapsed + nr_hogs;
+	pids = calloc(nr_hogs, sizeof(*pids));
+	if (!pids)
+		die("malloc");
+	if (pipe(ready) || pipe(go))
+		die("pipe");
+
+	for (i = 0; i < nr_hogs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0)
+			die("fork");
+		if (!pids[i]) {
+			close(go[1]);
+			run_hog(sh, lat + (size_t)i * per_hog, i,
+				ready[1], go[0]);
+		}
+	}
+
+	for (i = 0; i < nr_hogs; i++)
+		if (read(ready[0], &c, 1) != 1) {
+			fprintf(stderr, "child failed to start\n");
+			kill(0, SIGKILL);
+		}
+	have_stats = !get_stats(&before);
+	close(go[1]);	/* start everybody at once */
+
+	for (i = 0; i < nr_hogs; i++) {
+		int status;
+
+		waitpid(pids[i], &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			fprintf(stderr, "hog %d failed\n", i);
+			kill(0, SIGKILL);
+		}
+		if (sh->elapsed[i] > elapsed)
+			elapsed = sh->elapsed[i];
+	}
+	if (have_stats)
+		have_stats = !get_stats(&after);
+
+	printf("hogs %d, region %zu MB, passes %d, %d%% zero\n",
+	       nr_hogs, region_mb, passes, compress_pct);
+	printf("page touches/sec: %.0f\n", total * 1e9 / elapsed);
+	print_latency("touch latency", lat, total);
+	printf("swap-ins/sec: %.0f (%llu major faults)\n",
+	       sh->majflt * 1e9 / elapsed, (unsigned long long)sh->majflt);
+	if (have_stats) {
+		uint64_t r = after.num_reads - before.num_reads;
+		uint64_t w = after.num_writes - before.num_writes;
+
+		printf("%s: pages/sec out: %.0f, in: %.0f, "
+		       "failed writes: %llu\n", device, w * 1e9 / elapsed,
+		       r * 1e9 / elapsed, (unsigned long long)
+		       (after.failed_writes - before.failed_writes));
+		printf("%s: %u pages stored in %u pages with %.16s, "
+		       "%u zero, %u same-filled, %u deduplicated\n", device,
+		       after.pages_stored, after.pages_used, after.compressor,
+		       after.pages_zero, after.pages_same, after.pages_dup);
+		if (after.bd_writes)
+			printf("%s: %u pages on backing device, pages/sec "
+			       "written back: %.0f, read back: %.0f\n", device,
+			       after.pages_wb, (after.bd_writes -
+			       before.bd_writes) * 1e9 / elapsed,
+			       (after.bd_reads - before.bd_reads) * 1e9 /
+			       elapsed);
+	}
+	return 0;
+}
@@ -0,0 +1,278 @@
+/*
+ * read-bench.c -- cold parallel read throughput of a filesystem tree
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Measures how squashfs reads scale when several processes decompress
+ * at once, the way a boot reads the root filesystem.  The regular files
+ * under the given paths are cut into -c KB chunks and each -p process
+ * count reads all of them, process i taking chunks i, i + N, i + 2N,
+ * ..., so that they never read the same data.  The page cache is
+ * dropped before each count, which needs root; -w keeps it to measure
+ * warm reads.  The MB/s of each count are printed.
+ *
+ * -s measures every path on its own and labels it with the compressor
+ * of its squashfs, to compare one tree packed with several compressors:
+ *
+ *	read-bench -p 1,2,4 /mnt/squashfs
+ *	read-bench -s -p 1 /mnt/zlib /mnt/lzo /mnt/lzma
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <mntent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../include/bench.h"
+
+#define MAX_COUNTS	16
+
+#define SQUASHFS_MAGIC		0x73717368
+#define SQUASHFS_COMP_OFFSET	20
+
+struct chunk {
+	int file;
+	off_t offset;
+	size_t len;
+};
+
+static char **files;
+static int nr_files;
+static struct chunk *chunks;
+static int nr_chunks;
+static size_t chunk_size = 256 << 10;
+static uint64_t total_bytes;
+static int cold = 1;
+
+static int add_file(const char *path, const struct stat *st, int type,
+		    struct FTW *ftw)
+{
+	off_t off;
+
+	(void)ftw;
+	if (type != FTW_F || !S_ISREG(st->st_mode) || !st->st_size)
+		return 0;
+
+	files = realloc(files, (nr_files + 1) * sizeof(*files));
+	if (!files || !(files[nr_files] = strdup(path)))
+		die("malloc");
+
+	for (off = 0; off < st->st_size; off += chunk_size) {
+		chunks = realloc(chunks, (nr_chunks + 1) * sizeof(*chunks));
+		if (!chunks)
+			die("malloc");
+		chunks[nr_chunks].file = nr_files;
+		chunks[nr_chunks].offset = off;
+		chunks[nr_chunks].len = st->st_size - off < (off_t)chunk_size ?
+					(size_t)(st->st_size - off) : chunk_size;
+		nr_chunks++;
+	}
+	total_bytes += st->st_size;
+	nr_files++;
+	return 0;
+}
+
+/* Compressor of the squashfs @path is on, from its superblock */
+static const char *compressor(const char *path)
+{
+	static const char *const names[] = {
+		"unknown", "zlib", "lzma", "lzo", "xz"
+	};
+	unsigned char sb[SQUASHFS_COMP_OFFSET + 2];
+	const char *name = "not squashfs";
+	struct stat st, dev;
+	struct mntent *m;
+	FILE *f;
+	int fd, id;
+
+	if (stat(path, &st))
+		die(path);
+	f = setmntent("/proc/mounts", "r");
+	if (!f)
+		return "unknown";
+	while ((m = getmntent(f))) {
+		if (strcmp(m->mnt_type, "squashfs") ||
+		    stat(m->mnt_fsname, &dev) || dev.st_rdev != st.st_dev)
+			continue;
+		fd = open(m->mnt_fsname, O_RDONLY);
+		if (fd < 0 || pread(fd, sb, sizeof(sb), 0) != sizeof(sb)) {
+			name = "unknown";
+		} else if ((sb[0] | sb[1] << 8 | sb[2] << 16 |
+			    (uint32_t)sb[3] << 24) == SQUASHFS_MAGIC) {
+			id = sb[SQUASHFS_COMP_OFFSET] |
+				sb[SQUASHFS_COMP_OFFSET + 1] << 8;
+			name = names[id < 5 ? id : 0];
+		}
+		if (fd >= 0)
+			close(fd);
+		break;
+	}
+	endmntent(f);
+	return name;
+}
+
+static void drop_caches(void)
+{
+	int fd;
+
+	sync();
+	fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if (fd < 0 || write(fd, "3\n", 2) != 2)
+		die("/proc/sys/vm/drop_caches");
+	close(fd);
+}
+
+static void reader(int index, int nr_procs)
+{
+	char *buf = malloc(chunk_size);
+	int i, fd = -1, cur = -1;
+	ssize_t ret;
+	size_t done;
+
+	if (!buf)
+		die("malloc");
+
+	for (i = index; i < nr_chunks; i += nr_procs) {
+		struct chunk *c = &chunks[i];
+
+		if (c->file != cur) {
+			if (fd >= 0)
+				close(fd);
+			fd = open(files[c->file], O_RDONLY);
+			if (fd < 0)
+				die(files[c->file]);
+			cur = c->file;
+		}
+		for (done = 0; done < c->len; done += ret) {
+			ret = pread(fd, buf + done, c->len - done,
+				    c->offset + done);
+			if (ret < 0)
+				die("pread");
+			if (!ret)
+				break;
+		}
+	}
+	exit(0);
+}
+
+static double run(int nr_procs)
+{
+	uint64_t start;
+	int i, status, failed = 0;
+	pid_t pid;
+
+	if (cold)
+		drop_caches();
+	fflush(stdout);
+
+	start = now_ns();
+	for (i = 0; i < nr_procs; i++) {
+		pid = fork();
+		if (pid < 0)
+			die("fork");
+		if (!pid)
+			reader(i, nr_procs);
+	}
+	for (i = 0; i < nr_procs; i++) {
+		if (wait(&status) < 0)
+			die("wait");
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			failed = 1;
+	}
+	if (failed) {
+		fprintf(stderr, "reader failed\n");
+		exit(1);
+	}
+	return (now_ns() - start) / 1e9;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-p procs[,procs...]] [-c chunk KB] [-s] "
+		"[-w] path...\n", prog);
+	exit(1);
+}
+
+static void bench(char **paths, int nr_paths, int *counts, int nr_counts)
+{
+	double secs;
+	int i;
+
+	for (i = 0; i < nr_files; i++)
+		free(files[i]);
+	nr_files = nr_chunks = 0;
+	total_bytes = 0;
+	for (i = 0; i < nr_paths; i++)
+		if (nftw(paths[i], add_file, 16, FTW_PHYS))
+			die(paths[i]);
+	if (!nr_chunks) {
+		fprintf(stderr, "no data to read\n");
+		exit(1);
+	}
+
+	printf("%d files, %.1f MB, %zu KB chunks, %s reads\n", nr_files,
+	       total_bytes / 1048576.0, chunk_size >> 10,
+	       cold ? "cold" : "warm");
+	printf("%6s %10s %10s\n", "procs", "secs", "MB/s");
+	for (i = 0; i < nr_counts; i++) {
+		secs = run(counts[i]);
+		printf("%6d %10.3f %10.1f\n", counts[i], secs,
+		       total_bytes / 1048576.0 / secs);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int counts[MAX_COUNTS] = { 1, 2, 4 }, nr_counts = 3;
+	int opt, i, separate = 0;
+
+	while ((opt = getopt(argc, argv, "p:c:sw")) != -1) {
+		switch (opt) {
+		case 'p':
+			nr_counts = parse_list(optarg, counts, MAX_COUNTS, 1);
+			if (nr_counts < 0)
+				usage(argv[0]);
+			break;
+		case 'c':
+			chunk_size = (size_t)atoi(optarg) << 10;
+			break;
+		case 's':
+			separate = 1;
+			break;
+		case 'w':
+			cold = 0;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind == argc || !nr_counts || !chunk_size)
+		usage(argv[0]);
+
+	if (!separate) {
+		bench(argv + optind, argc - optind, counts, nr_counts);
+		return 0;
+	}
+
+	for (i = optind; i < argc; i++) {
+		printf("%s%s (%s)\n", i > optind ? "\n" : "", argv[i],
+		       compressor(argv[i]));
+		bench(argv + i, 1, counts, nr_counts);
+	}
+	return 0;
+}
@@ -0,0 +1,249 @@
+/*
+ * fault-around-bench.c -- page faults and startup time of loading a library
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Measures what fault-around saves when a program starts: how long a
+ * fresh process takes to dlopen() a library whose pages are all in the
+ * page cache, and how many minor faults it takes to do so.  With -t the
+ * process also reads every page the library mapped, like a program that
+ * runs through most of its text.  The pgfault_around vmstat counter
+ * shows how many pages were mapped around the faults.  A first run that
+ * is not counted brings the library into the page cache.
+ *
+ * -w lists fault_around_kb window sizes to compare.  Each is written to
+ * the bdi of the library's filesystem, or to the "default" bdi for
+ * filesystems without a block device like yaffs2, so this needs root.
+ * The old size is restored at the end.
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef major
+#include <sys/sysmacros.h>
+#endif
+
+#include "../include/bench.h"
+
+#define MAX_WINDOWS	16
+
+static int runs = 10;
+static int touch;
+
+struct result {
+	uint64_t ns;
+	long minflt;
+	long majflt;
+	unsigned long around;
+};
+
+static unsigned long vmstat(const char *name)
+{
+	unsigned long val = 0, v;
+	char key[64];
+	FILE *f;
+
+	f = fopen("/proc/vmstat", "r");
+	if (!f)
+		return 0;
+	while (fscanf(f, "%63s %lu", key, &v) == 2)
+		if (!strcmp(key, name)) {
+			val = v;
+			break;
+		}
+	fclose(f);
+	return val;
+}
+
+/* Read a byte from every page of the mappings of @lib */
+static void touch_library(const char *lib)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	unsigned long start, end;
+	char line[512], path[256], perms[8];
+	volatile char sum = 0;
+	FILE *f;
+
+	f = fopen("/proc/self/maps", "r");
+	if (!f)
+		die("/proc/self/maps");
+	while (fgets(line, sizeof(line), f)) {
+		path[0] = '\0';
+		if (sscanf(line, "%lx-%lx %7s %*s %*s %*s %255s", &start, &end,
+			   perms, path) < 3)
+			continue;
+		if (perms[0] != 'r' || !strstr(path, lib))
+			continue;
+		for (; start < end; start += page)
+			sum += *(volatile char *)start;
+	}
+	fclose(f);
+}
+
+static int run_child(const char *lib)
+{
+	const char *base = strrchr(lib, '/');
+
+	if (!dlopen(lib, RTLD_NOW)) {
+		fprintf(stderr, "%s\n", dlerror());
+		return 1;
+	}
+	if (touch)
+		touch_library(base ? base + 1 : lib);
+	return 0;
+}
+
+static void run_once(char *self, const char *lib, struct result *res)
+{
+	char *argv[] = { self, touch ? "-t" : "-r", "-c", (char *)lib, NULL };
+	unsigned long around = vmstat("pgfault_around");
+	struct rusage ru;
+	uint64_t start;
+	int status;
+	pid_t pid;
+
+	start = now_ns();
+	pid = fork();
+	if (pid < 0)
+		die("fork");
+	if (!pid) {
+		execv("/proc/self/exe", argv);
+		_exit(127);
+	}
+	if (wait4(pid, &status, 0, &ru) < 0)
+		die("wait4");
+	if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		fprintf(stderr, "loading %s failed\n", lib);
+		exit(1);
+	}
+
+	res->ns += now_ns() - start;
+	res->minflt += ru.ru_minflt;
+	res->majflt += ru.ru_majflt;
+	res->around += vmstat("pgfault_around") - around;
+}
+
+static void knob_path(const char *lib, char *buf, size_t len)
+{
+	struct stat st;
+
+	if (stat(lib, &st))
+		die(lib);
+	snprintf(buf, len, "/sys/class/bdi/%u:%u/fault_around_kb",
+		 major(st.st_dev), minor(st.st_dev));
+	if (access(buf, F_OK))
+		snprintf(buf, len, "/sys/class/bdi/default/fault_around_kb");
+}
+
+static int knob_read(const char *knob)
+{
+	FILE *f = fopen(knob, "r");
+	int kb;
+
+	if (!f || fscanf(f, "%d", &kb) != 1)
+		die(knob);
+	fclose(f);
+	return kb;
+}
+
+static void knob_write(const char *knob, int kb)
+{
+	FILE *f = fopen(knob, "w");
+
+	if (!f || fprintf(f, "%d\n", kb) < 0 || fclose(f))
+		die(knob);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n runs] [-t] [-w kb[,kb...]] library\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int windows[MAX_WINDOWS], nr_windows = 0, old_kb = -1;
+	char knob[128], *lib;
+	int opt, i, w, child = 0;
+
+	while ((opt = getopt(argc, argv, "n:trcw:")) != -1) {
+		switch (opt) {
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		case 't':
+			touch = 1;
+			break;
+		case 'r':
+			touch = 0;
+			break;
+		case 'c':	/* internal: the exec'd child */
+			child = 1;
+			break;
+		case 'w':
+			nr_windows = parse_list(optarg, windows, MAX_WINDOWS,
+						0);
+			if (nr_windows < 0)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || runs <= 0)
+		usage(argv[0]);
+	lib = argv[optind];
+
+	if (child)
+		return run_child(lib);
+
+	knob_path(lib, knob, sizeof(knob));
+	if (nr_windows)
+		old_kb = knob_read(knob);
+	else
+		windows[nr_windows++] = -1;
+
+	printf("%s, %d runs%s, knob %s\n", lib, runs,
+	       touch ? ", all pages touched" : "", knob);
+	printf("%-10s %10s %10s %8s %10s\n", "window_kb", "time_ms",
+	       "minflt", "majflt", "around");
+
+	for (w = 0; w < nr_windows; w++) {
+		struct result warm = { 0 }, res = { 0 };
+
+		if (windows[w] >= 0)
+			knob_write(knob, windows[w]);
+
+		run_once(argv[0], lib, &warm);
+		for (i = 0; i < runs; i++)
+			run_once(argv[0], lib, &res);
+
+		if (windows[w] >= 0)
+			printf("%-10d ", knob_read(knob));
+		else
+			printf("%-10s ", "current");
+		printf("%10.2f %10ld %8ld %10lu\n", res.ns / 1e6 / runs,
+		       res.minflt / runs, res.majflt / runs,
+		       res.around / runs);
+	}
+
+	if (old_kb >= 0)
+		knob_write(knob, old_kb);
+	return 0;
+}
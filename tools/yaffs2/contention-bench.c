@@ -0,0 +1,281 @@
+/*
+ * contention-bench.c -- yaffs2 read latency with concurrent writers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Measures how long yaffs2 readers wait while other processes write.  A
+ * directory is filled with files first; then, for each writer count given
+ * with -w, that many writers run next to a fixed number of readers for a
+ * few seconds.
+ *
+ * A reader drops a random page of a random file from the page cache and
+ * reads it back, so that every read goes to ->readpage and the NAND.  Every
+ * 16th operation lists the directory and stats a file in it instead.  Each
+ * writer keeps overwriting a file of its own and fsyncs it every megabyte,
+ * which keeps the garbage collector busy once the device has filled up.
+ * Each run prints the reader operations per second, the writer throughput
+ * and the latency of the reader operations.
+ *
+ * nandsim is enough, e.g. a 128 MiB device with 2 KiB pages:
+ *
+ *	modprobe nandsim first_id_byte=0x20 second_id_byte=0xa1 \
+ *		third_id_byte=0x00 fourth_id_byte=0x15
+ *	mount -t yaffs2 /dev/mtdblock0 /mnt
+ *	contention-bench -r 4 -w 0,1,2,4 /mnt/bench
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../include/bench.h"
+
+#define MAX_COUNTS	16
+#define MAX_SAMPLES	(1 << 16)	/* latencies kept per reader */
+#define PAGE		4096
+#define WRITE_SIZE	(64 << 10)
+
+static const char *dir;
+static int nr_files = 32;
+static size_t file_size = 256 << 10;
+static size_t writer_size = 4 << 20;
+static int seconds = 10;
+
+static void write_all(int fd, const char *buf, size_t len, off_t off)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = pwrite(fd, buf, len, off);
+		if (ret < 0)
+			die("pwrite");
+		buf += ret;
+		len -= ret;
+		off += ret;
+	}
+}
+
+static void setup(void)
+{
+	char path[512], *buf;
+	struct stat st;
+	size_t off;
+	int i, fd;
+
+	if (mkdir(dir, 0755) && errno != EEXIST)
+		die(dir);
+	buf = malloc(WRITE_SIZE);
+	if (!buf)
+		die("malloc");
+	memset(buf, 0x5a, WRITE_SIZE);
+
+	for (i = 0; i < nr_files; i++) {
+		snprintf(path, sizeof(path), "%s/file-%d", dir, i);
+		if (!stat(path, &st) && (size_t)st.st_size == file_size)
+			continue;
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			die(path);
+		for (off = 0; off < file_size; off += WRITE_SIZE)
+			write_all(fd, buf, file_size - off < WRITE_SIZE ?
+				  file_size - off : WRITE_SIZE, off);
+		if (fsync(fd))
+			die("fsync");
+		close(fd);
+	}
+	free(buf);
+	sync();
+}
+
+static void list_dir(void)
+{
+	DIR *d = opendir(dir);
+
+	if (!d)
+		die(dir);
+	while (readdir(d))
+		;
+	closedir(d);
+}
+
+/* Counts its operations in *ops and keeps the first MAX_SAMPLES latencies */
+static void reader(int index, uint64_t deadline, uint64_t *ops, uint64_t *lat)
+{
+	char path[512], buf[PAGE];
+	unsigned int seed = getpid() ^ index;
+	uint64_t start;
+	struct stat st;
+	off_t off;
+	int fd;
+
+	while ((start = now_ns()) < deadline) {
+		snprintf(path, sizeof(path), "%s/file-%d", dir,
+			 rand_r(&seed) % nr_files);
+		if ((*ops & 15) == 15) {
+			list_dir();
+			if (stat(path, &st))
+				die(path);
+		} else {
+			fd = open(path, O_RDONLY);
+			if (fd < 0)
+				die(path);
+			off = (off_t)(rand_r(&seed) % (file_size / PAGE)) * PAGE;
+			posix_fadvise(fd, off, PAGE, POSIX_FADV_DONTNEED);
+			if (pread(fd, buf, PAGE, off) < 0)
+				die("pread");
+			close(fd);
+		}
+		if (*ops < MAX_SAMPLES)
+			lat[*ops] = now_ns() - start;
+		(*ops)++;
+	}
+	exit(0);
+}
+
+/* Counts the bytes it wrote in *bytes */
+static void writer(int index, uint64_t deadline, uint64_t *bytes)
+{
+	char path[512], *buf;
+	size_t off = 0;
+	int fd;
+
+	buf = malloc(WRITE_SIZE);
+	if (!buf)
+		die("malloc");
+	memset(buf, index, WRITE_SIZE);
+	snprintf(path, sizeof(path), "%s/writer-%d", dir, index);
+	fd = open(path, O_WRONLY | O_CREAT, 0644);
+	if (fd < 0)
+		die(path);
+
+	while (now_ns() < deadline) {
+		write_all(fd, buf, WRITE_SIZE, off);
+		*bytes += WRITE_SIZE;
+		off += WRITE_SIZE;
+		if (!(off % (1 << 20)) && fsync(fd))
+			die("fsync");
+		if (off >= writer_size)
+			off = 0;
+	}
+	close(fd);
+	exit(0);
+}
+
+static void run(int nr_readers, int nr_writers)
+{
+	int i, status, failed = 0, nr = nr_readers + nr_writers;
+	uint64_t *count, *lat, deadline, ops = 0, bytes = 0, samples;
+	size_t map_size, total = 0;
+	pid_t pid;
+
+	/* per process counts, then each reader's latencies */
+	map_size = (nr + (size_t)nr_readers * MAX_SAMPLES) * sizeof(*count);
+	count = shared_alloc(map_size);
+	lat = count + nr;
+	fflush(stdout);
+
+	deadline = now_ns() + (uint64_t)seconds * 1000000000ull;
+	for (i = 0; i < nr; i++) {
+		pid = fork();
+		if (pid < 0)
+			die("fork");
+		if (!pid) {
+			if (i < nr_readers)
+				reader(i, deadline, &count[i],
+				       lat + (size_t)i * MAX_SAMPLES);
+			else
+				writer(i - nr_readers, deadline, &count[i]);
+		}
+	}
+	for (i = 0; i < nr; i++) {
+		if (wait(&status) < 0)
+			die("wait");
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			failed = 1;
+	}
+	if (failed) {
+		fprintf(stderr, "benchmark process failed\n");
+		exit(1);
+	}
+
+	for (i = 0; i < nr_readers; i++) {
+		ops += count[i];
+		samples = count[i] < MAX_SAMPLES ? count[i] : MAX_SAMPLES;
+		memmove(lat + total, lat + (size_t)i * MAX_SAMPLES,
+			samples * sizeof(*lat));
+		total += samples;
+	}
+	for (; i < nr; i++)
+		bytes += count[i];
+
+	printf("%d writers: %.0f reads/s, %.2f MB/s written\n", nr_writers,
+	       ops / (double)seconds, bytes / 1048576.0 / seconds);
+	print_latency("  read latency", lat, total);
+	munmap(count, map_size);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-r readers] [-w writers[,writers...]] "
+		"[-t secs] [-n files] [-s file KB] [-W writer KB] dir\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int counts[MAX_COUNTS] = { 0, 1, 2 }, nr_counts = 3;
+	int opt, i, nr_readers = 4;
+
+	while ((opt = getopt(argc, argv, "r:w:t:n:s:W:")) != -1) {
+		switch (opt) {
+		case 'r':
+			nr_readers = atoi(optarg);
+			break;
+		case 'w':
+			nr_counts = parse_list(optarg, counts, MAX_COUNTS, 0);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'n':
+			nr_files = atoi(optarg);
+			break;
+		case 's':
+			file_size = (size_t)atoi(optarg) << 10;
+			break;
+		case 'W':
+			writer_size = (size_t)atoi(optarg) << 10;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || nr_readers <= 0 || seconds <= 0 ||
+	    nr_files <= 0 || file_size < PAGE || writer_size < WRITE_SIZE ||
+	    nr_counts <= 0)
+		usage(argv[0]);
+	dir = argv[optind];
+
+	setup();
+
+	printf("%d readers, %d files of %zu KB, %d s per run\n", nr_readers,
+	       nr_files, file_size >> 10, seconds);
+	for (i = 0; i < nr_counts; i++)
+		run(nr_readers, counts[i]);
+	return 0;
+}